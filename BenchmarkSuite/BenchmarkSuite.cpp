@@ -0,0 +1,333 @@
+/*  The benchmark suite runs every case of a manifest through the renderers (RayTracerAss3 and Stage5),
+	checks each image against its reference and collects the renderers' -benchmark lines into one results table.
+	It can also compare two results tables and flag the cases that got slower than the noise allows.
+
+	BenchmarkSuite [-manifest Benchmarks/standard.txt] [-bin Release] [-output Outputs/benchmark_results.csv]
+	BenchmarkSuite -compare old.csv new.csv [-noise 5]
+
+	Run it from the solution directory (the manifest's scene and reference paths are relative to it), Outputs must exist.
+*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Manifest.h"
+#include "ResultTable.h"
+
+#ifdef _WIN32
+#define PATH_SEPARATOR "\\"
+#define EXE_SUFFIX ".exe"
+#else
+#define PATH_SEPARATOR "/"
+#define EXE_SUFFIX ""
+#endif
+
+// the renderer writes each case's timings here before they're copied into the results table
+#define CASE_BENCHMARK_FILE "Outputs/benchmark_case.csv"
+
+// columns of a renderer's -benchmark CSV line (see writeBenchmark), the results table has these after its own
+static const char* rendererColumns[] = { "program", "scene", "width", "height", "samples", "blockSize", "device", "mode",
+	"setupMs", "loadMs", "bvhMs", "uploadMs", "writeMs", "numRuns", "minMs", "medianMs", "p95Ms", "maxMs",
+	"kernelMedianMs", "readbackMedianMs", "runMs", "mae", "maxDiff", "passed",
+	"primaryRays", "reflectionRays", "refractionRays", "shadowRays", "shadowCacheHits", "nodeTests", "sphereTests", "boxTests", "hits",
+	"raysPerSample", "mraysPerSecond", "testsPerRay" };
+static const int numRendererColumns = sizeof(rendererColumns) / sizeof(rendererColumns[0]);
+
+
+// the command line that renders a case, the renderer's console output goes to a log next to the image
+static std::string caseCommand(const BenchmarkCase& c, const char* binDirectory, int runs, bool measured)
+{
+	char command[4096];
+	sprintf(command, "%s" PATH_SEPARATOR "%s" EXE_SUFFIX " -runs %d -size %d %d -samples %d -blockSize %d -input %s -output Outputs/benchmark_%s.bmp",
+		binDirectory, backendProgram(c.backend), runs, c.width, c.height, c.samples, c.blockSize, c.scene, c.name);
+	std::string line = command;
+
+	if (measured)
+	{
+		line += " -benchmark " CASE_BENCHMARK_FILE;
+		if (c.reference[0] != '\0')
+		{
+			sprintf(command, " -compare %s -compareThreshold %g -compareDiff Outputs/benchmark_%s_diff.bmp", c.reference, c.maxMae, c.name);
+			line += command;
+		}
+	}
+
+	if (c.extraArgs[0] != '\0')
+	{
+		line += " ";
+		line += c.extraArgs;
+	}
+
+	sprintf(command, " %s Outputs/benchmark_%s.log 2>&1", measured ? ">>" : ">", c.name);
+	line += command;
+	return line;
+}
+
+
+// run a case's warm-up launches then its measured launch, and add its row to the results
+static void runCase(const BenchmarkCase& c, const char* binDirectory, ResultTable* results)
+{
+	printf("%s: %s %s %dx%dx%d", c.name, c.backend, c.scene, c.width, c.height, c.samples);
+	fflush(stdout);
+
+	// warm-up launches are thrown away, they settle clocks and caches (and Stage5's program cache)
+	for (int i = 0; i < c.warmup; ++i)
+	{
+		std::system(caseCommand(c, binDirectory, 1, false).c_str());
+	}
+
+	remove(CASE_BENCHMARK_FILE);
+	int exitCode = std::system(caseCommand(c, binDirectory, c.runs, true).c_str());
+
+	// the renderer's line has everything measured, without one the launch didn't get far enough to write it
+	ResultTable caseTable;
+	// (checked for first so a missing one isn't reported as an error of its own)
+	FILE* caseFile = fopen(CASE_BENCHMARK_FILE, "r");
+	bool written = caseFile != NULL;
+	if (caseFile != NULL) fclose(caseFile);
+	written = written && readResultTable(CASE_BENCHMARK_FILE, &caseTable) && caseTable.rows.size() == 1;
+	remove(CASE_BENCHMARK_FILE);
+
+	const char* status = "ok";
+	if (!written) status = "error";
+	else if (getField(&caseTable, 0, "passed") == "0") status = "image failed";
+	else if (exitCode != 0) status = "error";
+
+	char maxMae[32];
+	sprintf(maxMae, "%g", c.maxMae);
+
+	std::vector<std::string> row;
+	row.push_back(c.name);
+	row.push_back(c.backend);
+	row.push_back(status);
+	row.push_back(c.reference[0] != '\0' ? c.reference : "");
+	row.push_back(c.reference[0] != '\0' ? maxMae : "");
+	for (int i = 0; i < numRendererColumns; ++i)
+	{
+		row.push_back(written ? getField(&caseTable, 0, rendererColumns[i]) : "");
+	}
+
+	// a failed launch still says what it was meant to render
+	if (!written)
+	{
+		char number[16];
+		row[findColumn(results, "scene")] = c.scene;
+		sprintf(number, "%d", c.width);
+		row[findColumn(results, "width")] = number;
+		sprintf(number, "%d", c.height);
+		row[findColumn(results, "height")] = number;
+		sprintf(number, "%d", c.samples);
+		row[findColumn(results, "samples")] = number;
+		sprintf(number, "%d", c.blockSize);
+		row[findColumn(results, "blockSize")] = number;
+	}
+
+	results->rows.push_back(row);
+
+	// cases run with -counters also say how fast the rays went
+	if (written && !getField(&caseTable, 0, "mraysPerSecond").empty()) printf(": median %s ms, %sM rays per second, %s\n", getField(&caseTable, 0, "medianMs").c_str(), getField(&caseTable, 0, "mraysPerSecond").c_str(), status);
+	else if (written) printf(": median %s ms, %s\n", getField(&caseTable, 0, "medianMs").c_str(), status);
+	else printf(": %s, see Outputs/benchmark_%s.log\n", status, c.name);
+}
+
+
+// print a results table as aligned text
+static void printResults(const ResultTable* results)
+{
+	printf("\n%-32s %-7s %-13s %10s %10s %10s %10s\n", "case", "backend", "status", "min ms", "median ms", "p95 ms", "MAE");
+	for (size_t i = 0; i < results->rows.size(); ++i)
+	{
+		const std::string& mae = getField(results, i, "mae");
+		printf("%-32s %-7s %-13s %10s %10s %10s %10s\n", getField(results, i, "case").c_str(), getField(results, i, "backend").c_str(),
+			getField(results, i, "status").c_str(), getField(results, i, "minMs").c_str(), getField(results, i, "medianMs").c_str(),
+			getField(results, i, "p95Ms").c_str(), mae.empty() ? "-" : mae.c_str());
+	}
+}
+
+
+// run every case of the manifest and write the results table, returns the exit code
+static int runManifest(const char* manifestFilename, const char* binDirectory, const char* outputFilename)
+{
+	std::vector<BenchmarkCase> cases;
+	if (!loadManifest(manifestFilename, &cases))
+	{
+		return 1;
+	}
+
+	ResultTable results;
+	const char* suiteColumns[] = { "case", "backend", "status", "reference", "maxMae" };
+	for (int i = 0; i < 5; ++i) results.columns.push_back(suiteColumns[i]);
+	for (int i = 0; i < numRendererColumns; ++i) results.columns.push_back(rendererColumns[i]);
+
+	printf("running %u case%s from %s with the renderers in %s\n", (unsigned int)cases.size(), cases.size() == 1 ? "" : "s", manifestFilename, binDirectory);
+	for (size_t i = 0; i < cases.size(); ++i)
+	{
+		runCase(cases[i], binDirectory, &results);
+	}
+
+	printResults(&results);
+
+	if (!writeResultTable(outputFilename, &results))
+	{
+		return 1;
+	}
+	printf("\nresults written to %s\n", outputFilename);
+
+	// every case has to have rendered, and rendered right
+	for (size_t i = 0; i < results.rows.size(); ++i)
+	{
+		if (getField(&results, i, "status") != "ok") return 1;
+	}
+	return 0;
+}
+
+
+// compare the median times of the cases two results tables share, returns the exit code (1 for any regression or failure)
+static int compareResults(const char* oldFilename, const char* newFilename, double noisePercent)
+{
+	ResultTable before, after;
+	if (!readResultTable(oldFilename, &before) || !readResultTable(newFilename, &after))
+	{
+		return 1;
+	}
+
+	if (findColumn(&before, "case") < 0 || findColumn(&after, "case") < 0)
+	{
+		printf("%s and %s have to be results tables written by BenchmarkSuite\n", oldFilename, newFilename);
+		return 1;
+	}
+
+	printf("%s -> %s, changes within %.1f%% are noise\n\n", oldFilename, newFilename, noisePercent);
+	printf("%-32s %12s %12s %9s  %s\n", "case", "old median", "new median", "change", "");
+
+	int regressions = 0, failures = 0, improvements = 0;
+	std::vector<bool> matched(before.rows.size(), false);
+	for (size_t i = 0; i < after.rows.size(); ++i)
+	{
+		const std::string& name = getField(&after, i, "case");
+
+		size_t j = 0;
+		while (j < before.rows.size() && getField(&before, j, "case") != name) ++j;
+
+		const std::string& status = getField(&after, i, "status");
+		if (status != "ok")
+		{
+			printf("%-32s %12s %12s %9s  FAILED (%s)\n", name.c_str(), "", "", "", status.c_str());
+			++failures;
+			if (j < before.rows.size()) matched[j] = true;
+			continue;
+		}
+
+		if (j == before.rows.size())
+		{
+			printf("%-32s %12s %12s %9s  new case\n", name.c_str(), "-", getField(&after, i, "medianMs").c_str(), "");
+			continue;
+		}
+		matched[j] = true;
+
+		// times of different work don't compare
+		const char* settings[] = { "scene", "width", "height", "samples", "blockSize", "mode" };
+		bool sameWork = true;
+		for (int k = 0; k < 6; ++k) sameWork = sameWork && getField(&before, j, settings[k]) == getField(&after, i, settings[k]);
+		if (!sameWork)
+		{
+			printf("%-32s %12s %12s %9s  settings differ, not compared\n", name.c_str(), "", "", "");
+			continue;
+		}
+
+		const std::string& oldMedian = getField(&before, j, "medianMs");
+		const std::string& newMedian = getField(&after, i, "medianMs");
+		if (oldMedian.empty() || newMedian.empty() || getField(&before, j, "status") != "ok")
+		{
+			printf("%-32s %12s %12s %9s  no old time to compare with\n", name.c_str(), oldMedian.c_str(), newMedian.c_str(), "");
+			continue;
+		}
+
+		double oldMs = atof(oldMedian.c_str());
+		double newMs = atof(newMedian.c_str());
+		double change = oldMs > 0.0 ? 100.0 * (newMs - oldMs) / oldMs : 0.0;
+
+		const char* verdict = "";
+		if (change > noisePercent)
+		{
+			verdict = "REGRESSION";
+			++regressions;
+		}
+		else if (change < -noisePercent)
+		{
+			verdict = "faster";
+			++improvements;
+		}
+
+		const char* device = "";
+		if (getField(&before, j, "device") != getField(&after, i, "device")) device = " (different device)";
+
+		printf("%-32s %12.3f %12.3f %+8.1f%%  %s%s\n", name.c_str(), oldMs, newMs, change, verdict, device);
+	}
+
+	for (size_t j = 0; j < before.rows.size(); ++j)
+	{
+		if (!matched[j]) printf("%-32s %12s %12s %9s  missing from %s\n", getField(&before, j, "case").c_str(), getField(&before, j, "medianMs").c_str(), "-", "", newFilename);
+	}
+
+	printf("\n%d regression%s, %d faster, %d failed\n", regressions, regressions == 1 ? "" : "s", improvements, failures);
+	return (regressions > 0 || failures > 0) ? 1 : 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+	const char* manifestFilename = "Benchmarks/standard.txt";
+	const char* binDirectory = "Release";
+	const char* outputFilename = "Outputs/benchmark_results.csv";
+
+	// compare mode: the two results tables and the percentage change that counts as noise
+	const char* oldFilename = NULL;
+	const char* newFilename = NULL;
+	double noisePercent = 5.0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-manifest") == 0 && i + 1 < argc)
+		{
+			manifestFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-bin") == 0 && i + 1 < argc)
+		{
+			binDirectory = argv[++i];
+		}
+		else if (strcmp(argv[i], "-output") == 0 && i + 1 < argc)
+		{
+			outputFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-compare") == 0 && i + 2 < argc)
+		{
+			oldFilename = argv[++i];
+			newFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-noise") == 0 && i + 1 < argc)
+		{
+			noisePercent = atof(argv[++i]);
+		}
+		else
+		{
+			fprintf(stderr, "unknown argument: %s\n", argv[i]);
+			fprintf(stderr, "usage: %s [-manifest file] [-bin directory] [-output file.csv]\n", argv[0]);
+			fprintf(stderr, "       %s -compare old.csv new.csv [-noise percent]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (oldFilename != NULL)
+	{
+		return compareResults(oldFilename, newFilename, noisePercent);
+	}
+
+	return runManifest(manifestFilename, binDirectory, outputFilename);
+}
@@ -0,0 +1,84 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include "Manifest.h"
+
+// the renderer that runs a backend's cases
+const char* backendProgram(const char* backend)
+{
+	if (strcmp(backend, "cpu") == 0) return "RayTracerAss3";
+	if (strcmp(backend, "opencl") == 0) return "Stage5";
+	return NULL;
+}
+
+
+// read the cases of a manifest, in order
+bool loadManifest(const char* filename, std::vector<BenchmarkCase>* cases)
+{
+	FILE* file = fopen(filename, "r");
+	if (file == NULL)
+	{
+		printf("Couldn't open the manifest %s\n", filename);
+		return false;
+	}
+
+	char line[1024];
+	int lineNumber = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), file))
+	{
+		++lineNumber;
+
+		// skip leading white space, blank lines and comments
+		const char* start = line + strspn(line, " \t\r\n");
+		if (*start == '\0' || *start == '#' || strncmp(start, "//", 2) == 0) continue;
+
+		BenchmarkCase c;
+		int consumed = 0;
+		if (sscanf(start, "%255s %255s %255s %d %d %d %d %d %d %255s %lf %n", c.name, c.backend, c.scene, &c.width, &c.height,
+			&c.samples, &c.blockSize, &c.warmup, &c.runs, c.reference, &c.maxMae, &consumed) < 11 || consumed == 0)
+		{
+			printf("%s:%d: expected name backend scene width height samples blockSize warmup runs reference maxMAE [arguments]\n", filename, lineNumber);
+			ok = false;
+			break;
+		}
+
+		// the rest of the line is passed to the renderer as it is
+		strncpy(c.extraArgs, start + consumed, MANIFEST_MAX_STRING - 1);
+		c.extraArgs[MANIFEST_MAX_STRING - 1] = '\0';
+		c.extraArgs[strcspn(c.extraArgs, "\r\n")] = '\0';
+
+		if (strcmp(c.reference, "-") == 0) c.reference[0] = '\0';
+
+		if (c.width <= 0 || c.height <= 0 || c.samples <= 0 || c.blockSize <= 0 || c.warmup < 0 || c.runs <= 0)
+		{
+			printf("%s:%d: sizes, samples, blockSize and runs must be positive\n", filename, lineNumber);
+			ok = false;
+			break;
+		}
+
+		if (backendProgram(c.backend) == NULL)
+		{
+			printf("%s:%d: unknown backend %s, expected cpu or opencl\n", filename, lineNumber, c.backend);
+			ok = false;
+			break;
+		}
+
+		for (size_t i = 0; i < cases->size(); ++i)
+		{
+			if (strcmp((*cases)[i].name, c.name) == 0)
+			{
+				printf("%s:%d: there is already a case called %s\n", filename, lineNumber, c.name);
+				ok = false;
+			}
+		}
+
+		cases->push_back(c);
+	}
+
+	fclose(file);
+	return ok;
+}
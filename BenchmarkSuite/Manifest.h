@@ -0,0 +1,33 @@
+#ifndef __MANIFEST_H
+#define __MANIFEST_H
+
+#include <vector>
+
+// longest name, path or argument list a case can have
+#define MANIFEST_MAX_STRING 256
+
+// one case of a benchmark manifest, a line of the file:
+// name backend scene width height samples blockSize warmup runs reference maxMAE [extra renderer arguments...]
+typedef struct BenchmarkCase
+{
+	char name[MANIFEST_MAX_STRING];			// unique name, used to match cases up between result files
+	char backend[MANIFEST_MAX_STRING];		// cpu (RayTracerAss3) or opencl (Stage5)
+	char scene[MANIFEST_MAX_STRING];		// scene file
+	int width, height;						// image size
+	int samples;							// anti-aliasing level
+	int blockSize;							// tile size
+	int warmup;								// launches before the measured one, thrown away (they also fill the kernel program cache)
+	int runs;								// runs of the measured launch (the first is left out of the summary when there's more than one)
+	char reference[MANIFEST_MAX_STRING];	// reference image to compare with, empty for none ("-" in the file)
+	double maxMae;							// most mean absolute error the image may have
+	char extraArgs[MANIFEST_MAX_STRING];	// anything else to pass to the renderer (eg. -wavefront)
+} BenchmarkCase;
+
+// read the cases of a manifest, in order (blank lines and lines starting with # or // are skipped)
+// prints the reason and returns false if the file can't be read or a line is malformed
+bool loadManifest(const char* filename, std::vector<BenchmarkCase>* cases);
+
+// the renderer that runs a backend's cases (RayTracerAss3 or Stage5), NULL for an unknown backend
+const char* backendProgram(const char* backend);
+
+#endif // __MANIFEST_H
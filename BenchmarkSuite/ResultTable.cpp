@@ -0,0 +1,140 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include "ResultTable.h"
+
+// split one CSV line into its fields (quoted fields may hold commas and doubled quotes, but not line breaks)
+static std::vector<std::string> splitCsvLine(const char* line)
+{
+	std::vector<std::string> fields(1);
+	bool quoted = false;
+
+	for (const char* c = line; *c && *c != '\r' && *c != '\n'; ++c)
+	{
+		if (quoted)
+		{
+			if (*c == '"' && c[1] == '"') fields.back() += *c++;
+			else if (*c == '"') quoted = false;
+			else fields.back() += *c;
+		}
+		else if (*c == '"') quoted = true;
+		else if (*c == ',') fields.push_back(std::string());
+		else fields.back() += *c;
+	}
+
+	return fields;
+}
+
+
+// read a CSV file with a header row
+bool readResultTable(const char* filename, ResultTable* table)
+{
+	FILE* file = fopen(filename, "r");
+	if (file == NULL)
+	{
+		printf("Couldn't open %s\n", filename);
+		return false;
+	}
+
+	table->columns.clear();
+	table->rows.clear();
+
+	char line[4096];
+	while (fgets(line, sizeof(line), file))
+	{
+		if (line[strspn(line, " \t\r\n")] == '\0') continue;
+
+		if (table->columns.empty()) table->columns = splitCsvLine(line);
+		else table->rows.push_back(splitCsvLine(line));
+	}
+
+	fclose(file);
+
+	if (table->columns.empty())
+	{
+		printf("%s is empty\n", filename);
+		return false;
+	}
+
+	return true;
+}
+
+
+// write a field, quoted if it needs to be
+static void writeCsvField(FILE* file, const std::string& field)
+{
+	if (field.find_first_of(",\"\r\n") == std::string::npos)
+	{
+		fputs(field.c_str(), file);
+		return;
+	}
+
+	fputc('"', file);
+	for (size_t i = 0; i < field.size(); ++i)
+	{
+		if (field[i] == '"') fputc('"', file);
+		fputc(field[i], file);
+	}
+	fputc('"', file);
+}
+
+
+static void writeCsvRow(FILE* file, const std::vector<std::string>& fields)
+{
+	for (size_t i = 0; i < fields.size(); ++i)
+	{
+		if (i > 0) fputc(',', file);
+		writeCsvField(file, fields[i]);
+	}
+	fputc('\n', file);
+}
+
+
+// write a table as CSV
+bool writeResultTable(const char* filename, const ResultTable* table)
+{
+	FILE* file = fopen(filename, "w");
+	if (file == NULL)
+	{
+		printf("Couldn't open %s to write the results to\n", filename);
+		return false;
+	}
+
+	writeCsvRow(file, table->columns);
+	for (size_t i = 0; i < table->rows.size(); ++i)
+	{
+		writeCsvRow(file, table->rows[i]);
+	}
+
+	bool ok = !ferror(file);
+	ok = (fclose(file) == 0) && ok;
+	if (!ok) printf("Couldn't write the results to %s\n", filename);
+	return ok;
+}
+
+
+// index of a column, -1 if the table doesn't have it
+int findColumn(const ResultTable* table, const char* name)
+{
+	for (size_t i = 0; i < table->columns.size(); ++i)
+	{
+		if (table->columns[i] == name) return (int)i;
+	}
+
+	return -1;
+}
+
+
+// a row's field in a column, "" if the row or column doesn't exist
+const std::string& getField(const ResultTable* table, size_t row, const char* column)
+{
+	static const std::string empty;
+
+	int index = findColumn(table, column);
+	if (index < 0 || row >= table->rows.size() || (size_t)index >= table->rows[row].size()) return empty;
+
+	return table->rows[row][index];
+}
@@ -0,0 +1,28 @@
+#ifndef __RESULT_TABLE_H
+#define __RESULT_TABLE_H
+
+#include <string>
+#include <vector>
+
+// a CSV file held as text: a header row of column names and a row per case
+typedef struct ResultTable
+{
+	std::vector<std::string> columns;
+	std::vector<std::vector<std::string> > rows;
+} ResultTable;
+
+// read a CSV file with a header row (fields may be quoted)
+// prints the reason and returns false if the file can't be read
+bool readResultTable(const char* filename, ResultTable* table);
+
+// write a table as CSV, quoting fields that need it
+// prints the reason and returns false if the file can't be written
+bool writeResultTable(const char* filename, const ResultTable* table);
+
+// index of a column, -1 if the table doesn't have it
+int findColumn(const ResultTable* table, const char* name);
+
+// a row's field in a column, "" if the row or column doesn't exist
+const std::string& getField(const ResultTable* table, size_t row, const char* column);
+
+#endif // __RESULT_TABLE_H
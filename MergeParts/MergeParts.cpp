@@ -0,0 +1,139 @@
+/*  Puts a frame that was rendered in parts (with -region and -tiles, see FramePart.h) back together.
+	Each part is a BMP with a .part file next to it saying where in the frame it goes, the parts can be rendered by
+	either renderer on as many processes and machines as there are parts.
+
+	MergeParts -output frame.bmp [-allowGaps] part.bmp [part.bmp ...]
+
+	Every pixel of the frame has to be in one of the parts unless -allowGaps is given (the rest are left black),
+	a pixel in more than one part keeps the last part's colour.
+*/
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "ImageIO.h"
+#include "FrameBuffer.h"
+#include "FramePart.h"
+
+int main(int argc, char* argv[])
+{
+	const char* outputFilename = NULL;
+	bool allowGaps = false;
+	std::vector<const char*> partFilenames;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-output") == 0 && i + 1 < argc)
+		{
+			outputFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-allowGaps") == 0)
+		{
+			allowGaps = true;
+		}
+		else
+		{
+			partFilenames.push_back(argv[i]);
+		}
+	}
+
+	if (outputFilename == NULL || partFilenames.empty())
+	{
+		printf("usage: MergeParts -output frame.bmp [-allowGaps] part.bmp [part.bmp ...]\n");
+		return 1;
+	}
+
+	FrameBuffer frameBuffer;
+	std::vector<unsigned char> covered;
+	int frameWidth = 0, frameHeight = 0;
+	unsigned long long overlapping = 0;
+
+	for (size_t p = 0; p < partFilenames.size(); ++p)
+	{
+		FramePart part;
+		if (!readFramePart(partFilenames[p], &part))
+		{
+			return 1;
+		}
+
+		// the first part says how big the frame is, the rest have to agree
+		if (p == 0)
+		{
+			frameWidth = part.frameWidth;
+			frameHeight = part.frameHeight;
+			if (!createFrameBuffer(&frameBuffer, frameWidth, frameHeight, false))
+			{
+				return 1;
+			}
+			covered.assign((size_t)frameWidth * frameHeight, 0);
+		}
+		else if (part.frameWidth != frameWidth || part.frameHeight != frameHeight)
+		{
+			printf("%s is part of a %dx%d frame, not a %dx%d one like %s\n", partFilenames[p], part.frameWidth, part.frameHeight, frameWidth, frameHeight, partFilenames[0]);
+			return 1;
+		}
+
+		int imageWidth, imageHeight;
+		unsigned int* image = read_bmp(partFilenames[p], &imageWidth, &imageHeight);
+		if (image == NULL)
+		{
+			return 1;
+		}
+		if (imageWidth != part.imageX1 - part.imageX0 || imageHeight != part.imageY1 - part.imageY0)
+		{
+			printf("%s is %dx%d, its .part file says %dx%d\n", partFilenames[p], imageWidth, imageHeight, part.imageX1 - part.imageX0, part.imageY1 - part.imageY0);
+			delete[] image;
+			return 1;
+		}
+
+		// only the pixels of the image that are in the part's region and tiles are the part's, the rest were never rendered
+		unsigned long long pixels = 0;
+		for (int y = part.imageY0; y < part.imageY1; ++y)
+		{
+			for (int x = part.imageX0; x < part.imageX1; ++x)
+			{
+				if (!inFramePart(&part, x, y)) continue;
+
+				size_t i = (size_t)y * frameWidth + x;
+				if (covered[i]) ++overlapping;
+				covered[i] = 1;
+				*framePixel(&frameBuffer.view, x, y) = image[(size_t)(y - part.imageY0) * imageWidth + (x - part.imageX0)];
+				++pixels;
+			}
+		}
+		delete[] image;
+
+		printf("%s: %llu pixels, region %d %d %d %d, tiles %d to %d of %dx%d\n", partFilenames[p], pixels,
+			part.x0, part.y0, part.x1, part.y1, part.firstTile, part.lastTile, part.tileSize, part.tileSize);
+	}
+
+	unsigned long long missing = 0;
+	for (size_t i = 0; i < covered.size(); ++i)
+	{
+		if (!covered[i]) ++missing;
+	}
+
+	if (overlapping > 0)
+	{
+		printf("%llu pixels were in more than one part\n", overlapping);
+	}
+	if (missing > 0)
+	{
+		printf("%llu pixels of the %dx%d frame weren't in any part%s\n", missing, frameWidth, frameHeight, allowGaps ? " (left black)" : "");
+		if (!allowGaps)
+		{
+			releaseFrameBuffer(&frameBuffer);
+			return 1;
+		}
+	}
+
+	write_bmp(outputFilename, frameBuffer.view.pixels, frameWidth, frameHeight, frameBuffer.view.stride);
+	printf("%dx%d frame written to %s from %u parts\n", frameWidth, frameHeight, outputFilename, (unsigned int)partFilenames.size());
+
+	releaseFrameBuffer(&frameBuffer);
+	return 0;
+}
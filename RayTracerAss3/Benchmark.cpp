@@ -0,0 +1,271 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "Benchmark.h"
+
+// summary of a set of times
+typedef struct BenchmarkStats
+{
+	double min, median, p95, max;
+} BenchmarkStats;
+
+
+// set everything to not measured and drop any runs
+void resetBenchmark(Benchmark* benchmark)
+{
+	benchmark->program = benchmark->scene = benchmark->device = benchmark->mode = "";
+	benchmark->width = benchmark->height = benchmark->samples = benchmark->blockSize = 0;
+	benchmark->setupMs = benchmark->loadMs = benchmark->bvhMs = benchmark->uploadMs = benchmark->writeMs = BENCHMARK_NOT_MEASURED;
+	benchmark->mae = BENCHMARK_NOT_MEASURED;
+	benchmark->maxDiff = 0;
+	benchmark->passed = true;
+	benchmark->counters = NULL;
+	benchmark->runs.clear();
+}
+
+
+// min, median, 95th percentile (nearest rank) and max of the runs after the first (or of the only run)
+// any run without the time makes the whole summary not measured
+static BenchmarkStats summarise(const Benchmark* benchmark, double BenchmarkRun::* time)
+{
+	BenchmarkStats stats = { BENCHMARK_NOT_MEASURED, BENCHMARK_NOT_MEASURED, BENCHMARK_NOT_MEASURED, BENCHMARK_NOT_MEASURED };
+
+	std::vector<double> times;
+	for (size_t i = (benchmark->runs.size() > 1) ? 1 : 0; i < benchmark->runs.size(); ++i)
+	{
+		if (benchmark->runs[i].*time < 0.0) return stats;
+		times.push_back(benchmark->runs[i].*time);
+	}
+	if (times.empty()) return stats;
+
+	std::sort(times.begin(), times.end());
+	size_t n = times.size();
+	stats.min = times[0];
+	stats.median = (n % 2) ? times[n / 2] : 0.5 * (times[n / 2 - 1] + times[n / 2]);
+	stats.p95 = times[(n * 95 + 99) / 100 - 1];
+	stats.max = times[n - 1];
+
+	return stats;
+}
+
+
+// write a string as a JSON string
+static void writeJsonString(FILE* file, const char* s)
+{
+	fputc('"', file);
+	for (; *s; ++s)
+	{
+		if (*s == '"' || *s == '\\') fprintf(file, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20) fprintf(file, "\\u%04x", *s);
+		else fputc(*s, file);
+	}
+	fputc('"', file);
+}
+
+
+// write a time in milliseconds as a JSON number (null if not measured)
+static void writeJsonTime(FILE* file, double ms)
+{
+	if (ms < 0.0) fprintf(file, "null");
+	else fprintf(file, "%.3f", ms);
+}
+
+
+// write a string as a CSV field, quoted if it needs to be
+static void writeCsvString(FILE* file, const char* s)
+{
+	if (!strpbrk(s, ",\"\r\n"))
+	{
+		fputs(s, file);
+		return;
+	}
+
+	fputc('"', file);
+	for (; *s; ++s)
+	{
+		if (*s == '"') fputc('"', file);
+		fputc(*s, file);
+	}
+	fputc('"', file);
+}
+
+
+// write a time in milliseconds as a CSV field (empty if not measured)
+static void writeCsvTime(FILE* file, double ms)
+{
+	if (ms >= 0.0) fprintf(file, "%.3f", ms);
+}
+
+
+static void writeJson(FILE* file, const Benchmark* b, const BenchmarkStats& total, const BenchmarkStats& kernel, const BenchmarkStats& readback)
+{
+	fprintf(file, "{\"program\":");
+	writeJsonString(file, b->program);
+	fprintf(file, ",\"scene\":");
+	writeJsonString(file, b->scene);
+	fprintf(file, ",\"width\":%d,\"height\":%d,\"samples\":%d,\"blockSize\":%d,\"device\":", b->width, b->height, b->samples, b->blockSize);
+	writeJsonString(file, b->device);
+	fprintf(file, ",\"mode\":");
+	writeJsonString(file, b->mode);
+
+	const char* phaseNames[] = { "setupMs", "loadMs", "bvhMs", "uploadMs", "writeMs" };
+	const double phases[] = { b->setupMs, b->loadMs, b->bvhMs, b->uploadMs, b->writeMs };
+	for (int i = 0; i < 5; ++i)
+	{
+		fprintf(file, ",\"%s\":", phaseNames[i]);
+		writeJsonTime(file, phases[i]);
+	}
+
+	fprintf(file, ",\"runs\":[");
+	for (size_t i = 0; i < b->runs.size(); ++i)
+	{
+		fprintf(file, "%s{\"totalMs\":", i ? "," : "");
+		writeJsonTime(file, b->runs[i].totalMs);
+		fprintf(file, ",\"kernelMs\":");
+		writeJsonTime(file, b->runs[i].kernelMs);
+		fprintf(file, ",\"readbackMs\":");
+		writeJsonTime(file, b->runs[i].readbackMs);
+		fprintf(file, "}");
+	}
+	fprintf(file, "]");
+
+	const char* statNames[] = { "minMs", "medianMs", "p95Ms", "maxMs" };
+	const double totals[] = { total.min, total.median, total.p95, total.max };
+	for (int i = 0; i < 4; ++i)
+	{
+		fprintf(file, ",\"%s\":", statNames[i]);
+		writeJsonTime(file, totals[i]);
+	}
+	fprintf(file, ",\"kernelMedianMs\":");
+	writeJsonTime(file, kernel.median);
+	fprintf(file, ",\"readbackMedianMs\":");
+	writeJsonTime(file, readback.median);
+
+	if (b->mae >= 0.0) fprintf(file, ",\"mae\":%.6f,\"maxDiff\":%d,\"passed\":%s", b->mae, b->maxDiff, b->passed ? "true" : "false");
+	else fprintf(file, ",\"mae\":null,\"maxDiff\":null,\"passed\":null");
+
+	// the counters as an object, with the samples that traced 1, 2, ... MAX_RAYS_CAST rays as an array
+	if (b->counters != NULL)
+	{
+		fprintf(file, ",\"counters\":{");
+		for (int i = 0; i < COUNT_DEPTH; ++i)
+		{
+			fprintf(file, "%s\"%s\":%llu", i ? "," : "", rayCounterName(i), b->counters->counts[i]);
+		}
+		fprintf(file, ",\"raysPerSample\":[");
+		for (int i = 0; i < MAX_RAYS_CAST; ++i)
+		{
+			fprintf(file, "%s%llu", i ? "," : "", b->counters->counts[COUNT_DEPTH + i]);
+		}
+		fprintf(file, "]}");
+
+		if (total.median >= 0.0) fprintf(file, ",\"mraysPerSecond\":%.3f", megaRaysPerSecond(b->counters, total.median));
+		else fprintf(file, ",\"mraysPerSecond\":null");
+		fprintf(file, ",\"testsPerRay\":%.3f", testsPerRay(b->counters));
+	}
+	else fprintf(file, ",\"counters\":null,\"mraysPerSecond\":null,\"testsPerRay\":null");
+	fprintf(file, "}\n");
+}
+
+
+static void writeCsv(FILE* file, bool header, const Benchmark* b, const BenchmarkStats& total, const BenchmarkStats& kernel, const BenchmarkStats& readback)
+{
+	if (header)
+	{
+		fprintf(file, "program,scene,width,height,samples,blockSize,device,mode,setupMs,loadMs,bvhMs,uploadMs,writeMs,"
+			"numRuns,minMs,medianMs,p95Ms,maxMs,kernelMedianMs,readbackMedianMs,runMs,mae,maxDiff,passed");
+		for (int i = 0; i < COUNT_DEPTH; ++i)
+		{
+			fprintf(file, ",%s", rayCounterName(i));
+		}
+		fprintf(file, ",raysPerSample,mraysPerSecond,testsPerRay\n");
+	}
+
+	writeCsvString(file, b->program);
+	fputc(',', file);
+	writeCsvString(file, b->scene);
+	fprintf(file, ",%d,%d,%d,%d,", b->width, b->height, b->samples, b->blockSize);
+	writeCsvString(file, b->device);
+	fputc(',', file);
+	writeCsvString(file, b->mode);
+
+	const double times[] = { b->setupMs, b->loadMs, b->bvhMs, b->uploadMs, b->writeMs };
+	for (int i = 0; i < 5; ++i)
+	{
+		fputc(',', file);
+		writeCsvTime(file, times[i]);
+	}
+
+	fprintf(file, ",%u", (unsigned int)b->runs.size());
+
+	const double stats[] = { total.min, total.median, total.p95, total.max, kernel.median, readback.median };
+	for (int i = 0; i < 6; ++i)
+	{
+		fputc(',', file);
+		writeCsvTime(file, stats[i]);
+	}
+
+	// every run's total time, separated by semicolons so they stay in one field
+	fputc(',', file);
+	for (size_t i = 0; i < b->runs.size(); ++i)
+	{
+		fprintf(file, "%s%.3f", i ? ";" : "", b->runs[i].totalMs);
+	}
+
+	if (b->mae >= 0.0) fprintf(file, ",%.6f,%d,%d", b->mae, b->maxDiff, b->passed ? 1 : 0);
+	else fprintf(file, ",,,");
+
+	// the counters (all empty if they weren't counted), the samples that traced 1, 2, ... rays separated by semicolons
+	for (int i = 0; i < COUNT_DEPTH; ++i)
+	{
+		fputc(',', file);
+		if (b->counters != NULL) fprintf(file, "%llu", b->counters->counts[i]);
+	}
+	fputc(',', file);
+	for (int i = 0; b->counters != NULL && i < MAX_RAYS_CAST; ++i)
+	{
+		fprintf(file, "%s%llu", i ? ";" : "", b->counters->counts[COUNT_DEPTH + i]);
+	}
+	fputc(',', file);
+	if (b->counters != NULL && total.median >= 0.0) fprintf(file, "%.3f", megaRaysPerSecond(b->counters, total.median));
+	fputc(',', file);
+	if (b->counters != NULL) fprintf(file, "%.3f", testsPerRay(b->counters));
+	fputc('\n', file);
+}
+
+
+// append the benchmark to filename as a single line, "-" writes it to stdout
+bool writeBenchmark(const Benchmark* benchmark, const char* filename)
+{
+	size_t length = strlen(filename);
+	bool csv = length >= 4 && strcmp(filename + length - 4, ".csv") == 0;
+	bool toStdout = strcmp(filename, "-") == 0;
+
+	FILE* file = toStdout ? stdout : fopen(filename, "a");
+	if (file == NULL)
+	{
+		printf("Couldn't open %s to write the benchmark to\n", filename);
+		return false;
+	}
+
+	// only a new (empty) CSV file gets the header row (stdout always does)
+	bool empty = toStdout || (fseek(file, 0, SEEK_END) == 0 && ftell(file) == 0);
+
+	BenchmarkStats total = summarise(benchmark, &BenchmarkRun::totalMs);
+	BenchmarkStats kernel = summarise(benchmark, &BenchmarkRun::kernelMs);
+	BenchmarkStats readback = summarise(benchmark, &BenchmarkRun::readbackMs);
+
+	if (csv) writeCsv(file, empty, benchmark, total, kernel, readback);
+	else writeJson(file, benchmark, total, kernel, readback);
+
+	bool ok = !ferror(file);
+	if (!toStdout) ok = (fclose(file) == 0) && ok;
+	else fflush(file);
+
+	if (!ok) printf("Couldn't write the benchmark to %s\n", filename);
+	return ok;
+}
@@ -0,0 +1,91 @@
+#include "Features.h"
+#include <stdio.h>
+#include <string.h>
+
+// the features one material needs
+static unsigned int materialFeatures(const Material* material)
+{
+	unsigned int features = 0;
+
+	// traceRay only refracts off a material that doesn't reflect
+	if (material->reflection) features |= FEATURE_REFLECTION;
+	else if (material->refraction) features |= FEATURE_REFRACTION;
+
+	switch (material->type)
+	{
+	case Material::CHECKERBOARD:
+		features |= FEATURE_CHECKERBOARD;
+		break;
+	case Material::CIRCLES:
+		features |= FEATURE_CIRCLES;
+		break;
+	case Material::WOOD:
+		features |= FEATURE_WOOD;
+		break;
+	default:
+		break;
+	}
+
+	return features;
+}
+
+
+// the features the scene's spheres and boxes use
+// (the skybox material only ever adds its diffuse colour, so it needs nothing)
+unsigned int sceneFeatures(const Scene* scene)
+{
+	unsigned int features = 0;
+
+	if (scene->numSpheres > 0) features |= FEATURE_SPHERES;
+	if (scene->numBoxes > 0) features |= FEATURE_BOXES;
+
+	for (unsigned int i = 0; i < scene->numSpheres; ++i)
+	{
+		features |= materialFeatures(&scene->materialContainer[scene->sphereContainer[i].materialId]);
+	}
+	for (unsigned int i = 0; i < scene->numBoxes; ++i)
+	{
+		features |= materialFeatures(&scene->materialContainer[scene->boxContainer[i].materialId]);
+	}
+
+	return features;
+}
+
+
+// number of features in a set
+static unsigned int countFeatures(unsigned int features)
+{
+	unsigned int count = 0;
+	for (; features; features &= features - 1) ++count;
+	return count;
+}
+
+
+// the compiled feature set with the fewest features that covers features
+unsigned int pickFeatureSet(unsigned int features)
+{
+	unsigned int best = ALL_FEATURES;
+
+#define PICK_FEATURE_SET(set) if (((set) & features) == features && countFeatures(set) < countFeatures(best)) best = (set);
+	FOR_EACH_FEATURE_SET(PICK_FEATURE_SET)
+#undef PICK_FEATURE_SET
+
+	return best;
+}
+
+
+// write the names of the features in a set into text (at least 80 chars), "none" for the empty set
+void describeFeatures(unsigned int features, char* text)
+{
+	static const char* names[] = { "reflection", "refraction", "checkerboard", "circles", "wood", "spheres", "boxes", "counters" };
+
+	text[0] = '\0';
+	for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+	{
+		if (!(features & (1 << i))) continue;
+		if (text[0]) strcat(text, " ");
+		strcat(text, names[i]);
+	}
+
+	if (!text[0]) strcpy(text, "none");
+}
@@ -0,0 +1,60 @@
+#ifndef __FEATURES_H
+#define __FEATURES_H
+
+#include "Scene.h"
+
+// what a scene's objects can need from the tracer, the CPU tracer is compiled for sets of these (template parameter Features)
+// so a scene that doesn't use a feature doesn't test for it at every hit or every light
+#define FEATURE_REFLECTION		0x01	// a material reflects
+#define FEATURE_REFRACTION		0x02	// a material refracts (and doesn't reflect, reflection wins when it has both)
+#define FEATURE_CHECKERBOARD	0x04	// a material is textured with a checkerboard
+#define FEATURE_CIRCLES			0x08	// a material is textured with circles
+#define FEATURE_WOOD			0x10	// a material is textured with wood
+#define FEATURE_SPHERES			0x20	// the scene has spheres
+#define FEATURE_BOXES			0x40	// the scene has boxes
+#define FEATURE_COUNTERS		0x80	// count rays and intersection tests into RayCounters (not a scene feature, asked for with -counters)
+
+#define FEATURE_TEXTURES (FEATURE_CHECKERBOARD | FEATURE_CIRCLES | FEATURE_WOOD)
+#define ALL_FEATURES 0x7F
+
+// the only counted feature set, counting is for measuring so one tracer that handles every scene is enough
+#define COUNTED_FEATURES (ALL_FEATURES | FEATURE_COUNTERS)
+
+// every feature set the tracer is compiled for, FEATURE_SET(features) is expanded for each (used for the explicit instantiations)
+// COUNTED_FEATURES is compiled as well, but isn't one of these as pickFeatureSet never picks it
+// either kind of object or both, with or without reflection and refraction, and no textures, only checkerboards or all of them
+#define FOR_EACH_FEATURE_SET_OPTICS(FEATURE_SET, objects) \
+	FEATURE_SET(objects) \
+	FEATURE_SET(objects | FEATURE_REFLECTION) \
+	FEATURE_SET(objects | FEATURE_REFRACTION) \
+	FEATURE_SET(objects | FEATURE_REFLECTION | FEATURE_REFRACTION)
+
+#define FOR_EACH_FEATURE_SET_TEXTURES(FEATURE_SET, objects) \
+	FOR_EACH_FEATURE_SET_OPTICS(FEATURE_SET, objects) \
+	FOR_EACH_FEATURE_SET_OPTICS(FEATURE_SET, objects | FEATURE_CHECKERBOARD) \
+	FOR_EACH_FEATURE_SET_OPTICS(FEATURE_SET, objects | FEATURE_TEXTURES)
+
+#define FOR_EACH_FEATURE_SET(FEATURE_SET) \
+	FOR_EACH_FEATURE_SET_TEXTURES(FEATURE_SET, FEATURE_SPHERES) \
+	FOR_EACH_FEATURE_SET_TEXTURES(FEATURE_SET, FEATURE_BOXES) \
+	FOR_EACH_FEATURE_SET_TEXTURES(FEATURE_SET, FEATURE_SPHERES | FEATURE_BOXES)
+
+// whether BVH primitive key is a sphere (sphere index, or numSpheres + box index)
+// known without looking at the key when the feature set only has one kind of object
+template <unsigned int Features> inline bool isSphereKey(const Scene* scene, unsigned int key)
+{
+	if (!(Features & FEATURE_BOXES)) return true;
+	if (!(Features & FEATURE_SPHERES)) return false;
+	return key < scene->numSpheres;
+}
+
+// the features the scene's spheres and boxes use
+unsigned int sceneFeatures(const Scene* scene);
+
+// the compiled feature set with the fewest features that covers features
+unsigned int pickFeatureSet(unsigned int features);
+
+// write the names of the features in a set into text (at least 80 chars), "none" for the empty set
+void describeFeatures(unsigned int features, char* text);
+
+#endif // __FEATURES_H
@@ -0,0 +1,265 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "FrameBuffer.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// how a frame buffer's pixels were allocated
+#define FRAME_ALLOCATED_ALIGNED 0			// _aligned_malloc / posix_memalign
+#define FRAME_ALLOCATED_LARGE_PAGES 1		// VirtualAlloc with MEM_LARGE_PAGES (Windows)
+#define FRAME_ALLOCATED_MAPPED 2			// mmap (Linux)
+
+// rows are padded to a whole number of FRAME_ALIGNMENT bytes so every row starts on the alignment
+static const int STRIDE_PIXELS = FRAME_ALIGNMENT / sizeof(unsigned int);
+
+// size of the huge pages asked for on Linux
+static const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+
+#ifdef _WIN32
+// large pages need the "Lock pages in memory" privilege enabled in the process's token
+static bool enableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+
+	CloseHandle(token);
+	return enabled;
+}
+#endif
+
+
+// try to allocate bytes on huge pages, returns NULL (with the reason in why) if the system won't
+static void* allocateHugePages(FrameBuffer* frame, size_t bytes, const char** why)
+{
+#ifdef _WIN32
+	size_t largePage = GetLargePageMinimum();
+	if (largePage == 0)
+	{
+		*why = "the processor doesn't support large pages";
+		return NULL;
+	}
+	if (!enableLockMemoryPrivilege())
+	{
+		*why = "the account doesn't have the \"Lock pages in memory\" privilege";
+		return NULL;
+	}
+
+	size_t rounded = (bytes + largePage - 1) / largePage * largePage;
+	void* pixels = VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+	if (pixels == NULL)
+	{
+		*why = "there aren't enough free large pages";
+		return NULL;
+	}
+
+	frame->allocationType = FRAME_ALLOCATED_LARGE_PAGES;
+	frame->allocatedBytes = rounded;
+	return pixels;
+#elif defined(__linux__)
+	// 2MB pages from the hugetlbfs pool if any were set aside for it (vm.nr_hugepages), otherwise ask for transparent huge pages
+	size_t rounded = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+
+	void* pixels = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (pixels == MAP_FAILED)
+	{
+		pixels = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (pixels == MAP_FAILED)
+		{
+			*why = "mmap failed";
+			return NULL;
+		}
+		if (madvise(pixels, rounded, MADV_HUGEPAGE) != 0)
+		{
+			munmap(pixels, rounded);
+			*why = "there are no huge pages set aside and transparent huge pages are off";
+			return NULL;
+		}
+	}
+
+	frame->allocationType = FRAME_ALLOCATED_MAPPED;
+	frame->allocatedBytes = rounded;
+	return pixels;
+#else
+	*why = "huge pages aren't supported on this system";
+	return NULL;
+#endif
+}
+
+
+// the whole of a frame's allocation as its view
+static void setFrameView(FrameBuffer* frame, void* pixels, int width, int height, int stride)
+{
+	frame->allocation = pixels;
+	frame->hugePages = frame->allocationType != FRAME_ALLOCATED_ALIGNED;
+	frame->view.pixels = (unsigned int*)pixels;
+	frame->view.width = width;
+	frame->view.height = height;
+	frame->view.stride = stride;
+}
+
+
+// allocate a black width x height frame, on huge pages if asked for and the system can give them (otherwise on normal pages, saying so)
+bool createFrameBuffer(FrameBuffer* frame, int width, int height, bool hugePages)
+{
+	memset(frame, 0, sizeof(FrameBuffer));
+
+	if (width < 1 || height < 1)
+	{
+		printf("Can't make a %dx%d frame buffer\n", width, height);
+		return false;
+	}
+
+	int stride = (width + STRIDE_PIXELS - 1) / STRIDE_PIXELS * STRIDE_PIXELS;
+	size_t bytes = (size_t)stride * height * sizeof(unsigned int);
+
+	void* pixels = NULL;
+	if (hugePages)
+	{
+		const char* why = "";
+		pixels = allocateHugePages(frame, bytes, &why);
+		if (pixels == NULL)
+		{
+			printf("Couldn't put the frame buffer on huge pages (%s), using normal pages\n", why);
+		}
+	}
+
+	if (pixels == NULL)
+	{
+#ifdef _WIN32
+		pixels = _aligned_malloc(bytes, FRAME_ALIGNMENT);
+#else
+		if (posix_memalign(&pixels, FRAME_ALIGNMENT, bytes) != 0) pixels = NULL;
+#endif
+		if (pixels == NULL)
+		{
+			printf("Couldn't allocate a %dx%d frame buffer (%zu bytes)\n", width, height, bytes);
+			return false;
+		}
+
+		frame->allocationType = FRAME_ALLOCATED_ALIGNED;
+		frame->allocatedBytes = bytes;
+	}
+
+	// start black like the static array did (an odd width or height leaves a column or row the renderers never write),
+	// which also faults the pages in here rather than in the first timed run
+	memset(pixels, 0, bytes);
+
+	setFrameView(frame, pixels, width, height, stride);
+	return true;
+}
+
+
+// allocate a black width x height frame that is shared with the processes forked after it
+bool createSharedFrameBuffer(FrameBuffer* frame, int width, int height, bool hugePages)
+{
+	memset(frame, 0, sizeof(FrameBuffer));
+
+	if (width < 1 || height < 1)
+	{
+		printf("Can't make a %dx%d frame buffer\n", width, height);
+		return false;
+	}
+
+#ifdef _WIN32
+	printf("A frame buffer can only be shared with forked processes, which Windows doesn't have\n");
+	return false;
+#else
+	int stride = (width + STRIDE_PIXELS - 1) / STRIDE_PIXELS * STRIDE_PIXELS;
+	size_t bytes = (size_t)stride * height * sizeof(unsigned int);
+
+	// a shared anonymous mapping starts zeroed, only the hugetlbfs pool can back it with huge pages
+	void* pixels = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (hugePages)
+	{
+		size_t rounded = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+		pixels = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (pixels != MAP_FAILED) frame->allocatedBytes = rounded;
+	}
+#endif
+	if (hugePages && pixels == MAP_FAILED)
+	{
+		printf("Couldn't put the frame buffer on huge pages (there are none set aside), using normal pages\n");
+	}
+
+	if (pixels == MAP_FAILED)
+	{
+		pixels = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (pixels == MAP_FAILED)
+		{
+			printf("Couldn't map a shared %dx%d frame buffer (%zu bytes)\n", width, height, bytes);
+			return false;
+		}
+		frame->allocatedBytes = bytes;
+		hugePages = false;
+	}
+
+	frame->allocationType = FRAME_ALLOCATED_MAPPED;
+	setFrameView(frame, pixels, width, height, stride);
+	frame->hugePages = hugePages;
+	return true;
+#endif
+}
+
+
+void releaseFrameBuffer(FrameBuffer* frame)
+{
+	if (frame->allocation == NULL) return;
+
+	switch (frame->allocationType)
+	{
+#ifdef _WIN32
+	case FRAME_ALLOCATED_LARGE_PAGES:
+		VirtualFree(frame->allocation, 0, MEM_RELEASE);
+		break;
+	case FRAME_ALLOCATED_ALIGNED:
+		_aligned_free(frame->allocation);
+		break;
+#else
+	case FRAME_ALLOCATED_MAPPED:
+		munmap(frame->allocation, frame->allocatedBytes);
+		break;
+	case FRAME_ALLOCATED_ALIGNED:
+		free(frame->allocation);
+		break;
+#endif
+	}
+
+	memset(frame, 0, sizeof(FrameBuffer));
+}
+
+
+// the part [x0, x0 + width) x [y0, y0 + height) of a view (cut down to fit inside it), with the same stride
+FrameView subFrameView(const FrameView* view, int x0, int y0, int width, int height)
+{
+	int x1 = std::min(x0 + width, view->width), y1 = std::min(y0 + height, view->height);
+	x0 = std::min(std::max(x0, 0), view->width);
+	y0 = std::min(std::max(y0, 0), view->height);
+
+	FrameView sub;
+	sub.pixels = framePixel(view, x0, y0);
+	sub.width = std::max(x1 - x0, 0);
+	sub.height = std::max(y1 - y0, 0);
+	sub.stride = view->stride;
+	return sub;
+}
@@ -0,0 +1,197 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "FramePart.h"
+#include "ImageIO.h"
+
+// read "i..j" (or "i" for a single tile) as a range of tiles
+bool parseTileRange(const char* text, int* firstTile, int* lastTile)
+{
+	int consumed = 0;
+	if (sscanf(text, "%d..%d%n", firstTile, lastTile, &consumed) == 2 && text[consumed] == '\0' && *firstTile >= 0 && *lastTile >= *firstTile) return true;
+
+	consumed = 0;
+	if (sscanf(text, "%d%n", firstTile, &consumed) == 1 && text[consumed] == '\0' && *firstTile >= 0)
+	{
+		*lastTile = *firstTile;
+		return true;
+	}
+
+	printf("Tiles should be given as first..last (or a single tile), not %s\n", text);
+	return false;
+}
+
+
+// the part of a frameWidth x frameHeight frame cut into tileSize tiles that is in region and in tiles firstTile to lastTile
+bool createFramePart(FramePart* part, int frameWidth, int frameHeight, int tileSize, const int* region, int firstTile, int lastTile)
+{
+	part->frameWidth = frameWidth;
+	part->frameHeight = frameHeight;
+	part->tileSize = std::max(tileSize, 1);
+
+	part->x0 = region ? std::max(region[0], 0) : 0;
+	part->y0 = region ? std::max(region[1], 0) : 0;
+	part->x1 = region ? std::min(region[2], frameWidth) : frameWidth;
+	part->y1 = region ? std::min(region[3], frameHeight) : frameHeight;
+	if (part->x0 >= part->x1 || part->y0 >= part->y1)
+	{
+		printf("The region %d %d %d %d has no pixels of the %dx%d frame\n", region[0], region[1], region[2], region[3], frameWidth, frameHeight);
+		return false;
+	}
+
+	const int totalTiles = frameTilesWide(part) * ((frameHeight + part->tileSize - 1) / part->tileSize);
+	part->firstTile = std::max(firstTile, 0);
+	part->lastTile = (lastTile < 0) ? totalTiles - 1 : std::min(lastTile, totalTiles - 1);
+
+	// the image is the smallest rectangle holding every tile's pixels
+	part->imageX0 = frameWidth;
+	part->imageY0 = frameHeight;
+	part->imageX1 = part->imageY1 = 0;
+	for (int tile = part->firstTile; tile <= part->lastTile; ++tile)
+	{
+		int x0, y0, x1, y1;
+		if (!framePartTile(part, tile, &x0, &y0, &x1, &y1)) continue;
+
+		part->imageX0 = std::min(part->imageX0, x0);
+		part->imageY0 = std::min(part->imageY0, y0);
+		part->imageX1 = std::max(part->imageX1, x1);
+		part->imageY1 = std::max(part->imageY1, y1);
+	}
+
+	if (part->imageX0 >= part->imageX1)
+	{
+		printf("None of the tiles %d to %d of the %dx%d frame (%d tiles of %dx%d) are in the region %d %d %d %d\n", firstTile, lastTile,
+			frameWidth, frameHeight, totalTiles, part->tileSize, part->tileSize, part->x0, part->y0, part->x1, part->y1);
+		return false;
+	}
+
+	return true;
+}
+
+
+// whether the part is the whole frame
+bool isWholeFrame(const FramePart* part)
+{
+	int tilesHigh = (part->frameHeight + part->tileSize - 1) / part->tileSize;
+	return part->x0 == 0 && part->y0 == 0 && part->x1 == part->frameWidth && part->y1 == part->frameHeight &&
+		part->firstTile == 0 && part->lastTile == frameTilesWide(part) * tilesHigh - 1;
+}
+
+
+// tiles across the frame
+int frameTilesWide(const FramePart* part)
+{
+	return (part->frameWidth + part->tileSize - 1) / part->tileSize;
+}
+
+
+// the pixels [x0, x1) x [y0, y1) of the frame's tile that are in the part, returns false if there are none
+bool framePartTile(const FramePart* part, int tile, int* x0, int* y0, int* x1, int* y1)
+{
+	if (tile < part->firstTile || tile > part->lastTile) return false;
+
+	const int tilesWide = frameTilesWide(part);
+	*x0 = std::max((tile % tilesWide) * part->tileSize, part->x0);
+	*y0 = std::max((tile / tilesWide) * part->tileSize, part->y0);
+	*x1 = std::min((tile % tilesWide + 1) * part->tileSize, part->x1);
+	*y1 = std::min((tile / tilesWide + 1) * part->tileSize, part->y1);
+
+	return *x0 < *x1 && *y0 < *y1;
+}
+
+
+// whether pixel (x, y) of the frame is in the part
+bool inFramePart(const FramePart* part, int x, int y)
+{
+	if (x < part->x0 || x >= part->x1 || y < part->y0 || y >= part->y1) return false;
+
+	int tile = (y / part->tileSize) * frameTilesWide(part) + x / part->tileSize;
+	return tile >= part->firstTile && tile <= part->lastTile;
+}
+
+
+// the .part file has the image's name with .part instead of .bmp (or added to it)
+static void partFilename(const char* filename, char* partName, size_t size)
+{
+	size_t length = strlen(filename);
+	if (length >= 4 && strcmp(filename + length - 4, ".bmp") == 0) length -= 4;
+	snprintf(partName, size, "%.*s.part", (int)std::min(length, size - 6), filename);
+}
+
+
+// write the part's image through write_bmp, and where it goes in the frame to a .part file next to it
+bool writeFramePart(const FramePart* part, const FrameView* image, const char* filename)
+{
+	write_bmp(filename, image->pixels, image->width, image->height, image->stride);
+
+	char partName[1000];
+	partFilename(filename, partName, sizeof(partName));
+
+	FILE* file = fopen(partName, "w");
+	if (file == NULL)
+	{
+		printf("Couldn't write where the part goes to %s\n", partName);
+		return false;
+	}
+
+	// the image holds the pixels of the frame inside "image" (x0 y0 x1 y1), but only those in the region and the tiles are the part's
+	fprintf(file, "# part of a frame, put the parts back together with MergeParts\n");
+	fprintf(file, "frame %d %d\n", part->frameWidth, part->frameHeight);
+	fprintf(file, "region %d %d %d %d\n", part->x0, part->y0, part->x1, part->y1);
+	fprintf(file, "tiles %d %d %d\n", part->tileSize, part->firstTile, part->lastTile);
+	fprintf(file, "image %d %d %d %d\n", part->imageX0, part->imageY0, part->imageX1, part->imageY1);
+	fclose(file);
+
+	printf("part written to %s and %s: region %d %d %d %d, tiles %d to %d of %dx%d, image %dx%d at (%d, %d) of the %dx%d frame\n", filename, partName,
+		part->x0, part->y0, part->x1, part->y1, part->firstTile, part->lastTile, part->tileSize, part->tileSize,
+		part->imageX1 - part->imageX0, part->imageY1 - part->imageY0, part->imageX0, part->imageY0, part->frameWidth, part->frameHeight);
+
+	return true;
+}
+
+
+// read where the part written to filename (the BMP) goes in the frame from its .part file
+bool readFramePart(const char* filename, FramePart* part)
+{
+	char partName[1000];
+	partFilename(filename, partName, sizeof(partName));
+
+	FILE* file = fopen(partName, "r");
+	if (file == NULL)
+	{
+		printf("Couldn't open %s, which says where %s goes\n", partName, filename);
+		return false;
+	}
+
+	int frame[2], region[4], tiles[3], image[4];
+	int found = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), file))
+	{
+		if (sscanf(line, "frame %d %d", &frame[0], &frame[1]) == 2) found |= 1;
+		else if (sscanf(line, "region %d %d %d %d", &region[0], &region[1], &region[2], &region[3]) == 4) found |= 2;
+		else if (sscanf(line, "tiles %d %d %d", &tiles[0], &tiles[1], &tiles[2]) == 3) found |= 4;
+		else if (sscanf(line, "image %d %d %d %d", &image[0], &image[1], &image[2], &image[3]) == 4) found |= 8;
+	}
+	fclose(file);
+
+	if (found != 15)
+	{
+		printf("%s doesn't have the frame, region, tiles and image lines\n", partName);
+		return false;
+	}
+
+	// the image has to be where the region and tiles put it
+	if (!createFramePart(part, frame[0], frame[1], tiles[0], region, tiles[1], tiles[2]) ||
+		part->imageX0 != image[0] || part->imageY0 != image[1] || part->imageX1 != image[2] || part->imageY1 != image[3])
+	{
+		printf("%s doesn't describe a part of a frame\n", partName);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,48 @@
+#ifndef __FRAME_PART_H
+#define __FRAME_PART_H
+
+#include "FrameBuffer.h"
+
+// the part of a frame one run renders, so a frame can be split across processes and machines and put back together with MergeParts
+// it is the pixels of the region [x0, x1) x [y0, y1) that are in the tiles firstTile to lastTile, with x from the left of the
+// frame and y up from its bottom row (as frames are stored), and the frame cut into tileSize x tileSize tiles numbered across
+// and then up from the bottom left (as the renderers number their tiles)
+typedef struct FramePart
+{
+	int frameWidth, frameHeight;			// size of the whole frame
+	int x0, y0, x1, y1;						// region of the frame
+	int tileSize;							// width and height of a (full) tile
+	int firstTile, lastTile;				// tiles rendered
+	int imageX0, imageY0, imageX1, imageY1;	// smallest rectangle holding every pixel of the part, the part's image
+} FramePart;
+
+// read "i..j" (or "i" for a single tile) as a range of tiles
+bool parseTileRange(const char* text, int* firstTile, int* lastTile);
+
+// the part of a frameWidth x frameHeight frame cut into tileSize tiles that is in region (x0, y0, x1, y1, the whole frame if NULL)
+// and in tiles firstTile to lastTile (every tile if lastTile is -1), both cut down to fit the frame
+// prints the reason and returns false if that leaves no pixels
+bool createFramePart(FramePart* part, int frameWidth, int frameHeight, int tileSize, const int* region, int firstTile, int lastTile);
+
+// whether the part is the whole frame
+bool isWholeFrame(const FramePart* part);
+
+// tiles across the frame
+int frameTilesWide(const FramePart* part);
+
+// the pixels [x0, x1) x [y0, y1) of the frame's tile that are in the part, returns false if there are none
+bool framePartTile(const FramePart* part, int tile, int* x0, int* y0, int* x1, int* y1);
+
+// whether pixel (x, y) of the frame is in the part
+bool inFramePart(const FramePart* part, int x, int y);
+
+// write the part's image (image holds the pixels of [imageX0, imageX1) x [imageY0, imageY1)) through write_bmp, and where it
+// goes in the frame to a text file of the same name ending in .part instead of .bmp
+// prints the reason and returns false if the .part file can't be written
+bool writeFramePart(const FramePart* part, const FrameView* image, const char* filename);
+
+// read where the part written to filename (the BMP) goes in the frame from its .part file
+// prints the reason and returns false if it can't be read
+bool readFramePart(const char* filename, FramePart* part);
+
+#endif // __FRAME_PART_H
@@ -0,0 +1,25 @@
+#ifndef __HEAT_MAP_H
+#define __HEAT_MAP_H
+
+#include <vector>
+#include "FramePart.h"
+
+// the work each pixel of a frame took, recorded with -heatmap (pixels in the same places as in the frame buffer,
+// so row 0 is the bottom of the image)
+typedef struct HeatMap
+{
+	int width, height;						// size of the frame
+	std::vector<unsigned int> tests;		// BVH node, sphere and box tests of each pixel's rays (its shadow rays' included)
+	std::vector<unsigned int> rays;			// rays each pixel traced: primary, reflection, refraction and shadow
+} HeatMap;
+
+// size the heat map for a width x height frame, with no work recorded
+void createHeatMap(HeatMap* heatMap, int width, int height);
+
+// write each pixel's tests as a false colour BMP through write_bmp (on a log scale, from dark blue for the cheapest pixel
+// of the part through green and yellow to red for the most expensive, and black outside the part), and a line per tile
+// of the part (numbered like the renderers number their tiles) to a CSV file of the same name ending in .csv instead of .bmp
+// prints the most expensive tile, or the reason and returns false if the CSV file can't be written
+bool writeHeatMap(const HeatMap* heatMap, const FramePart* part, const char* filename);
+
+#endif // __HEAT_MAP_H
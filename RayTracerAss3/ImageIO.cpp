@@ -93,6 +93,72 @@ unsigned int read_int16(ifstream& f)
 	return (((unsigned char) value2) << 8) | ((unsigned char) value1);
 }
 
+// read a 24 bit BMP written by write_bmp (or any other uncompressed 24 bit BMP) into a new[]'d buffer, packed as write_bmp expects
+// rows are kept in file order, so the buffer matches the one that was written (rows may or may not be padded to 4 bytes)
+// prints the reason and returns NULL if the file can't be read
+unsigned int* read_bmp(const char* name, int* width, int* height)
+{
+	ifstream imageFile(name, ios_base::binary);
+	if (!imageFile)
+	{
+		fprintf(stderr, "Failed to open %s.\n", name);
+		return NULL;
+	}
+
+	char b, m;
+	imageFile.get(b);
+	imageFile.get(m);
+	if (b != 'B' || m != 'M')
+	{
+		fprintf(stderr, "File %s not a BMP.\n", name);
+		return NULL;
+	}
+
+	unsigned int fileSize = read_int32(imageFile);
+	read_int32(imageFile);
+	unsigned int offset = read_int32(imageFile);
+	read_int32(imageFile);
+
+	*width = (int)read_int32(imageFile);
+	*height = (int)read_int32(imageFile);
+	read_int16(imageFile);
+	unsigned int bpp = read_int16(imageFile);
+	unsigned int compression = read_int32(imageFile);
+
+	if (!imageFile || bpp != 24 || compression != 0 || *width <= 0 || *height <= 0)
+	{
+		fprintf(stderr, "BMP %s not an uncompressed 24bpp image.\n", name);
+		return NULL;
+	}
+
+	// write_bmp doesn't pad its rows, other writers pad them to a multiple of 4 bytes
+	size_t rowSize = (size_t)*width * 3;
+	if (fileSize != offset + rowSize * *height) rowSize = (rowSize + 3) & ~(size_t)3;
+
+	unsigned char* row = new unsigned char[rowSize];
+	unsigned int* buffer = new unsigned int[(size_t)*width * *height];
+
+	imageFile.seekg(offset);
+	for (int y = 0; y < *height && imageFile; ++y)
+	{
+		imageFile.read((char*)row, rowSize);
+		for (int x = 0; x < *width; ++x)
+		{
+			buffer[(size_t)y * *width + x] = (row[x * 3] << 16) | (row[x * 3 + 1] << 8) | row[x * 3 + 2];
+		}
+	}
+	delete[] row;
+
+	if (!imageFile)
+	{
+		fprintf(stderr, "BMP %s is truncated.\n", name);
+		delete[] buffer;
+		return NULL;
+	}
+
+	return buffer;
+}
+
 /*bool read_bmp(const char* name, Texture& t)
 {
 	ifstream imageFile(name, ios_base::binary);
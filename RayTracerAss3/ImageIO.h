@@ -3,8 +3,9 @@
 #ifndef __IMAGE_IO_H
 #define __IMAGE_IO_H
 
-// image file writing functions
+// image file reading and writing functions (read_bmp returns a new[]'d buffer, NULL if the file can't be read)
 //bool read_bmp(const char *name, Texture& t);
+unsigned int* read_bmp(const char *name, int* width, int* height);
 void write_bmp(const char *name, unsigned int *screen, int width, int height, int stride);
 void write_tga(const char *name, unsigned int *screen, int width, int height, int stride);
 void write_ppm(const char *name, unsigned int *screen, int width, int height, int stride);
@@ -3,6 +3,7 @@
 	It is free to use for educational purpose and cannot be redistributed outside of the tutorial pages. */
 
 #include "Intersection.h"
+#include "PrimitiveSoA.h"
 #include <immintrin.h>
 
 
@@ -125,44 +126,202 @@ void calculateIntersectionResponse(const Scene* scene, const Ray* viewRay, Inter
 }
 
 
-// test to see if collision between ray and any object in the scene
-// updates intersection structure if collision occurs
-bool objectIntersection(const Scene* scene, const Ray* viewRay, Intersection* intersect)
+// test the objects in BVH primitive slots [first, first + count) for the closest collision (key as used by the BVH)
+// long runs test their spheres and boxes 8 at a time when the CPU has AVX2, the rest are tested one by one
+// (a pass 8 at a time counts as a test of every slot of the run, whatever is in it, as that is the work it does)
+template <unsigned int Features>
+static bool intersectSlots(const Scene* scene, const Ray* viewRay, unsigned int first, unsigned int count, float* t, unsigned int* closest, bool found, RayCounters* counters)
 {
-	// set default distance to be a long long way away
-    float t = MAX_RAY_DISTANCE;
+	bool hitAny = false;
+	bool simdSpheres = (Features & FEATURE_SPHERES) && scene->useSphereSoA && count >= PRIMITIVE_SOA_MIN_SLOTS;
+	bool simdBoxes = (Features & FEATURE_BOXES) && scene->useBoxSoA && count >= PRIMITIVE_SOA_MIN_SLOTS;
+
+	if (Features & FEATURE_COUNTERS)
+	{
+		if (simdSpheres) counters->counts[COUNT_SPHERE_TESTS] += count;
+		if (simdBoxes) counters->counts[COUNT_BOX_TESTS] += count;
+	}
+
+	if (simdSpheres && intersectSphereSlots(scene, viewRay, first, count, t, closest, found)) found = hitAny = true;
+	if (simdBoxes && intersectBoxSlots(scene, viewRay, first, count, t, closest, found)) found = hitAny = true;
+	if (simdSpheres && simdBoxes) return hitAny;
+
+	for (unsigned int i = first; i < first + count; ++i)
+	{
+		unsigned int key = scene->bvhPrimitiveContainer[i];
+		bool isSphere = isSphereKey<Features>(scene, key);
+		if (isSphere ? simdSpheres : simdBoxes) continue;
 
-	// no intersection found by default
-	intersect->objectType = Intersection::NONE;
+		// an earlier object also wins at exactly the same distance
+		float limit = (found && key < *closest) ? nextafterf(*t, MAX_RAY_DISTANCE) : *t;
+
+		if (Features & FEATURE_COUNTERS) counters->counts[isSphere ? COUNT_SPHERE_TESTS : COUNT_BOX_TESTS]++;
+
+		bool hit = isSphere ?
+			isSphereIntersected(&scene->sphereContainer[key], viewRay, &limit) :
+			isBoxIntersected(&scene->boxContainer[key - scene->numSpheres], viewRay, &limit);
+
+		if (hit)
+		{
+			*t = limit;
+			*closest = key;
+			found = hitAny = true;
+		}
+	}
+
+	return hitAny;
+}
+
+
+// test every sphere and then every box for the closest collision (key as used by the BVH)
+// scenes small enough for the whole BVH to be a single leaf are traced this way, in scene order ties need no extra work
+template <unsigned int Features>
+static bool intersectAllObjects(const Scene* scene, const Ray* viewRay, float* t, unsigned int* closest, RayCounters* counters)
+{
+	bool found = false;
 
 	// search for sphere collisions, storing closest one found
-	for (unsigned int i = 0; i < scene->numSpheres; ++i)
+	if (Features & FEATURE_SPHERES)
 	{
-		if (isSphereIntersected(&scene->sphereContainer[i], viewRay, &t))
+		if (Features & FEATURE_COUNTERS) counters->counts[COUNT_SPHERE_TESTS] += scene->numSpheres;
+
+		for (unsigned int i = 0; i < scene->numSpheres; ++i)
 		{
-			intersect->objectType = Intersection::SPHERE;
-			intersect->sphere = &scene->sphereContainer[i];
+			if (isSphereIntersected(&scene->sphereContainer[i], viewRay, t))
+			{
+				*closest = i;
+				found = true;
+			}
 		}
 	}
 
 	// search for box collisions, storing closest one found
-	for (unsigned int i = 0; i < scene->numBoxes; ++i)
+	if (Features & FEATURE_BOXES)
 	{
-		if (isBoxIntersected(&scene->boxContainer[i], viewRay, &t))
+		if (Features & FEATURE_COUNTERS) counters->counts[COUNT_BOX_TESTS] += scene->numBoxes;
+
+		for (unsigned int i = 0; i < scene->numBoxes; ++i)
 		{
-			intersect->objectType = Intersection::BOX;
-			intersect->box = &scene->boxContainer[i];
+			if (isBoxIntersected(&scene->boxContainer[i], viewRay, t))
+			{
+				*closest = scene->numSpheres + i;
+				found = true;
+			}
 		}
 	}
 
-	// nothing detected, return false
-	if (intersect->objectType == Intersection::NONE)
+	return found;
+}
+
+
+// fill in the object hit (key as used by the BVH) and the point of the intersection at time t
+void setIntersection(const Scene* scene, const Ray* viewRay, unsigned int key, float t, Intersection* intersect)
+{
+	if (key < scene->numSpheres)
 	{
-		return false;
+		intersect->objectType = Intersection::SPHERE;
+		intersect->sphere = &scene->sphereContainer[key];
+	}
+	else
+	{
+		intersect->objectType = Intersection::BOX;
+		intersect->box = &scene->boxContainer[key - scene->numSpheres];
 	}
 
 	// calculate the point of the intersection
 	intersect->pos = viewRay->start + viewRay->dir * t;
+}
+
+
+// test to see if collision between ray and any object in the scene
+// updates intersection structure if collision occurs
+// walks the BVH nearest child first, the result is the same as testing every sphere and then every box in order:
+// the closest hit wins and on equal distance the object that comes first (spheres before boxes, lower index first)
+template <unsigned int Features>
+bool objectIntersection(const Scene* scene, const Ray* viewRay, Intersection* intersect, RayCounters* counters)
+{
+	// set default distance to be a long long way away
+	float t = MAX_RAY_DISTANCE;
+
+	// key of the closest object found so far (spheres first, then boxes)
+	unsigned int closest = 0;
+	bool found = false;
+
+	// 1 / the ray direction, for the node tests (only worked out when the BVH is walked)
+	Vector invDir;
+
+	// nodes still to visit and where the ray enters them
+	unsigned int stack[BVH_STACK_SIZE];
+	float stackEntry[BVH_STACK_SIZE];
+	int stackSize = 0;
+
+	// scenes small enough for the whole BVH to be a single leaf test everything one by one, without the bounds test
+	// the sphere test assumes a unit length direction, which rays reflected from inside an object don't have
+	// those can report sphere hits outside the sphere's bounds, so they are tested against everything too
+	if (scene->numBvhNodes == 1)
+	{
+		found = intersectAllObjects<Features>(scene, viewRay, &t, &closest, counters);
+	}
+	else if (fabsf(viewRay->dir.dot() - 1.0f) > BVH_UNIT_TOLERANCE)
+	{
+		found = intersectSlots<Features>(scene, viewRay, 0, scene->numSpheres + scene->numBoxes, &t, &closest, false, counters);
+	}
+	else
+	{
+		invDir = Vector{ 1.0f / viewRay->dir.x, 1.0f / viewRay->dir.y, 1.0f / viewRay->dir.z };
+		if (Features & FEATURE_COUNTERS) counters->counts[COUNT_NODE_TESTS]++;
+		if (isNodeIntersected(&scene->bvhNodeContainer[0], viewRay, &invDir, t, &stackEntry[0])) stack[stackSize++] = 0;
+	}
+
+	while (stackSize > 0)
+	{
+		--stackSize;
+
+		// a closer hit may have been found since the node was pushed
+		if (stackEntry[stackSize] > t) continue;
+
+		const BVHNode* node = &scene->bvhNodeContainer[stack[stackSize]];
+
+		if (node->count > 0)
+		{
+			// test the leaf's objects
+			if (intersectSlots<Features>(scene, viewRay, node->first, node->count, &t, &closest, found, counters)) found = true;
+		}
+		else
+		{
+			// visit the nearer child first (pushed last), skipping any the ray misses or only reaches after the closest hit
+			float tLeft, tRight;
+			bool hitLeft = isNodeIntersected(&scene->bvhNodeContainer[node->first], viewRay, &invDir, t, &tLeft);
+			bool hitRight = isNodeIntersected(&scene->bvhNodeContainer[node->first + 1], viewRay, &invDir, t, &tRight);
+			if (Features & FEATURE_COUNTERS) counters->counts[COUNT_NODE_TESTS] += 2;
+
+			if (hitLeft && hitRight && tRight < tLeft)
+			{
+				stack[stackSize] = node->first; stackEntry[stackSize++] = tLeft;
+				stack[stackSize] = node->first + 1; stackEntry[stackSize++] = tRight;
+			}
+			else
+			{
+				if (hitRight) { stack[stackSize] = node->first + 1; stackEntry[stackSize++] = tRight; }
+				if (hitLeft) { stack[stackSize] = node->first; stackEntry[stackSize++] = tLeft; }
+			}
+		}
+	}
+
+	// nothing detected, return false
+	if (!found)
+	{
+		intersect->objectType = Intersection::NONE;
+		return false;
+	}
+
+	setIntersection(scene, viewRay, closest, t, intersect);
+	if (Features & FEATURE_COUNTERS) counters->counts[COUNT_HITS]++;
 
 	return true;
 }
+
+// compile the intersection test for every feature set (the last of them is ALL_FEATURES) and the counted one
+#define INSTANTIATE_INTERSECTION(features) template bool objectIntersection<features>(const Scene*, const Ray*, Intersection*, RayCounters*);
+FOR_EACH_FEATURE_SET(INSTANTIATE_INTERSECTION)
+INSTANTIATE_INTERSECTION(COUNTED_FEATURES)
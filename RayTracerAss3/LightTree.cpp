@@ -0,0 +1,124 @@
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include "LightTree.h"
+
+// box around the positions of lights [first, first + count)
+static void lightBounds(const Scene* scene, unsigned int first, unsigned int count, float* lo, float* hi)
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		lo[axis] = FLT_MAX;
+		hi[axis] = -FLT_MAX;
+	}
+
+	for (unsigned int i = first; i < first + count; ++i)
+	{
+		const Point& pos = scene->lightContainer[i].pos;
+		float p[3] = { pos.x, pos.y, pos.z };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			lo[axis] = std::min(lo[axis], p[axis]);
+			hi[axis] = std::max(hi[axis], p[axis]);
+		}
+	}
+}
+
+
+// length of a box's diagonal (the culling test works on the sphere around the box, so that is what splits try to shrink)
+static float diagonal(const float* lo, const float* hi)
+{
+	float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+	return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+
+// fill in a node for lights [first, first + count) and split it in two if it holds too many lights
+static void buildNode(const Scene* scene, std::vector<LightNode>& nodes, unsigned int nodeIndex, unsigned int first, unsigned int count, int depth)
+{
+	LightNode node;
+	lightBounds(scene, first, count, node.boundsMin, node.boundsMax);
+	node.first = first;
+	node.count = count;
+	node.intensity = 0.0f;
+	for (unsigned int i = first; i < first + count; ++i)
+	{
+		const Colour& intensity = scene->lightContainer[i].intensity;
+		node.intensity += std::max(fabsf(intensity.red), std::max(fabsf(intensity.green), fabsf(intensity.blue)));
+	}
+	nodes[nodeIndex] = node;
+
+	if (count <= LIGHT_TREE_LEAF_SIZE || depth >= LIGHT_TREE_MAX_DEPTH) return;
+
+	// the lights have to stay in order, so the only choice is where to cut the run
+	// sweep the prefix and suffix boxes and take the cut with the smallest count weighted diagonals (nearest the middle on ties)
+	std::vector<float> suffixSize(count);
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (unsigned int i = count - 1; i > 0; --i)
+	{
+		const Point& pos = scene->lightContainer[first + i].pos;
+		float p[3] = { pos.x, pos.y, pos.z };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			lo[axis] = std::min(lo[axis], p[axis]);
+			hi[axis] = std::max(hi[axis], p[axis]);
+		}
+		suffixSize[i] = diagonal(lo, hi) * (count - i);
+	}
+
+	unsigned int bestCut = count / 2;
+	float bestCost = FLT_MAX;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		lo[axis] = FLT_MAX;
+		hi[axis] = -FLT_MAX;
+	}
+	for (unsigned int i = 1; i < count; ++i)
+	{
+		const Point& pos = scene->lightContainer[first + i - 1].pos;
+		float p[3] = { pos.x, pos.y, pos.z };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			lo[axis] = std::min(lo[axis], p[axis]);
+			hi[axis] = std::max(hi[axis], p[axis]);
+		}
+
+		float cost = diagonal(lo, hi) * i + suffixSize[i];
+		unsigned int distance = std::max(i, count / 2) - std::min(i, count / 2);
+		unsigned int bestDistance = std::max(bestCut, count / 2) - std::min(bestCut, count / 2);
+		if (cost < bestCost || (cost == bestCost && distance < bestDistance))
+		{
+			bestCost = cost;
+			bestCut = i;
+		}
+	}
+
+	// children are allocated as a pair
+	unsigned int leftChild = (unsigned int)nodes.size();
+	nodes.resize(leftChild + 2);
+	nodes[nodeIndex].first = leftChild;
+	nodes[nodeIndex].count = 0;
+
+	buildNode(scene, nodes, leftChild, first, bestCut, depth + 1);
+	buildNode(scene, nodes, leftChild + 1, first + bestCut, count - bestCut, depth + 1);
+}
+
+
+// build the tree of bounding boxes over the scene's lights that applyLighting() uses to skip groups of lights
+// fills in numLightNodes and lightNodeContainer, has to be redone if lights move
+void buildLightTree(Scene* scene)
+{
+	std::vector<LightNode> nodes(1);
+	nodes.reserve(scene->numLights * 2 + 1);
+	buildNode(scene, nodes, 0, 0, scene->numLights, 0);
+
+	// a scene without lights still gets a (zero sized) root, applyLighting() returns before looking at it
+	if (scene->numLights == 0)
+	{
+		for (int axis = 0; axis < 3; ++axis) nodes[0].boundsMin[axis] = nodes[0].boundsMax[axis] = 0.0f;
+	}
+
+	scene->numLightNodes = (unsigned int)nodes.size();
+	scene->lightNodeContainer = new LightNode[scene->numLightNodes];
+	std::copy(nodes.begin(), nodes.end(), scene->lightNodeContainer);
+}
@@ -0,0 +1,19 @@
+#ifndef __LIGHT_TREE_H
+#define __LIGHT_TREE_H
+
+#include "Scene.h"
+
+// most lights in a leaf of the light tree
+#define LIGHT_TREE_LEAF_SIZE 4
+
+// deepest node the builder creates (leaves at this depth can hold more lights), traversal stacks need LIGHT_TREE_MAX_DEPTH + 1 entries
+#define LIGHT_TREE_MAX_DEPTH 32
+#define LIGHT_TREE_STACK_SIZE (LIGHT_TREE_MAX_DEPTH + 1)
+
+// build the tree of bounding boxes over the scene's lights that applyLighting() uses to skip groups of lights
+// every node covers a run of consecutive lights, so visiting the leaves left to right meets the lights in scene order
+// (and their contributions are added up in the same order as a plain loop over the lights)
+// fills in numLightNodes and lightNodeContainer, has to be redone if lights move
+void buildLightTree(Scene* scene);
+
+#endif // __LIGHT_TREE_H
@@ -7,18 +7,46 @@
 
 #include "Scene.h"
 #include "Intersection.h"
+#include "Features.h"
+
+// number of lights whose last occluder is remembered (lights beyond this share slots, light j uses slot j % SHADOW_CACHE_SIZE)
+#define SHADOW_CACHE_SIZE 64
+
+// slot value for a light nothing has blocked yet
+#define NO_OCCLUDER 0xFFFFFFFF
+
+// per thread memory of which object last blocked each light, plus shadow ray counters
+// neighbouring shading points are usually blocked by the same object, so it is tested before walking the scene
+typedef struct ShadowCache
+{
+	unsigned int lastOccluder[SHADOW_CACHE_SIZE];	// sphere index, or numSpheres + box index (NO_OCCLUDER if none)
+	unsigned long long shadowRays;					// shadow rays cast
+	unsigned long long cacheHits;					// shadow rays answered by the remembered occluder
+} ShadowCache;
+
+// forget all occluders and zero the counters
+void resetShadowCache(ShadowCache* cache);
+
+// forget all occluders but keep the counters (so a pixel's work doesn't depend on the pixels rendered before it)
+void forgetOccluders(ShadowCache* cache);
 
 // test to see if light ray collides with any of the scene's objects
-bool isInShadow(const Scene* scene, const Ray* lightRay, const float lightDist);
+// *occluder is tested first and is set to the blocking object when one is found
+// (Features is the set of features the scene may use, see Features.h, the same goes for the functions below,
+// with FEATURE_COUNTERS the tests are counted into counters, otherwise it may be NULL)
+template <unsigned int Features = ALL_FEATURES>
+bool isInShadow(const Scene* scene, const Ray* lightRay, const float lightDist, unsigned int* occluder, RayCounters* counters);
 
 // apply diffuse lighting with respect to material's colouring
+template <unsigned int Features = ALL_FEATURES>
 Colour applyDiffuse(const Ray* lightRay, const Light* currentLight, const Intersection* intersect);
 
 // apply specular lighting using Blinn
 Colour applySpecular(const Ray* lightRay, const Light* currentLight, const float fLightProjection, const Ray* viewRay, const Intersection* intersect);
 
 // apply diffuse and specular lighting contributions for all lights in scene taking shadowing into account
-Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection* intersect); 
+template <unsigned int Features = ALL_FEATURES>
+Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection* intersect, ShadowCache* cache, RayCounters* counters);
 
 
 #endif // __LIGHTING_H
@@ -0,0 +1,298 @@
+#include <cmath>
+#include <algorithm>
+#include "PrimitiveSoA.h"
+#include "Simd.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+
+// whether this CPU (and OS) can run the AVX2 tests, checked once with CPUID
+bool cpuHasAVX2()
+{
+	unsigned int leaf1[4] = { 0 }, leaf7[4] = { 0 };
+
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	for (int i = 0; i < 4; ++i) leaf1[i] = (unsigned int)info[i];
+	__cpuidex(info, 7, 0);
+	for (int i = 0; i < 4; ++i) leaf7[i] = (unsigned int)info[i];
+#else
+	if (__get_cpuid_max(0, NULL) < 7) return false;
+	__get_cpuid(1, &leaf1[0], &leaf1[1], &leaf1[2], &leaf1[3]);
+	__get_cpuid_count(7, 0, &leaf7[0], &leaf7[1], &leaf7[2], &leaf7[3]);
+#endif
+
+	// AVX (ecx bit 28) and the OS saving the ymm registers (OSXSAVE, ecx bit 27, then XCR0 bits 1 and 2)
+	if ((leaf1[2] & (1u << 27)) == 0 || (leaf1[2] & (1u << 28)) == 0) return false;
+
+#ifdef _MSC_VER
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0Low, xcr0High;
+	__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)xcr0High << 32) | xcr0Low;
+#endif
+	if ((xcr0 & 6) != 6) return false;
+
+	// AVX2 (leaf 7 ebx bit 5)
+	return (leaf7[1] & (1u << 5)) != 0;
+}
+
+
+// copy the spheres and boxes into structure of arrays form, indexed by BVH primitive slot (call after buildBVH)
+void buildPrimitiveSoA(Scene* scene, bool allowSIMD)
+{
+	unsigned int numPrimitives = scene->numSpheres + scene->numBoxes;
+
+	// padded to a whole number of 8 wide blocks, 32 byte aligned so each block fills one AVX register
+	unsigned int numSlots = (numPrimitives + PRIMITIVE_SOA_WIDTH - 1) / PRIMITIVE_SOA_WIDTH * PRIMITIVE_SOA_WIDTH;
+	if (numSlots == 0) numSlots = PRIMITIVE_SOA_WIDTH;
+
+	float** arrays[] = { &scene->sphereX, &scene->sphereY, &scene->sphereZ, &scene->sphereRadiusSq,
+		&scene->boxMinX, &scene->boxMinY, &scene->boxMinZ, &scene->boxMaxX, &scene->boxMaxY, &scene->boxMaxZ };
+	for (unsigned int i = 0; i < sizeof(arrays) / sizeof(arrays[0]); ++i)
+	{
+		*arrays[i] = (float*)_mm_malloc(numSlots * sizeof(float), 32);
+	}
+
+	for (unsigned int slot = 0; slot < numSlots; ++slot)
+	{
+		unsigned int key = slot < numPrimitives ? scene->bvhPrimitiveContainer[slot] : numPrimitives;
+
+		// anything else in the slot (or padding) gets a radius squared of -infinity, so D is always -infinity
+		scene->sphereX[slot] = scene->sphereY[slot] = scene->sphereZ[slot] = 0.0f;
+		scene->sphereRadiusSq[slot] = -INFINITY;
+
+		// and NaN box bounds, so every slab time is NaN
+		scene->boxMinX[slot] = scene->boxMinY[slot] = scene->boxMinZ[slot] = NAN;
+		scene->boxMaxX[slot] = scene->boxMaxY[slot] = scene->boxMaxZ[slot] = NAN;
+
+		if (key < scene->numSpheres)
+		{
+			const Sphere& s = scene->sphereContainer[key];
+			scene->sphereX[slot] = s.pos.x;
+			scene->sphereY[slot] = s.pos.y;
+			scene->sphereZ[slot] = s.pos.z;
+			scene->sphereRadiusSq[slot] = s.size * s.size;
+		}
+		else if (key < numPrimitives)
+		{
+			// the slab test takes the min and max of the two times per axis, so which corner is which doesn't matter
+			const Box& b = scene->boxContainer[key - scene->numSpheres];
+			scene->boxMinX[slot] = std::min(b.p1.x, b.p2.x);
+			scene->boxMinY[slot] = std::min(b.p1.y, b.p2.y);
+			scene->boxMinZ[slot] = std::min(b.p1.z, b.p2.z);
+			scene->boxMaxX[slot] = std::max(b.p1.x, b.p2.x);
+			scene->boxMaxY[slot] = std::max(b.p1.y, b.p2.y);
+			scene->boxMaxZ[slot] = std::max(b.p1.z, b.p2.z);
+		}
+	}
+
+	bool avx2 = allowSIMD && cpuHasAVX2();
+	scene->useSphereSoA = avx2 && scene->numSpheres >= PRIMITIVE_SOA_MIN_SLOTS;
+	scene->useBoxSoA = avx2 && scene->numBoxes >= PRIMITIVE_SOA_MIN_SLOTS;
+}
+
+
+// lanes [0, count) of a block of 8 slots (count can be more than 8)
+AVX2_FUNCTION static inline __m256i validLanes(unsigned int count)
+{
+	return _mm256_cmpgt_epi32(_mm256_set1_epi32((int)(count < PRIMITIVE_SOA_WIDTH ? count : PRIMITIVE_SOA_WIDTH)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+
+// intersection times of the ray with 8 spheres, the same sums in the same order as isSphereIntersected
+// lanes with no hit (D < 0, neither time past EPSILON, or masked off) get NaN
+AVX2_FUNCTION static inline __m256 sphereTimes(const Scene* scene, const Ray* r, unsigned int slot, __m256i valid)
+{
+	__m256 distX = _mm256_sub_ps(_mm256_maskload_ps(scene->sphereX + slot, valid), _mm256_set1_ps(r->start.x));
+	__m256 distY = _mm256_sub_ps(_mm256_maskload_ps(scene->sphereY + slot, valid), _mm256_set1_ps(r->start.y));
+	__m256 distZ = _mm256_sub_ps(_mm256_maskload_ps(scene->sphereZ + slot, valid), _mm256_set1_ps(r->start.z));
+	__m256 radiusSq = _mm256_maskload_ps(scene->sphereRadiusSq + slot, valid);
+
+	// B = dir . dist, D = B * B - dist . dist + size * size (separate multiplies and adds, an FMA would round differently)
+	__m256 B = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(r->dir.x), distX), _mm256_mul_ps(_mm256_set1_ps(r->dir.y), distY)), _mm256_mul_ps(_mm256_set1_ps(r->dir.z), distZ));
+	__m256 distSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(distX, distX), _mm256_mul_ps(distY, distY)), _mm256_mul_ps(distZ, distZ));
+	__m256 D = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(B, B), distSq), radiusSq);
+
+	// D < 0 gives NaN here, which fails every comparison below
+	__m256 root = _mm256_sqrt_ps(D);
+	__m256 t0 = _mm256_sub_ps(B, root);
+	__m256 t1 = _mm256_add_ps(B, root);
+
+	// the nearer time if it is in front of the ray, otherwise the further one (t1 >= t0, so if t0 is too far t1 is too)
+	__m256 epsilon = _mm256_set1_ps(EPSILON);
+	__m256 t = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, epsilon, _CMP_GT_OQ));
+
+	// masked off lanes miss
+	__m256 inFront = _mm256_and_ps(_mm256_cmp_ps(t, epsilon, _CMP_GT_OQ), _mm256_castsi256_ps(valid));
+	return _mm256_blendv_ps(_mm256_set1_ps(NAN), t, inFront);
+}
+
+
+// times the ray enters and leaves one axis's slabs of 8 boxes (the smaller and bigger of the two plane crossings)
+AVX2_FUNCTION static inline void slabTimes(const float* lo, const float* hi, float start, float dir, __m256i valid, __m256* tsmaller, __m256* tbigger)
+{
+	__m256 s = _mm256_set1_ps(start), d = _mm256_set1_ps(dir);
+	__m256 t0 = _mm256_div_ps(_mm256_sub_ps(_mm256_maskload_ps(lo, valid), s), d);
+	__m256 t1 = _mm256_div_ps(_mm256_sub_ps(_mm256_maskload_ps(hi, valid), s), d);
+	*tsmaller = fminLanes(t0, t1);
+	*tbigger = fmaxLanes(t0, t1);
+}
+
+
+// entry times of the ray into 8 boxes, the same slab test as isBoxIntersected
+// (dividing by the direction like it does, multiplying by a reciprocal would round differently)
+// lanes with no hit (missed, entered before EPSILON, or masked off) get NaN
+AVX2_FUNCTION static inline __m256 boxTimes(const Scene* scene, const Ray* r, unsigned int slot, __m256i valid)
+{
+	const float* lo[3] = { scene->boxMinX + slot, scene->boxMinY + slot, scene->boxMinZ + slot };
+	const float* hi[3] = { scene->boxMaxX + slot, scene->boxMaxY + slot, scene->boxMaxZ + slot };
+	float start[3] = { r->start.x, r->start.y, r->start.z };
+	float dir[3] = { r->dir.x, r->dir.y, r->dir.z };
+
+	__m256 tmin, tmax;
+	slabTimes(lo[0], hi[0], start[0], dir[0], valid, &tmin, &tmax);
+	for (int axis = 1; axis < 3; ++axis)
+	{
+		__m256 tsmaller, tbigger;
+		slabTimes(lo[axis], hi[axis], start[axis], dir[axis], valid, &tsmaller, &tbigger);
+
+		// largest entry and smallest exit time over the axes (in any order, fmin and fmax can only differ in the sign of a zero, which never hits)
+		tmin = fmaxLanes(tsmaller, tmin);
+		tmax = fminLanes(tbigger, tmax);
+	}
+
+	// a hit unless tmin >= tmax, and only if in front of the ray (NaN fails the second test but not the first, as in the scalar test)
+	__m256 notBehind = _mm256_cmp_ps(tmin, tmax, _CMP_NGE_UQ);
+	__m256 inFront = _mm256_and_ps(_mm256_and_ps(notBehind, _mm256_cmp_ps(tmin, _mm256_set1_ps(EPSILON), _CMP_GT_OQ)), _mm256_castsi256_ps(valid));
+	return _mm256_blendv_ps(_mm256_set1_ps(NAN), tmin, inFront);
+}
+
+
+// keep the closer of each lane's best hit and this block's hits, or on equal distance the one with the lower key (NaN lanes never win)
+AVX2_FUNCTION static inline void keepClosest(__m256 times, __m256i keys, __m256* bestT, __m256i* bestKey, __m256* anyHit)
+{
+	__m256 tie = _mm256_and_ps(_mm256_cmp_ps(times, *bestT, _CMP_EQ_OQ), _mm256_castsi256_ps(_mm256_cmpgt_epi32(*bestKey, keys)));
+	__m256 hit = _mm256_or_ps(_mm256_cmp_ps(times, *bestT, _CMP_LT_OQ), tie);
+
+	*bestT = _mm256_blendv_ps(*bestT, times, hit);
+	*bestKey = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(*bestKey), _mm256_castsi256_ps(keys), hit));
+	*anyHit = _mm256_or_ps(*anyHit, hit);
+}
+
+
+// pick the closest of the 8 lanes' best hits, returns false if no lane hit anything
+AVX2_FUNCTION static inline bool closestLane(__m256 bestT, __m256i bestKey, __m256 anyHit, float* t, unsigned int* closest)
+{
+	if (_mm256_movemask_ps(anyHit) == 0) return false;
+
+	// lanes that never hit still hold the starting time and key, which any lane that did hit beats
+	float laneT[PRIMITIVE_SOA_WIDTH];
+	unsigned int laneKey[PRIMITIVE_SOA_WIDTH];
+	_mm256_storeu_ps(laneT, bestT);
+	_mm256_storeu_si256((__m256i*)laneKey, bestKey);
+
+	unsigned int best = 0;
+	for (unsigned int lane = 1; lane < PRIMITIVE_SOA_WIDTH; ++lane)
+	{
+		if (laneT[lane] < laneT[best] || (laneT[lane] == laneT[best] && laneKey[lane] < laneKey[best])) best = lane;
+	}
+
+	*t = laneT[best];
+	*closest = laneKey[best];
+	return true;
+}
+
+
+// the first lane of a block closer than maxT whose key isn't ignore
+AVX2_FUNCTION static inline bool firstLaneBefore(const Scene* scene, __m256 times, __m256 limit, unsigned int slot, unsigned int ignore, unsigned int* occluder)
+{
+	int hits = _mm256_movemask_ps(_mm256_cmp_ps(times, limit, _CMP_LT_OQ));
+
+	for (unsigned int lane = 0; hits != 0; ++lane, hits >>= 1)
+	{
+		unsigned int key = scene->bvhPrimitiveContainer[slot + lane];
+		if ((hits & 1) && key != ignore)
+		{
+			*occluder = key;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+// test the spheres in BVH primitive slots [first, first + count) for a collision closer than *t
+// 8 spheres at a time, keeping the closest time and key in each lane and picking the closest lane at the end
+AVX2_FUNCTION bool intersectSphereSlots(const Scene* scene, const Ray* r, unsigned int first, unsigned int count, float* t, unsigned int* closest, bool found)
+{
+	// keys are below 2^31, so signed comparisons work, and with nothing found key 0 stops ties beating MAX_RAY_DISTANCE
+	__m256 bestT = _mm256_set1_ps(*t);
+	__m256i bestKey = _mm256_set1_epi32(found ? (int)*closest : 0);
+	__m256 anyHit = _mm256_setzero_ps();
+
+	for (unsigned int i = 0; i < count; i += PRIMITIVE_SOA_WIDTH)
+	{
+		__m256i valid = validLanes(count - i);
+		__m256i keys = _mm256_maskload_epi32((const int*)scene->bvhPrimitiveContainer + first + i, valid);
+		keepClosest(sphereTimes(scene, r, first + i, valid), keys, &bestT, &bestKey, &anyHit);
+	}
+
+	return closestLane(bestT, bestKey, anyHit, t, closest);
+}
+
+
+// test the boxes in BVH primitive slots [first, first + count) for a collision closer than *t, as intersectSphereSlots
+AVX2_FUNCTION bool intersectBoxSlots(const Scene* scene, const Ray* r, unsigned int first, unsigned int count, float* t, unsigned int* closest, bool found)
+{
+	__m256 bestT = _mm256_set1_ps(*t);
+	__m256i bestKey = _mm256_set1_epi32(found ? (int)*closest : 0);
+	__m256 anyHit = _mm256_setzero_ps();
+
+	for (unsigned int i = 0; i < count; i += PRIMITIVE_SOA_WIDTH)
+	{
+		__m256i valid = validLanes(count - i);
+		__m256i keys = _mm256_maskload_epi32((const int*)scene->bvhPrimitiveContainer + first + i, valid);
+		keepClosest(boxTimes(scene, r, first + i, valid), keys, &bestT, &bestKey, &anyHit);
+	}
+
+	return closestLane(bestT, bestKey, anyHit, t, closest);
+}
+
+
+// test the spheres in BVH primitive slots [first, first + count) for any collision closer than maxT, skipping key ignore
+// 8 spheres at a time, stopping at the first block with a hit
+AVX2_FUNCTION bool isAnySphereSlotIntersected(const Scene* scene, const Ray* r, unsigned int first, unsigned int count, float maxT, unsigned int ignore, unsigned int* occluder)
+{
+	__m256 limit = _mm256_set1_ps(maxT);
+
+	for (unsigned int i = 0; i < count; i += PRIMITIVE_SOA_WIDTH)
+	{
+		if (firstLaneBefore(scene, sphereTimes(scene, r, first + i, validLanes(count - i)), limit, first + i, ignore, occluder)) return true;
+	}
+
+	return false;
+}
+
+
+// test the boxes in BVH primitive slots [first, first + count) for any collision closer than maxT, as isAnySphereSlotIntersected
+AVX2_FUNCTION bool isAnyBoxSlotIntersected(const Scene* scene, const Ray* r, unsigned int first, unsigned int count, float maxT, unsigned int ignore, unsigned int* occluder)
+{
+	__m256 limit = _mm256_set1_ps(maxT);
+
+	for (unsigned int i = 0; i < count; i += PRIMITIVE_SOA_WIDTH)
+	{
+		if (firstLaneBefore(scene, boxTimes(scene, r, first + i, validLanes(count - i)), limit, first + i, ignore, occluder)) return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,38 @@
+#ifndef __PRIMITIVE_SOA_H
+#define __PRIMITIVE_SOA_H
+
+#include "Scene.h"
+
+// number of spheres or boxes the AVX2 tests check at once
+#define PRIMITIVE_SOA_WIDTH 8
+
+// shorter runs of slots (most BVH leaves) are quicker to test one at a time with the scalar tests
+#define PRIMITIVE_SOA_MIN_SLOTS 8
+
+// whether this CPU (and OS) can run the AVX2 tests, checked once with CPUID
+bool cpuHasAVX2();
+
+// copy the spheres and boxes into structure of arrays form, indexed by BVH primitive slot (call after buildBVH)
+// slots holding the other kind of object never report a hit (a sphere radius squared of -infinity, NaN box bounds)
+// sets useSphereSoA / useBoxSoA if the CPU has AVX2, allowSIMD is true and there are enough spheres / boxes to fill a block
+void buildPrimitiveSoA(Scene* scene, bool allowSIMD);
+
+// the tests below use AVX2 and must only be called when useSphereSoA / useBoxSoA is set (callers use them for runs of at least PRIMITIVE_SOA_MIN_SLOTS)
+// they give exactly the same result as isSphereIntersected / isBoxIntersected on each object in turn (no fused multiply adds or reciprocals)
+
+// test the spheres in BVH primitive slots [first, first + count) for a collision closer than *t
+// on equal distance the lower key wins, and a hit only beats *closest at the same distance if its key is lower (found tells if *closest is set)
+// updates *t and *closest if a sphere is hit
+bool intersectSphereSlots(const Scene* scene, const Ray* r, unsigned int first, unsigned int count, float* t, unsigned int* closest, bool found);
+
+// test the boxes in BVH primitive slots [first, first + count) for a collision closer than *t, as intersectSphereSlots
+bool intersectBoxSlots(const Scene* scene, const Ray* r, unsigned int first, unsigned int count, float* t, unsigned int* closest, bool found);
+
+// test the spheres in BVH primitive slots [first, first + count) for any collision closer than maxT, skipping key ignore
+// sets *occluder to the key of the first slot hit
+bool isAnySphereSlotIntersected(const Scene* scene, const Ray* r, unsigned int first, unsigned int count, float maxT, unsigned int ignore, unsigned int* occluder);
+
+// test the boxes in BVH primitive slots [first, first + count) for any collision closer than maxT, as isAnySphereSlotIntersected
+bool isAnyBoxSlotIntersected(const Scene* scene, const Ray* r, unsigned int first, unsigned int count, float maxT, unsigned int ignore, unsigned int* occluder);
+
+#endif // __PRIMITIVE_SOA_H
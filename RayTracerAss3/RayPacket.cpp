@@ -0,0 +1,271 @@
+#include <cmath>
+#include "RayPacket.h"
+#include "Simd.h"
+
+// 8 rays of a packet as a structure of arrays, one lane per ray
+typedef struct PacketLanes
+{
+	__m256 startX, startY, startZ;
+	__m256 dirX, dirY, dirZ;
+	__m256 invX, invY, invZ;				// 1 / direction, for the node tests
+	__m256 t;								// closest hit so far
+	__m256i closest;						// key of the closest hit (0 until something is hit, so no tie can beat nothing)
+	__m256 found;							// lanes that have hit something
+	__m256 active;							// lanes traced by the packet (not padding or a ray handed to objectIntersection)
+} PacketLanes;
+
+
+// the lanes whose ray passes through a BVH node's bounds before its closest hit, the same slab test as isNodeIntersected
+AVX2_FUNCTION static inline __m256 nodeLanes(const BVHNode* node, const PacketLanes* lanes)
+{
+	__m256 start[3] = { lanes->startX, lanes->startY, lanes->startZ };
+	__m256 inv[3] = { lanes->invX, lanes->invY, lanes->invZ };
+	__m256 tmin = _mm256_set1_ps(-MAX_RAY_DISTANCE), tmax = _mm256_set1_ps(MAX_RAY_DISTANCE);
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node->boundsMin[axis]), start[axis]), inv[axis]);
+		__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node->boundsMax[axis]), start[axis]), inv[axis]);
+
+		// min_ps(a, b) is a < b ? a : b and max_ps(a, b) is a > b ? a : b, so NaN is skipped the same way as in the scalar test
+		tmin = _mm256_max_ps(_mm256_min_ps(t0, t1), tmin);
+		tmax = _mm256_min_ps(_mm256_blendv_ps(t0, t1, _mm256_cmp_ps(t0, t1, _CMP_LT_OQ)), tmax);
+	}
+
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ), _mm256_cmp_ps(tmax, _mm256_setzero_ps(), _CMP_GT_OQ));
+	return _mm256_and_ps(_mm256_and_ps(hit, _mm256_cmp_ps(tmin, lanes->t, _CMP_LE_OQ)), lanes->active);
+}
+
+
+// keep a hit at time times of object key in the lanes of mask that are closer than their closest hit so far,
+// or as close and with a lower key (what the nextafterf limit in objectIntersection does)
+AVX2_FUNCTION static inline void keepClosest(PacketLanes* lanes, __m256 times, unsigned int key, __m256 mask)
+{
+	__m256i keys = _mm256_set1_epi32((int)key);
+	__m256 tie = _mm256_and_ps(_mm256_cmp_ps(times, lanes->t, _CMP_EQ_OQ), _mm256_castsi256_ps(_mm256_cmpgt_epi32(lanes->closest, keys)));
+	__m256 hit = _mm256_and_ps(_mm256_or_ps(_mm256_cmp_ps(times, lanes->t, _CMP_LT_OQ), tie), mask);
+
+	lanes->t = _mm256_blendv_ps(lanes->t, times, hit);
+	lanes->closest = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(lanes->closest), _mm256_castsi256_ps(keys), hit));
+	lanes->found = _mm256_or_ps(lanes->found, hit);
+}
+
+
+// test 8 rays against one sphere, the same sums in the same order as isSphereIntersected (no fused multiply adds)
+AVX2_FUNCTION static inline void sphereLanes(const Sphere* s, unsigned int key, PacketLanes* lanes, __m256 mask)
+{
+	__m256 distX = _mm256_sub_ps(_mm256_set1_ps(s->pos.x), lanes->startX);
+	__m256 distY = _mm256_sub_ps(_mm256_set1_ps(s->pos.y), lanes->startY);
+	__m256 distZ = _mm256_sub_ps(_mm256_set1_ps(s->pos.z), lanes->startZ);
+
+	__m256 B = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lanes->dirX, distX), _mm256_mul_ps(lanes->dirY, distY)), _mm256_mul_ps(lanes->dirZ, distZ));
+	__m256 distSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(distX, distX), _mm256_mul_ps(distY, distY)), _mm256_mul_ps(distZ, distZ));
+	__m256 D = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(B, B), distSq), _mm256_set1_ps(s->size * s->size));
+
+	// D < 0 gives NaN here, which fails every comparison below
+	__m256 root = _mm256_sqrt_ps(D);
+	__m256 t0 = _mm256_sub_ps(B, root);
+	__m256 t1 = _mm256_add_ps(B, root);
+
+	// the nearer time if it is in front of the ray, otherwise the further one
+	__m256 epsilon = _mm256_set1_ps(EPSILON);
+	__m256 t = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, epsilon, _CMP_GT_OQ));
+
+	keepClosest(lanes, t, key, _mm256_and_ps(mask, _mm256_cmp_ps(t, epsilon, _CMP_GT_OQ)));
+}
+
+
+// test 8 rays against one box, the same slab test as isBoxIntersected (dividing by each ray's direction)
+AVX2_FUNCTION static inline void boxLanes(const Box* b, unsigned int key, PacketLanes* lanes, __m256 mask)
+{
+	__m256 t0X = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(b->p1.x), lanes->startX), lanes->dirX);
+	__m256 t0Y = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(b->p1.y), lanes->startY), lanes->dirY);
+	__m256 t0Z = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(b->p1.z), lanes->startZ), lanes->dirZ);
+	__m256 t1X = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(b->p2.x), lanes->startX), lanes->dirX);
+	__m256 t1Y = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(b->p2.y), lanes->startY), lanes->dirY);
+	__m256 t1Z = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(b->p2.z), lanes->startZ), lanes->dirZ);
+
+	__m256 tmin = fmaxLanes(fminLanes(t0X, t1X), fmaxLanes(fminLanes(t0Y, t1Y), fminLanes(t0Z, t1Z)));
+	__m256 tmax = fminLanes(fmaxLanes(t0X, t1X), fminLanes(fmaxLanes(t0Y, t1Y), fmaxLanes(t0Z, t1Z)));
+
+	// a hit unless tmin >= tmax (NaN doesn't count as >=), and only if in front of the ray
+	__m256 inFront = _mm256_and_ps(_mm256_cmp_ps(tmin, tmax, _CMP_NGE_UQ), _mm256_cmp_ps(tmin, _mm256_set1_ps(EPSILON), _CMP_GT_OQ));
+
+	keepClosest(lanes, tmin, key, _mm256_and_ps(mask, inFront));
+}
+
+
+// number of lanes set in a mask
+AVX2_FUNCTION static inline unsigned int countLanes(__m256 mask)
+{
+	unsigned int count = 0;
+	for (int bits = _mm256_movemask_ps(mask); bits; bits &= bits - 1) ++count;
+	return count;
+}
+
+
+// test the objects in BVH primitive slots [first, first + count) against the lanes of each block that reached them
+// (counting a test for each of those lanes if counters isn't NULL)
+AVX2_FUNCTION static void leafLanes(const Scene* scene, unsigned int first, unsigned int count, PacketLanes* lanes, const __m256* masks, unsigned int numBlocks, RayCounters* counters)
+{
+	for (unsigned int i = first; i < first + count; ++i)
+	{
+		unsigned int key = scene->bvhPrimitiveContainer[i];
+
+		for (unsigned int block = 0; block < numBlocks; ++block)
+		{
+			if (_mm256_movemask_ps(masks[block]) == 0) continue;
+
+			if (counters) counters->counts[key < scene->numSpheres ? COUNT_SPHERE_TESTS : COUNT_BOX_TESTS] += countLanes(masks[block]);
+
+			if (key < scene->numSpheres)
+			{
+				sphereLanes(&scene->sphereContainer[key], key, &lanes[block], masks[block]);
+			}
+			else
+			{
+				boxLanes(&scene->boxContainer[key - scene->numSpheres], key, &lanes[block], masks[block]);
+			}
+		}
+	}
+}
+
+
+// find the closest object hit by each of numRays (<= PACKET_MAX_RAYS) rays, walking the BVH once for the whole packet
+AVX2_FUNCTION void packetIntersection(const Scene* scene, const Ray* rays, unsigned int numRays, Intersection* intersects, RayCounters* counters)
+{
+	PacketLanes lanes[PACKET_MAX_RAYS / PACKET_LANES];
+	unsigned int numBlocks = (numRays + PACKET_LANES - 1) / PACKET_LANES;
+
+	// the packet's rays in lanes, padded with inactive lanes
+	// rays with non unit directions are left to objectIntersection, which tests them against everything
+	bool traced[PACKET_MAX_RAYS];
+	int firstTraced = -1;
+	for (unsigned int block = 0; block < numBlocks; ++block)
+	{
+		float v[9][PACKET_LANES];
+		int active[PACKET_LANES];
+
+		for (unsigned int lane = 0; lane < PACKET_LANES; ++lane)
+		{
+			unsigned int i = block * PACKET_LANES + lane;
+			const Ray* r = &rays[i < numRays ? i : numRays - 1];
+
+			v[0][lane] = r->start.x; v[1][lane] = r->start.y; v[2][lane] = r->start.z;
+			v[3][lane] = r->dir.x; v[4][lane] = r->dir.y; v[5][lane] = r->dir.z;
+			v[6][lane] = 1.0f / r->dir.x; v[7][lane] = 1.0f / r->dir.y; v[8][lane] = 1.0f / r->dir.z;
+
+			bool isTraced = i < numRays && !(fabsf(r->dir.dot() - 1.0f) > BVH_UNIT_TOLERANCE);
+			active[lane] = isTraced ? -1 : 0;
+			if (i < numRays) traced[i] = isTraced;
+			if (isTraced && firstTraced < 0) firstTraced = (int)i;
+		}
+
+		PacketLanes& l = lanes[block];
+		l.startX = _mm256_loadu_ps(v[0]); l.startY = _mm256_loadu_ps(v[1]); l.startZ = _mm256_loadu_ps(v[2]);
+		l.dirX = _mm256_loadu_ps(v[3]); l.dirY = _mm256_loadu_ps(v[4]); l.dirZ = _mm256_loadu_ps(v[5]);
+		l.invX = _mm256_loadu_ps(v[6]); l.invY = _mm256_loadu_ps(v[7]); l.invZ = _mm256_loadu_ps(v[8]);
+		l.t = _mm256_set1_ps(MAX_RAY_DISTANCE);
+		l.closest = _mm256_setzero_si256();
+		l.found = _mm256_setzero_ps();
+		l.active = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)active));
+	}
+
+	__m256 masks[PACKET_MAX_RAYS / PACKET_LANES];
+
+	if (firstTraced < 0)
+	{
+		// nothing for the packet to do
+	}
+	else if (scene->numBvhNodes == 1)
+	{
+		// the whole BVH is a single leaf, test everything without the bounds test (as objectIntersection does)
+		for (unsigned int block = 0; block < numBlocks; ++block) masks[block] = lanes[block].active;
+		leafLanes(scene, 0, scene->numSpheres + scene->numBoxes, lanes, masks, numBlocks, counters);
+	}
+	else
+	{
+		// the packet's rays are close to parallel, so the first ray's direction decides which child is nearer for all of them
+		const Vector& dir = rays[firstTraced].dir;
+
+		unsigned int stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize > 0)
+		{
+			const BVHNode* node = &scene->bvhNodeContainer[stack[--stackSize]];
+
+			// skip the node if no ray reaches it before its closest hit
+			int anyLane = 0;
+			for (unsigned int block = 0; block < numBlocks; ++block)
+			{
+				masks[block] = nodeLanes(node, &lanes[block]);
+				anyLane |= _mm256_movemask_ps(masks[block]);
+				if (counters) counters->counts[COUNT_NODE_TESTS] += countLanes(lanes[block].active);
+			}
+			if (anyLane == 0) continue;
+
+			if (node->count > 0)
+			{
+				leafLanes(scene, node->first, node->count, lanes, masks, numBlocks, counters);
+			}
+			else
+			{
+				// push the further child first, so the nearer one (by the centres of their bounds along dir) is visited first
+				const BVHNode* left = &scene->bvhNodeContainer[node->first];
+				const BVHNode* right = &scene->bvhNodeContainer[node->first + 1];
+				float ahead = 0.0f;
+				const float d[3] = { dir.x, dir.y, dir.z };
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					ahead += d[axis] * ((right->boundsMin[axis] + right->boundsMax[axis]) - (left->boundsMin[axis] + left->boundsMax[axis]));
+				}
+
+				if (ahead < 0.0f)
+				{
+					stack[stackSize++] = node->first;
+					stack[stackSize++] = node->first + 1;
+				}
+				else
+				{
+					stack[stackSize++] = node->first + 1;
+					stack[stackSize++] = node->first;
+				}
+			}
+		}
+	}
+
+	// hand the results back one ray at a time
+	for (unsigned int block = 0; block < numBlocks; ++block)
+	{
+		float t[PACKET_LANES];
+		unsigned int closest[PACKET_LANES];
+		_mm256_storeu_ps(t, lanes[block].t);
+		_mm256_storeu_si256((__m256i*)closest, lanes[block].closest);
+		int found = _mm256_movemask_ps(lanes[block].found);
+
+		for (unsigned int lane = 0; lane < PACKET_LANES && block * PACKET_LANES + lane < numRays; ++lane)
+		{
+			unsigned int i = block * PACKET_LANES + lane;
+
+			if (!traced[i] && counters)
+			{
+				objectIntersection<COUNTED_FEATURES>(scene, &rays[i], &intersects[i], counters);
+			}
+			else if (!traced[i])
+			{
+				objectIntersection(scene, &rays[i], &intersects[i], NULL);
+			}
+			else if (found & (1 << lane))
+			{
+				setIntersection(scene, &rays[i], closest[lane], t[lane], &intersects[i]);
+				if (counters) counters->counts[COUNT_HITS]++;
+			}
+			else
+			{
+				intersects[i].objectType = Intersection::NONE;
+			}
+		}
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef __RAY_PACKET_H
+#define __RAY_PACKET_H
+
+#include "Intersection.h"
+
+// most rays in a packet (8x8 pixels), traced in blocks of 8 SIMD lanes
+#define PACKET_MAX_RAYS 64
+#define PACKET_LANES 8
+
+// find the closest object hit by each of numRays (<= PACKET_MAX_RAYS) rays, walking the BVH once for the whole packet
+// a node is visited if any ray of the packet reaches it before its closest hit so far, then every ray that reached it tests its contents
+// gives exactly the same intersections as objectIntersection on each ray (rays with non unit directions are handed to it)
+// counts the node, sphere and box tests each ray takes and the hits into counters, unless it is NULL
+// needs AVX2 (only call once cpuHasAVX2() has said the CPU has it)
+void packetIntersection(const Scene* scene, const Ray* rays, unsigned int numRays, Intersection* intersects, RayCounters* counters);
+
+#endif // __RAY_PACKET_H
@@ -2,7 +2,11 @@
 Ray tracing tutorial of http://www.codermind.com/articles/Raytracer-in-C++-Introduction-What-is-ray-tracing.html
 It is free to use for educational purpose and cannot be redistributed outside of the tutorial pages. */
 
+#ifdef _WIN32
 #define TARGET_WINDOWS
+#else
+#define TARGET_MACLINUX
+#endif
 
 #pragma warning(disable: 4996)
 #include <stdio.h>
@@ -13,8 +17,30 @@ It is free to use for educational purpose and cannot be redistributed outside of
 #include "Intersection.h"
 #include "ImageIO.h"
 #include "LoadCL.h"
+#include "BVH.h"
+#include "LightTree.h"
+#include "PrimitiveSoA.h"
+#include "RayPacket.h"
+#include "Features.h"
+#include "RayCounters.h"
+#include "Benchmark.h"
+#include "ImageCompare.h"
+#include "HeatMap.h"
+#include "FrameBuffer.h"
+#include "FramePart.h"
+#include "ThreadPool.h"
+#include "TileScheduler.h"
+#include "RenderFarm.h"
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
 
-unsigned int buffer[MAX_WIDTH * MAX_HEIGHT];
+// the frame being rendered (allocated in main for the size of the job)
+// when only part of the image is rendered it holds the part's image, with its first pixel at (frameX0, frameY0) of the image
+FrameView frame;
+int frameX0 = 0, frameY0 = 0;
 
 // reflect the ray from an object
 Ray calculateReflection(const Ray* viewRay, const Intersection* intersect)
@@ -63,44 +89,61 @@ Ray calculateRefraction(const Ray* viewRay, const Intersection* intersect, float
 
 
 // follow a single ray until it's final destination (or maximum number of steps reached)
-Colour traceRay(const Scene* scene, Ray viewRay)
+// primaryHit (if not NULL) is what objectIntersection would find for the ray, already found by tracing it in a packet
+// Features is the set the scene's objects fit in (see Features.h), a scene without reflection or refraction stops at the first hit
+// with FEATURE_COUNTERS the rays and tests are counted into counters (otherwise it may be NULL)
+template <unsigned int Features>
+Colour traceRay(const Scene* scene, Ray viewRay, ShadowCache* shadowCache, const Intersection* primaryHit, RayCounters* counters)
 {
 	Colour output(0.0f, 0.0f, 0.0f); 								// colour value to be output
 	float currentRefractiveIndex = DEFAULT_REFRACTIVE_INDEX;		// current refractive index
 	float coef = 1.0f;												// amount of ray left to transmit
 	Intersection intersect;											// properties of current intersection
+	int level;														// bounce being traced
 
 																	// loop until reached maximum ray cast limit (unless loop is broken out of)
-	for (int level = 0; level < MAX_RAYS_CAST; ++level)
+	for (level = 0; level < MAX_RAYS_CAST; ++level)
 	{
 		// check for intersections between the view ray and any of the objects in the scene
 		// exit the loop if no intersection found
-		if (!objectIntersection(scene, &viewRay, &intersect)) break;
+		if (level == 0 && primaryHit)
+		{
+			intersect = *primaryHit;
+			if (intersect.objectType == Intersection::NONE) break;
+		}
+		else if (!objectIntersection<Features>(scene, &viewRay, &intersect, counters)) break;
 
 		// calculate response to collision: ie. get normal at point of collision and material of object
 		calculateIntersectionResponse(scene, &viewRay, &intersect);
 
 		// apply the diffuse and specular lighting 
-		if (!intersect.insideObject) output += coef * applyLighting(scene, &viewRay, &intersect);
+		if (!intersect.insideObject) output += coef * applyLighting<Features>(scene, &viewRay, &intersect, shadowCache, counters);
 
 		// if object has reflection or refraction component, adjust the view ray and coefficent of calculation and continue looping
-		if (intersect.material->reflection)
+		// (the new ray is only counted if there is a bounce left to trace it)
+		if ((Features & FEATURE_REFLECTION) && intersect.material->reflection)
 		{
 			viewRay = calculateReflection(&viewRay, &intersect);
 			coef *= intersect.material->reflection;
+			if ((Features & FEATURE_COUNTERS) && level + 1 < MAX_RAYS_CAST) counters->counts[COUNT_REFLECTION_RAYS]++;
 		}
-		else if (intersect.material->refraction)
+		else if ((Features & FEATURE_REFRACTION) && intersect.material->refraction)
 		{
 			viewRay = calculateRefraction(&viewRay, &intersect, &currentRefractiveIndex);
 			coef *= intersect.material->refraction;
+			if ((Features & FEATURE_COUNTERS) && level + 1 < MAX_RAYS_CAST) counters->counts[COUNT_REFRACTION_RAYS]++;
 		}
 		else
 		{
 			// if no reflection or refraction, then finish looping (cast no more rays)
+			if (Features & FEATURE_COUNTERS) counters->counts[COUNT_DEPTH + level]++;
 			return output;
 		}
 	}
 
+	// the sample traced level + 1 rays if the last one missed, MAX_RAYS_CAST if it ran out of bounces
+	if (Features & FEATURE_COUNTERS) counters->counts[COUNT_DEPTH + std::min(level, MAX_RAYS_CAST - 1)]++;
+
 	// if the calculation coefficient is non-zero, read from the environment map
 	if (coef > 0.0f)
 	{
@@ -112,25 +155,78 @@ Colour traceRay(const Scene* scene, Ray viewRay)
 	return output;
 }
 
-// render scene at given width and height and anti-aliasing level
-int render(Scene* scene, const int width, const int height, const int aaLevel, bool testMode)
+// primary ray through the point (fragmentx, fragmenty) of the image plane (coordinates relative to the centre of the image, in pixels)
+inline Ray primaryRay(const Scene* scene, const float dirStepSize, float fragmentx, float fragmenty)
+{
+	// direction of default forward facing ray
+	Vector dir = { fragmentx * dirStepSize, fragmenty * dirStepSize, 1.0f };
+
+	// rotated direction of ray
+	Vector rotatedDir = {
+		dir.x * cosf(scene->cameraRotation) - dir.z * sinf(scene->cameraRotation),
+		dir.y,
+		dir.x * sinf(scene->cameraRotation) + dir.z * cosf(scene->cameraRotation) };
+
+	// view ray starting from camera position and heading in rotated (normalised) direction
+	Ray viewRay = { scene->cameraPosition, normalise(rotatedDir) };
+
+	return viewRay;
+}
+
+// store the final colour of pixel (x, y) (coordinates relative to the centre of the image) in the frame buffer
+inline void storePixel(const Scene* scene, const int width, const int height, bool testMode, int x, int y, Colour output)
+{
+	unsigned int* out = framePixel(&frame, x + width / 2 - frameX0, y + height / 2 - frameY0);
+
+	if (!testMode)
+	{
+		// store saturated final colour value in image buffer
+		*out = output.convertToPixel(scene->exposure);
+	}
+	else
+	{
+		// store colour (calculated from x,y coordinates) in image buffer 
+		*out = Colour((x + width / 2) % 256 / 256.0f, 0, (y + height / 2) % 256 / 256.0f).convertToPixel();
+	}
+}
+
+// the secondary and shadow rays counted so far (the primary rays are the samples)
+static inline unsigned long long countedSecondaryRays(const RayCounters* counters, const ShadowCache* shadowCache)
+{
+	return counters->counts[COUNT_REFLECTION_RAYS] + counters->counts[COUNT_REFRACTION_RAYS] + shadowCache->shadowRays;
+}
+
+
+// render the pixels [x0, x1) x [y0, y1) (coordinates relative to the centre of the image) straight into their place in the frame buffer
+// with FEATURE_COUNTERS and a heat map, each pixel's tests and rays are recorded in it too (starting from an empty shadow cache)
+// returns the number of samples rendered
+template <unsigned int Features>
+unsigned int renderBlock(const Scene* scene, const int width, const int height, const int aaLevel, bool testMode, int x0, int y0, int x1, int y1, ShadowCache* shadowCache, RayCounters* counters, HeatMap* heatMap)
 {
 	// angle between each successive ray cast (per pixel, anti-aliasing uses a fraction of this)
 	const float dirStepSize = 1.0f / (0.5f * width / tanf(PIOVER180 * 0.5f * scene->cameraFieldOfView));
 
-	// pointer to output buffer
-	unsigned int* out = buffer;
-
 	// count of samples rendered
 	unsigned int samplesRendered = 0;
 
 	// loop through all the pixels
-	for (int y = -height / 2; y < height / 2; ++y)
+	for (int y = y0; y < y1; ++y)
 	{
-		for (int x = -width / 2; x < width / 2; ++x)
+		for (int x = x0; x < x1; ++x)
 		{
 			Colour output(0.0f, 0.0f, 0.0f);
 
+			// work counted before this pixel, the heat map gets the difference
+			unsigned long long testsBefore = 0, raysBefore = 0, samplesBefore = samplesRendered;
+			// the occluders are forgotten for every pixel (as the kernel does), otherwise its tests would depend on which
+			// pixels its worker happened to render before it
+			if ((Features & FEATURE_COUNTERS) && heatMap != NULL)
+			{
+				forgetOccluders(shadowCache);
+				testsBefore = totalTests(counters);
+				raysBefore = countedSecondaryRays(counters, shadowCache);
+			}
+
 			// calculate multiple samples for each pixel
 			const float sampleStep = 1.0f / aaLevel, sampleRatio = 1.0f / (aaLevel * aaLevel);
 
@@ -139,42 +235,434 @@ int render(Scene* scene, const int width, const int height, const int aaLevel, b
 			{
 				for (float fragmenty = float(y); fragmenty < y + 1.0f; fragmenty += sampleStep)
 				{
-					// direction of default forward facing ray
-					Vector dir = { fragmentx * dirStepSize, fragmenty * dirStepSize, 1.0f };
+					// follow ray and add proportional of the result to the final pixel colour
+					output += sampleRatio * traceRay<Features>(scene, primaryRay(scene, dirStepSize, fragmentx, fragmenty), shadowCache, NULL, counters);
 
-					// rotated direction of ray
-					Vector rotatedDir = {
-						dir.x * cosf(scene->cameraRotation) - dir.z * sinf(scene->cameraRotation),
-						dir.y,
-						dir.x * sinf(scene->cameraRotation) + dir.z * cosf(scene->cameraRotation) };
+					// count this sample
+					samplesRendered++;
+				}
+			}
 
-					// view ray starting from camera position and heading in rotated (normalised) direction
-					Ray viewRay = { scene->cameraPosition, normalise(rotatedDir) };
+			storePixel(scene, width, height, testMode, x, y, output);
 
-					// follow ray and add proportional of the result to the final pixel colour
-					output += sampleRatio * traceRay(scene, viewRay);
+			if ((Features & FEATURE_COUNTERS) && heatMap != NULL)
+			{
+				size_t pixel = (size_t)(y + height / 2) * width + (x + width / 2);
+				heatMap->tests[pixel] = (unsigned int)(totalTests(counters) - testsBefore);
+				heatMap->rays[pixel] = (unsigned int)(countedSecondaryRays(counters, shadowCache) - raysBefore + samplesRendered - samplesBefore);
+			}
+		}
+	}
 
-					// count this sample
+	return samplesRendered;
+}
+
+// render the pixels [x0, x1) x [y0, y1) like renderBlock, but finding the primary ray hits of packetSize x packetSize pixels at a time as one packet
+// after the first hit each ray carries on alone (reflections and refractions scatter too much to keep them together)
+// every pixel's samples are added up in the same order as in renderBlock, so the image is identical
+template <unsigned int Features>
+unsigned int renderPacketBlock(const Scene* scene, const int width, const int height, const int aaLevel, bool testMode, int x0, int y0, int x1, int y1, int packetSize, ShadowCache* shadowCache, RayCounters* counters)
+{
+	const float dirStepSize = 1.0f / (0.5f * width / tanf(PIOVER180 * 0.5f * scene->cameraFieldOfView));
+	const float sampleStep = 1.0f / aaLevel, sampleRatio = 1.0f / (aaLevel * aaLevel);
+
+	unsigned int samplesRendered = 0;
+
+	for (int py = y0; py < y1; py += packetSize)
+	{
+		for (int px = x0; px < x1; px += packetSize)
+		{
+			// the pixels of this packet (smaller at the edges of the block)
+			int packetWidth = std::min(packetSize, x1 - px);
+			int numPixels = packetWidth * std::min(packetSize, y1 - py);
+
+			// colour so far and next sample position of each pixel, stepped exactly as renderBlock's loops step them
+			Colour output[PACKET_MAX_RAYS];
+			float fragmentx[PACKET_MAX_RAYS], fragmenty[PACKET_MAX_RAYS];
+			for (int p = 0; p < numPixels; ++p)
+			{
+				output[p] = Colour(0.0f, 0.0f, 0.0f);
+				fragmentx[p] = float(px + p % packetWidth);
+				fragmenty[p] = float(py + p / packetWidth);
+			}
+
+			// one packet per sample position, until every pixel has had all its samples
+			while (true)
+			{
+				Ray rays[PACKET_MAX_RAYS];
+				int rayPixel[PACKET_MAX_RAYS];
+				unsigned int numRays = 0;
+
+				for (int p = 0; p < numPixels; ++p)
+				{
+					if (fragmentx[p] < (px + p % packetWidth) + 1.0f)
+					{
+						rays[numRays] = primaryRay(scene, dirStepSize, fragmentx[p], fragmenty[p]);
+						rayPixel[numRays++] = p;
+					}
+				}
+				if (numRays == 0) break;
+
+				Intersection hits[PACKET_MAX_RAYS];
+				packetIntersection(scene, rays, numRays, hits, (Features & FEATURE_COUNTERS) ? counters : NULL);
+
+				for (unsigned int i = 0; i < numRays; ++i)
+				{
+					int p = rayPixel[i], y = py + p / packetWidth;
+
+					output[p] += sampleRatio * traceRay<Features>(scene, rays[i], shadowCache, &hits[i], counters);
 					samplesRendered++;
+
+					// next sub-location (inner loop over fragmenty, outer over fragmentx)
+					fragmenty[p] += sampleStep;
+					if (!(fragmenty[p] < y + 1.0f))
+					{
+						fragmentx[p] += sampleStep;
+						fragmenty[p] = float(y);
+					}
 				}
 			}
 
-			if (!testMode)
+			for (int p = 0; p < numPixels; ++p)
 			{
-				// store saturated final colour value in image buffer
-				*out++ = output.convertToPixel(scene->exposure);
+				storePixel(scene, width, height, testMode, px + p % packetWidth, py + p / packetWidth, output[p]);
+			}
+		}
+	}
+
+	return samplesRendered;
+}
+
+// about how many samples the wavefront renderer traces together
+#define WAVEFRONT_BATCH 4096
+
+// a ray of the wavefront renderer's stream, with the state traceRay() keeps in its locals
+typedef struct StreamRay
+{
+	Ray ray;
+	float coef;								// amount of ray left to transmit
+	float refractiveIndex;					// current refractive index
+	unsigned int sample;					// the sample whose colour it adds to
+} StreamRay;
+
+// buffers of the wavefront renderer, one set per worker, reused (without reallocating) for every block
+typedef struct WavefrontBuffers
+{
+	std::vector<StreamRay> rays;			// rays of the current bounce
+	std::vector<StreamRay> nextRays;		// reflected and refracted rays of the current bounce, sorted by direction octant
+	std::vector<Intersection> hits;			// what each ray of the current bounce hit
+	std::vector<unsigned int> order;		// indices of the rays that hit something, grouped by material type
+	std::vector<Colour> sampleColour;		// colour so far of each sample
+	std::vector<unsigned int> samplePixel;	// pixel (index within the block) each sample belongs to
+	std::vector<Colour> pixelColour;		// final colour of each pixel of the block
+} WavefrontBuffers;
+
+// which of the 8 octants a direction points into
+inline unsigned int directionOctant(const Vector& dir)
+{
+	return (dir.x < 0.0f ? 1 : 0) | (dir.y < 0.0f ? 2 : 0) | (dir.z < 0.0f ? 4 : 0);
+}
+
+// render the pixels [x0, x1) x [y0, y1) like renderBlock, but a bounce at a time for all of the block's samples together:
+// every ray of the stream is intersected, the hits are shaded grouped by material type, and the reflected and refracted rays
+// are compacted into the next bounce's stream sorted by direction octant (packetSize > 1 intersects the stream in packets)
+// each sample still adds up its bounces in order and each pixel its samples in order, so the image is identical to renderBlock's
+template <unsigned int Features>
+unsigned int renderWavefrontBlock(const Scene* scene, const int width, const int height, const int aaLevel, bool testMode, int x0, int y0, int x1, int y1, int packetSize, WavefrontBuffers* buffers, ShadowCache* shadowCache, RayCounters* counters)
+{
+	const float dirStepSize = 1.0f / (0.5f * width / tanf(PIOVER180 * 0.5f * scene->cameraFieldOfView));
+	const float sampleStep = 1.0f / aaLevel, sampleRatio = 1.0f / (aaLevel * aaLevel);
+	const Colour& skybox = scene->materialContainer[scene->skyboxMaterialId].diffuse;
+
+	std::vector<StreamRay>& rays = buffers->rays;
+	std::vector<StreamRay>& nextRays = buffers->nextRays;
+	std::vector<Intersection>& hits = buffers->hits;
+	std::vector<unsigned int>& order = buffers->order;
+	std::vector<Colour>& sampleColour = buffers->sampleColour;
+	std::vector<unsigned int>& samplePixel = buffers->samplePixel;
+
+	// generate every primary ray of the block, pixels in the same order and sub-locations in the same steps as renderBlock
+	rays.clear();
+	sampleColour.clear();
+	samplePixel.clear();
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = x0; x < x1; ++x)
+		{
+			for (float fragmentx = float(x); fragmentx < x + 1.0f; fragmentx += sampleStep)
+			{
+				for (float fragmenty = float(y); fragmenty < y + 1.0f; fragmenty += sampleStep)
+				{
+					StreamRay streamRay = { primaryRay(scene, dirStepSize, fragmentx, fragmenty), 1.0f, DEFAULT_REFRACTIVE_INDEX, (unsigned int)sampleColour.size() };
+					rays.push_back(streamRay);
+					sampleColour.push_back(Colour(0.0f, 0.0f, 0.0f));
+					samplePixel.push_back((y - y0) * (x1 - x0) + (x - x0));
+				}
+			}
+		}
+	}
+	unsigned int samplesRendered = (unsigned int)rays.size();
+
+	for (int level = 0; level < MAX_RAYS_CAST && !rays.empty(); ++level)
+	{
+		unsigned int numRays = (unsigned int)rays.size();
+		hits.resize(numRays);
+
+		// intersect the whole stream
+		if (packetSize > 1)
+		{
+			Ray packet[PACKET_MAX_RAYS];
+			for (unsigned int first = 0; first < numRays; first += PACKET_MAX_RAYS)
+			{
+				unsigned int count = std::min(numRays - first, (unsigned int)PACKET_MAX_RAYS);
+				for (unsigned int i = 0; i < count; ++i) packet[i] = rays[first + i].ray;
+				packetIntersection(scene, packet, count, &hits[first], (Features & FEATURE_COUNTERS) ? counters : NULL);
+			}
+		}
+		else
+		{
+			for (unsigned int i = 0; i < numRays; ++i) objectIntersection<Features>(scene, &rays[i].ray, &hits[i], counters);
+		}
+
+		// rays that left the scene read from the environment map, the rest get their normal and material
+		unsigned int typeCount[4] = { 0 };
+		for (unsigned int i = 0; i < numRays; ++i)
+		{
+			if (hits[i].objectType == Intersection::NONE)
+			{
+				if (rays[i].coef > 0.0f) sampleColour[rays[i].sample] += rays[i].coef * skybox;
+				if (Features & FEATURE_COUNTERS) counters->counts[COUNT_DEPTH + level]++;
+				continue;
+			}
+
+			calculateIntersectionResponse(scene, &rays[i].ray, &hits[i]);
+			typeCount[hits[i].material->type]++;
+		}
+
+		// shade the hits a material type at a time (counting sort, so each group keeps stream order)
+		unsigned int typeStart[4] = { 0, typeCount[0], typeCount[0] + typeCount[1], typeCount[0] + typeCount[1] + typeCount[2] };
+		order.resize(typeStart[3] + typeCount[3]);
+		for (unsigned int i = 0; i < numRays; ++i)
+		{
+			if (hits[i].objectType != Intersection::NONE) order[typeStart[hits[i].material->type]++] = i;
+		}
+
+		for (size_t j = 0; j < order.size(); ++j)
+		{
+			const StreamRay& r = rays[order[j]];
+			const Intersection& intersect = hits[order[j]];
+
+			if (!intersect.insideObject) sampleColour[r.sample] += r.coef * applyLighting<Features>(scene, &r.ray, &intersect, shadowCache, counters);
+		}
+
+		// reflect or refract into the next bounce's stream, sorted by direction octant so similar rays are intersected together
+		// (rays that stop at a diffuse surface are finished and don't read the environment map)
+		unsigned int octantCount[8] = { 0 };
+		for (unsigned int i = 0; i < numRays; ++i)
+		{
+			if (hits[i].objectType == Intersection::NONE) continue;
+
+			StreamRay& r = rays[i];
+			const Material* material = hits[i].material;
+
+			if ((Features & FEATURE_REFLECTION) && material->reflection)
+			{
+				r.ray = calculateReflection(&r.ray, &hits[i]);
+				r.coef *= material->reflection;
+				if ((Features & FEATURE_COUNTERS) && level + 1 < MAX_RAYS_CAST) counters->counts[COUNT_REFLECTION_RAYS]++;
+			}
+			else if ((Features & FEATURE_REFRACTION) && material->refraction)
+			{
+				r.ray = calculateRefraction(&r.ray, &hits[i], &r.refractiveIndex);
+				r.coef *= material->refraction;
+				if ((Features & FEATURE_COUNTERS) && level + 1 < MAX_RAYS_CAST) counters->counts[COUNT_REFRACTION_RAYS]++;
 			}
 			else
 			{
-				// store colour (calculated from x,y coordinates) in image buffer 
-				*out++ = Colour((x + width / 2) % 256 / 256.0f, 0, (y + height / 2) % 256 / 256.0f).convertToPixel();
+				hits[i].objectType = Intersection::NONE;
+				if (Features & FEATURE_COUNTERS) counters->counts[COUNT_DEPTH + level]++;
+				continue;
 			}
+
+			octantCount[directionOctant(r.ray.dir)]++;
+		}
+
+		unsigned int octantStart[8];
+		unsigned int numNextRays = 0;
+		for (int octant = 0; octant < 8; ++octant)
+		{
+			octantStart[octant] = numNextRays;
+			numNextRays += octantCount[octant];
+		}
+
+		nextRays.resize(numNextRays);
+		for (unsigned int i = 0; i < numRays; ++i)
+		{
+			if (hits[i].objectType != Intersection::NONE) nextRays[octantStart[directionOctant(rays[i].ray.dir)]++] = rays[i];
+		}
+
+		rays.swap(nextRays);
+	}
+
+	// rays still going after MAX_RAYS_CAST bounces read from the environment map
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		if (rays[i].coef > 0.0f) sampleColour[rays[i].sample] += rays[i].coef * skybox;
+	}
+	if (Features & FEATURE_COUNTERS) counters->counts[COUNT_DEPTH + MAX_RAYS_CAST - 1] += rays.size();
+
+	// add up each pixel's samples in the order they were generated
+	std::vector<Colour>& output = buffers->pixelColour;
+	output.assign((y1 - y0) * (x1 - x0), Colour(0.0f, 0.0f, 0.0f));
+	for (size_t i = 0; i < sampleColour.size(); ++i)
+	{
+		output[samplePixel[i]] += sampleRatio * sampleColour[i];
+	}
+
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = x0; x < x1; ++x)
+		{
+			storePixel(scene, width, height, testMode, x, y, output[(y - y0) * (x1 - x0) + (x - x0)]);
 		}
 	}
 
 	return samplesRendered;
 }
 
+// render scene at given width and height and anti-aliasing level
+// the part of the image being rendered (usually all of it) is cut into its tiles, which the workers of the pool render through the work-stealing scheduler
+// packetSize > 1 traces the primary rays in packetSize x packetSize packets (needs AVX2)
+// wavefront renders bands of rows a bounce at a time (see renderWavefrontBlock), intersecting in packets if packetSize > 1
+// the tracer is compiled for the feature set Features, which has to cover the scene (see Features.h)
+// the frame's rays are counted into counters, the tests and bounces only with FEATURE_COUNTERS
+// (which also fills in heatMap if it isn't NULL, single rays only)
+template <unsigned int Features>
+int render(Scene* scene, const int width, const int height, const int aaLevel, bool testMode, ThreadPool& pool, TileScheduler& scheduler, const FramePart* part, const int packetSize, bool wavefront, RayCounters* counters, HeatMap* heatMap)
+{
+	// total count of samples rendered
+	std::atomic<unsigned int> samplesRendered(0);
+
+	// each worker counts into its own counters, they are added up once the frame is done
+	std::vector<RayCounters> workerCounters(scheduler.numWorkers);
+
+	scheduler.reset(width, height, part);
+
+	std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
+	pool.run([&](unsigned int worker)
+	{
+		unsigned int workerSamples = 0;
+		Tile tile;
+
+		// each worker remembers its own occluders, neighbouring pixels of its tiles tend to share them
+		ShadowCache shadowCache;
+		resetShadowCache(&shadowCache);
+
+		WavefrontBuffers wavefrontBuffers;
+
+		RayCounters* rayCounters = &workerCounters[worker];
+		resetRayCounters(rayCounters);
+
+		while (scheduler.next(worker, &tile))
+		{
+			std::chrono::steady_clock::time_point tileStart = std::chrono::steady_clock::now();
+
+			// render a row (or a row of packets, or a band of about WAVEFRONT_BATCH samples) at a time,
+			// so a tile that turns out to be expensive can give away what it has left
+			int rows = wavefront ? std::max(WAVEFRONT_BATCH / ((tile.x1 - tile.x0) * aaLevel * aaLevel), 1) : packetSize;
+			for (int y = tile.y0; y < tile.y1; y += rows)
+			{
+				scheduler.trySplit(worker, &tile, y);
+
+				if (wavefront)
+				{
+					workerSamples += renderWavefrontBlock<Features>(scene, width, height, aaLevel, testMode, tile.x0, y, tile.x1, std::min(y + rows, tile.y1), packetSize, &wavefrontBuffers, &shadowCache, rayCounters);
+				}
+				else if (packetSize > 1)
+				{
+					workerSamples += renderPacketBlock<Features>(scene, width, height, aaLevel, testMode, tile.x0, y, tile.x1, std::min(y + packetSize, tile.y1), packetSize, &shadowCache, rayCounters);
+				}
+				else
+				{
+					workerSamples += renderBlock<Features>(scene, width, height, aaLevel, testMode, tile.x0, y, tile.x1, y + 1, &shadowCache, rayCounters, heatMap);
+				}
+			}
+
+			scheduler.finished(worker);
+			scheduler.stats[worker].busyMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tileStart).count();
+		}
+
+		samplesRendered += workerSamples;
+		scheduler.stats[worker].shadowRays = shadowCache.shadowRays;
+		scheduler.stats[worker].shadowCacheHits = shadowCache.cacheHits;
+
+		// the primary and shadow rays are always counted (as samples and by the shadow cache)
+		rayCounters->counts[COUNT_PRIMARY_RAYS] = workerSamples;
+		rayCounters->counts[COUNT_SHADOW_RAYS] = shadowCache.shadowRays;
+		rayCounters->counts[COUNT_SHADOW_CACHE_HITS] = shadowCache.cacheHits;
+	});
+
+	resetRayCounters(counters);
+	for (unsigned int i = 0; i < scheduler.numWorkers; ++i)
+	{
+		addRayCounters(counters, &workerCounters[i]);
+	}
+
+	// whatever part of the frame a worker didn't spend rendering it spent idle
+	double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+	for (unsigned int i = 0; i < scheduler.numWorkers; ++i)
+	{
+		scheduler.stats[i].idleMs = std::max(frameMs - scheduler.stats[i].busyMs, 0.0);
+	}
+
+	return samplesRendered;
+}
+
+// render() compiled for one feature set
+typedef int (*RenderFunction)(Scene* scene, const int width, const int height, const int aaLevel, bool testMode, ThreadPool& pool, TileScheduler& scheduler, const FramePart* part, const int packetSize, bool wavefront, RayCounters* counters, HeatMap* heatMap);
+
+// the render() compiled for a feature set (one of FOR_EACH_FEATURE_SET's, or COUNTED_FEATURES)
+RenderFunction renderFunction(unsigned int features)
+{
+#define RENDER_FUNCTION(set) if (features == (set)) return render<set>;
+	FOR_EACH_FEATURE_SET(RENDER_FUNCTION)
+	RENDER_FUNCTION(COUNTED_FEATURES)
+#undef RENDER_FUNCTION
+
+	return render<ALL_FEATURES>;
+}
+
+
+// print what each worker did during the last frame
+void outputWorkerStats(const TileScheduler* scheduler)
+{
+	unsigned long long shadowRays = 0, shadowCacheHits = 0;
+
+	printf("worker   tiles  stolen   split    busy (ms)    idle (ms)   shadow rays  cache hits\n");
+	for (unsigned int i = 0; i < scheduler->numWorkers; ++i)
+	{
+		const WorkerStats& stats = scheduler->stats[i];
+		printf("%6u  %6u  %6u  %6u  %11.1f  %11.1f  %12llu  %10llu\n", i, stats.tilesRendered, stats.tilesStolen, stats.tilesSplit, stats.busyMs, stats.idleMs, stats.shadowRays, stats.shadowCacheHits);
+
+		shadowRays += stats.shadowRays;
+		shadowCacheHits += stats.shadowCacheHits;
+	}
+
+	printf("shadow rays: %llu, occluder cache hit rate: %.1f%%\n", shadowRays, shadowRays ? 100.0 * shadowCacheHits / shadowRays : 0.0);
+}
+
+// per worker process jobs and busy/idle time of the last run
+void outputFarmStats(const RenderFarm* farm)
+{
+	printf("process     pid    jobs   split    busy (ms)    idle (ms)\n");
+	for (unsigned int i = 0; i < farm->numWorkers; ++i)
+	{
+		const FarmWorkerStats& stats = farm->stats[i];
+		printf("%7u  %6d  %6u  %6u  %11.1f  %11.1f\n", i, stats.pid, stats.jobsRendered, stats.jobsSplit, stats.busyMs, stats.idleMs);
+	}
+}
+
 // output a bunch of info about the contents of the scene
 /*void outputInfo(const Scene* scene)
 {
@@ -266,6 +754,19 @@ int render(Scene* scene, const int width, const int height, const int aaLevel, b
 }*/
 
 
+// the file name part of a path (either kind of slash)
+const char* baseName(const char* path)
+{
+	const char* name = path;
+	for (const char* c = path; *c; ++c)
+	{
+		if (*c == '/' || *c == '\\') name = c + 1;
+	}
+
+	return name;
+}
+
+
 // read command line arguments, render, and write out BMP file
 int main(int argc, char* argv[])
 {
@@ -276,6 +777,35 @@ int main(int argc, char* argv[])
 	// rendering options
 	int times = 1;
 	bool testMode = false;
+	unsigned int numThreads = std::thread::hardware_concurrency();
+	int blockSize = 32;
+	bool workerStats = false;
+	float lightEpsilon = 0.0f;
+	bool allowSIMD = true;
+	int packetSize = 1;
+	bool wavefront = false;
+	bool genericTracer = false;
+	bool countRays = false;
+	bool hugePages = false;
+
+	// worker processes rendering the tiles (0 renders them with this process's threads, see RenderFarm.h)
+	unsigned int farmWorkers = 0;
+
+	// part of the image to render (x0 y0 x1 y1, from the bottom left) and range of its tiles, the whole image unless given (see FramePart.h)
+	bool renderRegion = false;
+	int region[4];
+	int firstTile = 0, lastTile = -1;
+
+	// where the false colour image of each pixel's work is written, with a CSV summary of each tile (NULL for none, see writeHeatMap)
+	const char* heatMapFilename = NULL;
+
+	// file the timings are appended to as a JSON or CSV line (NULL for none, see writeBenchmark)
+	const char* benchmarkFilename = NULL;
+
+	// reference image to compare the frame with (NULL for none), the most mean absolute error that passes, and where to write a diff image
+	const char* referenceFilename = NULL;
+	double compareThreshold = 0.0;
+	const char* diffFilename = NULL;
 
 	// default input / output filenames
 	const char* inputFilename = "Scenes/cornell.txt";
@@ -307,6 +837,79 @@ int main(int argc, char* argv[])
 		{
 			times = atoi(argv[++i]);
 		}
+		else if (strcmp(argv[i], "-threads") == 0)
+		{
+			numThreads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-blockSize") == 0)
+		{
+			blockSize = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-lightEpsilon") == 0)
+		{
+			lightEpsilon = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-packet") == 0)
+		{
+			packetSize = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-wavefront") == 0)
+		{
+			wavefront = true;
+		}
+		else if (strcmp(argv[i], "-genericTracer") == 0)
+		{
+			genericTracer = true;
+		}
+		else if (strcmp(argv[i], "-counters") == 0)
+		{
+			countRays = true;
+		}
+		else if (strcmp(argv[i], "-heatmap") == 0)
+		{
+			heatMapFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-region") == 0)
+		{
+			renderRegion = true;
+			for (int k = 0; k < 4; ++k) region[k] = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-tiles") == 0)
+		{
+			if (!parseTileRange(argv[++i], &firstTile, &lastTile)) return -1;
+		}
+		else if (strcmp(argv[i], "-farm") == 0)
+		{
+			farmWorkers = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-hugePages") == 0)
+		{
+			hugePages = true;
+		}
+		else if (strcmp(argv[i], "-noSIMD") == 0)
+		{
+			allowSIMD = false;
+		}
+		else if (strcmp(argv[i], "-workerStats") == 0)
+		{
+			workerStats = true;
+		}
+		else if (strcmp(argv[i], "-benchmark") == 0)
+		{
+			benchmarkFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-compare") == 0)
+		{
+			referenceFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-compareThreshold") == 0)
+		{
+			compareThreshold = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-compareDiff") == 0)
+		{
+			diffFilename = argv[++i];
+		}
 		else if (strcmp(argv[i], "-testMode") == 0)
 		{
 			testMode = true;
@@ -318,19 +921,158 @@ int main(int argc, char* argv[])
 	}
 
 	// nasty (and fragile) kludge to make an ok-ish default output filename (can be overriden with "-output" command line option)
-	sprintf(outputFilenameBuffer, "Outputs/%s_%dx%dx%d_%s.bmp", (strrchr(inputFilename, '/') + 1), width, height, samples, (strrchr(argv[0], '\\') + 1));
+	sprintf(outputFilenameBuffer, "Outputs/%s_%dx%dx%d_%s.bmp", baseName(inputFilename), width, height, samples, baseName(argv[0]));
 
 	// read scene file
+	Timer loadTimer;
 	Scene scene;
 	if (!init(inputFilename, scene))
 	{
 		fprintf(stderr, "Failure when reading the Scene file.\n");
 		return -1;
 	}
+	loadTimer.end();
+	int loadTime = loadTimer.getMilliseconds();
+
+	// everything timed is also kept for -benchmark
+	Benchmark benchmark;
+	resetBenchmark(&benchmark);
+	benchmark.loadMs = loadTimer.getMillisecondsExact();
+
+	// build the acceleration structures (timed separately from parsing the file)
+	loadTimer.start();
+	buildBVH(&scene);
+	buildLightTree(&scene);
+	buildPrimitiveSoA(&scene, allowSIMD);
+	loadTimer.end();
+	int bvhTime = loadTimer.getMilliseconds();
+	benchmark.bvhMs = loadTimer.getMillisecondsExact();
+	printf("scene load time: %dms, BVH build time: %dms (%u nodes, %u light nodes), sphere tests: %s, box tests: %s\n", loadTime, bvhTime, scene.numBvhNodes, scene.numLightNodes, scene.useSphereSoA ? "AVX2" : "scalar", scene.useBoxSoA ? "AVX2" : "scalar");
+
+	// use the tracer compiled for the fewest features that covers the scene (or the one that handles everything, counted or not)
+	// the heat map is made from the counts
+	unsigned int features = sceneFeatures(&scene);
+	unsigned int featureSet = (countRays || heatMapFilename != NULL) ? COUNTED_FEATURES : genericTracer ? ALL_FEATURES : pickFeatureSet(features);
+	RenderFunction renderScene = renderFunction(featureSet);
+	char featureNames[2][80];
+	describeFeatures(features, featureNames[0]);
+	describeFeatures(featureSet, featureNames[1]);
+	printf("scene features: %s, tracer features: %s\n", featureNames[0], featureNames[1]);
+
+	// lights may be skipped at an intersection as long as they add up to no more than this (0 keeps the image exact)
+	scene.lightCullEpsilon = lightEpsilon;
 
 	// display info about the current scene
 	//outputInfo(&scene);
 
+	if (numThreads == 0) numThreads = 1;
+	if (blockSize < 1) blockSize = 1;
+
+	// packets are 2x2, 4x4 or 8x8 rays, and need the AVX2 tests
+	if (packetSize != 1 && packetSize != 2 && packetSize != 4 && packetSize != 8)
+	{
+		fprintf(stderr, "packet size must be 1, 2, 4 or 8, tracing single rays\n");
+		packetSize = 1;
+	}
+	if (packetSize > 1 && !(allowSIMD && cpuHasAVX2()))
+	{
+		fprintf(stderr, "packet tracing needs AVX2, tracing single rays\n");
+		packetSize = 1;
+	}
+
+	// the tiles of the image (or of the part of it given by -region and -tiles) that this run renders
+	FramePart framePart;
+	if (!createFramePart(&framePart, width, height, blockSize, renderRegion ? region : NULL, firstTile, lastTile))
+	{
+		return -1;
+	}
+	bool wholeFrame = isWholeFrame(&framePart);
+
+	// each pixel's work is recorded in the memory of the process that renders it
+	if (farmWorkers > 0 && heatMapFilename != NULL)
+	{
+		fprintf(stderr, "the heat map is made without worker processes\n");
+		farmWorkers = 0;
+	}
+
+	// the frame buffer is sized for the job, every row aligned (no limit on the size of the image beyond memory)
+	// a part of the image only needs room for the part, and worker processes render into one shared with them
+	FrameBuffer frameBuffer;
+	if (farmWorkers > 0 && !createSharedFrameBuffer(&frameBuffer, framePart.imageX1 - framePart.imageX0, framePart.imageY1 - framePart.imageY0, hugePages))
+	{
+		fprintf(stderr, "rendering without worker processes\n");
+		farmWorkers = 0;
+	}
+	if (farmWorkers == 0 && !createFrameBuffer(&frameBuffer, framePart.imageX1 - framePart.imageX0, framePart.imageY1 - framePart.imageY0, hugePages))
+	{
+		return -1;
+	}
+	frame = frameBuffer.view;
+	frameX0 = framePart.imageX0;
+	frameY0 = framePart.imageY0;
+
+	// a part is compared once it has been merged with the rest of the frame
+	if (!wholeFrame && referenceFilename != NULL)
+	{
+		fprintf(stderr, "only whole frames are compared with a reference, compare the merged image\n");
+		referenceFilename = NULL;
+	}
+
+	// the work of a packet or a wavefront band can't be told apart pixel by pixel
+	HeatMap heatMap;
+	if (heatMapFilename != NULL)
+	{
+		if (packetSize > 1 || wavefront) fprintf(stderr, "the heat map is made tracing single rays\n");
+		packetSize = 1;
+		wavefront = false;
+		createHeatMap(&heatMap, width, height);
+	}
+
+	// start the worker threads (or processes) before the timer, they are reused for every run
+	Timer setupTimer;
+
+	// worker processes are forked now the scene is built and the frame buffer is shared, so they render from this process's
+	// scene without loading it again, each with its share of the threads (started in the worker, threads don't survive a fork)
+	unsigned int threadsPerWorker = std::max(numThreads / std::max(farmWorkers, 1u), 1u);
+	std::unique_ptr<ThreadPool> workerPool;
+	std::unique_ptr<TileScheduler> workerScheduler;
+	RenderFarm farm(farmWorkers, [&](const FarmJob& job, RayCounters* jobCounters) -> unsigned int
+	{
+		if (!workerPool)
+		{
+			workerPool.reset(new ThreadPool(threadsPerWorker));
+			workerScheduler.reset(new TileScheduler(workerPool->size()));
+		}
+
+		int jobRegion[4] = { job.x0, job.y0, job.x1, job.y1 };
+		FramePart jobPart;
+		createFramePart(&jobPart, width, height, blockSize, jobRegion, job.tile, job.tile);
+		return renderScene(&scene, width, height, samples, testMode, *workerPool, *workerScheduler, &jobPart, packetSize, wavefront, jobCounters, NULL);
+	}, [&]()
+	{
+		workerScheduler.reset();
+		workerPool.reset();
+	});
+	if (farmWorkers > 0 && farm.numWorkers == 0)
+	{
+		fprintf(stderr, "rendering without worker processes\n");
+	}
+
+	// a job for each of the part's tiles
+	std::vector<FarmJob> farmJobs;
+	for (int tile = framePart.firstTile; tile <= framePart.lastTile && farm.numWorkers > 0; ++tile)
+	{
+		FarmJob job;
+		job.tile = tile;
+		if (framePartTile(&framePart, tile, &job.x0, &job.y0, &job.x1, &job.y1)) farmJobs.push_back(job);
+	}
+
+	// the coordinator leaves the rendering to the workers
+	ThreadPool pool(farm.numWorkers > 0 ? 1 : numThreads);
+	TileScheduler scheduler(pool.size());
+	setupTimer.end();
+	benchmark.setupMs = setupTimer.getMillisecondsExact();
+
 	Timer timer;																						// create timer
 
 	// OpenCL setup code goes here
@@ -339,14 +1081,28 @@ int main(int argc, char* argv[])
 	int firstTime = 0;
 	int totalTime = 0;
 	int samplesRendered = 0;
+	RayCounters rayCounters;
 	for (int i = 0; i < times; i++)
 	{
 		if (i > 0) timer.start();
 
 		// OpenCL execution code replaces this call to render()
-		samplesRendered = render(&scene, width, height, samples, testMode);								// raytrace scene
+		if (farm.numWorkers > 0)
+		{
+			samplesRendered = farm.render(farmJobs, &rayCounters);
+			if (samplesRendered < 0) return 1;
+		}
+		else
+		{
+			samplesRendered = renderScene(&scene, width, height, samples, testMode, pool, scheduler, &framePart, packetSize, wavefront, &rayCounters, heatMapFilename != NULL ? &heatMap : NULL);	// raytrace scene
+		}
 
 		timer.end();																					// record end time
+
+		// the whole run is rendering, there is nothing to read back
+		BenchmarkRun run = { timer.getMillisecondsExact(), timer.getMillisecondsExact(), BENCHMARK_NOT_MEASURED };
+		benchmark.runs.push_back(run);
+
 		if (i > 0)
 		{
 			totalTime += timer.getMilliseconds();														// record total time taken
@@ -367,6 +1123,86 @@ int main(int argc, char* argv[])
 		printf("first run time: %dms, subsequent average time taken (%d run(s)): N/A\n", firstTime, times - 1);
 	}
 
-	// output BMP file
-	write_bmp(outputFilename, buffer, width, height, width);
+	// primary rays traced per second (over the subsequent runs if there were any, they don't include any start up costs)
+	// (from the exact run times, a small frame or part can take less than a millisecond)
+	double rateTime = 0.0;
+	for (size_t i = (benchmark.runs.size() > 1) ? 1 : 0; i < benchmark.runs.size(); ++i)
+	{
+		rateTime += benchmark.runs[i].totalMs;
+	}
+	if (benchmark.runs.size() > 1) rateTime /= benchmark.runs.size() - 1;
+	char modeDescription[64];
+	if (wavefront) sprintf(modeDescription, "wavefront, %s", packetSize > 1 ? "intersected in packets" : "single rays");
+	else if (packetSize > 1) sprintf(modeDescription, "%dx%d packets", packetSize, packetSize);
+	else sprintf(modeDescription, "single rays");
+	printf("primary rays per second: %.2fM (%s)\n", rateTime > 0.0 ? samplesRendered / (rateTime * 1000.0) : 0.0, modeDescription);
+
+	// rays and tests of the last run, and the rate they were traced at
+	if (countRays && !benchmark.runs.empty()) outputRayCounters(&rayCounters, benchmark.runs.back().totalMs);
+
+	// per worker busy/idle time and shadow ray counts of the last run (shows how long the tail of the frame is)
+	if (workerStats && farm.numWorkers > 0) outputFarmStats(&farm);
+	else if (workerStats) outputWorkerStats(&scheduler);
+
+	// where the last run's work went, by pixel and by tile
+	if (heatMapFilename != NULL && !writeHeatMap(&heatMap, &framePart, heatMapFilename))
+	{
+		return 1;
+	}
+
+	// output BMP file (or the part's image and where it goes, for MergeParts)
+	timer.start();
+	if (wholeFrame)
+	{
+		write_bmp(outputFilename, frame.pixels, width, height, frame.stride);
+	}
+	else if (!writeFramePart(&framePart, &frame, outputFilename))
+	{
+		return 1;
+	}
+	timer.end();
+	benchmark.writeMs = timer.getMillisecondsExact();
+
+	// compare the frame with the reference straight from memory, the run fails if it's too far off
+	if (referenceFilename != NULL)
+	{
+		ImageDifference difference;
+		if (!compareWithReference(frame.pixels, width, height, frame.stride, referenceFilename, diffFilename, &difference))
+		{
+			return 1;
+		}
+
+		benchmark.mae = difference.mae;
+		benchmark.maxDiff = difference.maxDiff;
+		benchmark.passed = difference.mae <= compareThreshold;
+		printf("compared with %s: MAE %.4f (%.6f normalised), PSNR %.2f dB, max difference %d, %u pixels differ: %s\n", referenceFilename,
+			difference.mae, difference.mae / 255.0, difference.psnr, difference.maxDiff, difference.pixelsDifferent, benchmark.passed ? "passed" : "FAILED");
+	}
+
+	// one machine readable line with what was rendered and every timing
+	if (benchmarkFilename != NULL)
+	{
+		char deviceDescription[64];
+		if (farm.numWorkers > 0) sprintf(deviceDescription, "CPU, %u processes x %u thread%s", farm.numWorkers, threadsPerWorker, threadsPerWorker == 1 ? "" : "s");
+		else sprintf(deviceDescription, "CPU, %u thread%s", pool.size(), pool.size() == 1 ? "" : "s");
+
+		benchmark.program = baseName(argv[0]);
+		benchmark.scene = inputFilename;
+		benchmark.width = width;
+		benchmark.height = height;
+		benchmark.samples = samples;
+		benchmark.blockSize = blockSize;
+		benchmark.device = deviceDescription;
+		benchmark.mode = modeDescription;
+		benchmark.counters = countRays ? &rayCounters : NULL;
+		if (!writeBenchmark(&benchmark, benchmarkFilename))
+		{
+			return 1;
+		}
+	}
+
+	releaseFrameBuffer(&frameBuffer);
+
+	// a failed comparison fails the run (after everything has been written)
+	return benchmark.passed ? 0 : 1;
 }
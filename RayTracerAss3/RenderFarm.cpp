@@ -0,0 +1,337 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include "RenderFarm.h"
+#include "TileScheduler.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+// a finished job, as its worker reports it
+typedef struct FarmResult
+{
+	FarmJob job;
+	unsigned int samples;				// samples rendered
+	double ms;							// time the worker took
+	RayCounters counters;				// rays the job traced
+} FarmResult;
+
+
+#ifndef _WIN32
+// write all of data to a pipe, returns false if the other end has gone
+static bool writeFully(int fd, const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	while (size > 0)
+	{
+		ssize_t written = write(fd, bytes, size);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return false;
+		bytes += written;
+		size -= written;
+	}
+	return true;
+}
+
+// read all of data from a pipe, returns false if the other end has gone
+static bool readFully(int fd, void* data, size_t size)
+{
+	char* bytes = (char*)data;
+	while (size > 0)
+	{
+		ssize_t got = read(fd, bytes, size);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) return false;
+		bytes += got;
+		size -= got;
+	}
+	return true;
+}
+#endif
+
+
+// fork numWorkers worker processes that render the jobs they are handed with renderJob, and call workerExit as they exit
+RenderFarm::RenderFarm(unsigned int numWorkers, JobFunction renderJob, WorkerExitFunction workerExit)
+	: numWorkers(0), renderJob(renderJob), workerExit(workerExit)
+{
+#ifdef _WIN32
+	if (numWorkers > 0) printf("Worker processes are forked, which Windows can't do\n");
+#else
+	if (numWorkers > 0)
+	{
+		// writing a job to a worker that has died shouldn't kill the coordinator
+		signal(SIGPIPE, SIG_IGN);
+
+		// anything still buffered would be printed again by every worker
+		fflush(stdout);
+		fflush(stderr);
+	}
+
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		int jobFds[2], resultFds[2];
+		if (pipe(jobFds) != 0)
+		{
+			printf("Couldn't make the pipes for worker process %u: %s\n", i, strerror(errno));
+			break;
+		}
+		if (pipe(resultFds) != 0)
+		{
+			printf("Couldn't make the pipes for worker process %u: %s\n", i, strerror(errno));
+			close(jobFds[0]);
+			close(jobFds[1]);
+			break;
+		}
+
+		int pid = fork();
+		if (pid < 0)
+		{
+			printf("Couldn't fork worker process %u: %s\n", i, strerror(errno));
+			close(jobFds[0]);
+			close(jobFds[1]);
+			close(resultFds[0]);
+			close(resultFds[1]);
+			break;
+		}
+
+		if (pid == 0)
+		{
+			// the worker only keeps its own ends of its own pipes
+			for (size_t w = 0; w < workers.size(); ++w)
+			{
+				close(workers[w].jobPipe);
+				close(workers[w].resultPipe);
+			}
+			close(jobFds[1]);
+			close(resultFds[0]);
+
+			workerLoop(jobFds[0], resultFds[1]);
+			close(jobFds[0]);
+			close(resultFds[1]);
+
+			// the worker's own threads are stopped and joined before it goes
+			if (workerExit) workerExit();
+
+			// leave without running the coordinator's destructors or flushing its buffers
+			fflush(stdout);
+			_exit(0);
+		}
+
+		close(jobFds[0]);
+		close(resultFds[1]);
+
+		Worker worker = { pid, jobFds[1], resultFds[0], true };
+		workers.push_back(worker);
+	}
+
+	this->numWorkers = (unsigned int)workers.size();
+#endif
+
+	stats = new FarmWorkerStats[this->numWorkers];
+	for (unsigned int i = 0; i < this->numWorkers; ++i)
+	{
+		stats[i] = FarmWorkerStats();
+		stats[i].pid = workers[i].pid;
+	}
+}
+
+
+// tell the workers to exit and wait for them
+RenderFarm::~RenderFarm()
+{
+#ifndef _WIN32
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		FarmJob exitJob = { -1, 0, 0, 0, 0 };
+		if (workers[i].alive) writeFully(workers[i].jobPipe, &exitJob, sizeof(exitJob));
+		close(workers[i].jobPipe);
+	}
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		waitpid(workers[i].pid, NULL, 0);
+		close(workers[i].resultPipe);
+	}
+#endif
+
+	delete[] stats;
+}
+
+
+// a worker process renders each job it is handed and sends back the result, until it is told to exit
+void RenderFarm::workerLoop(int jobPipe, int resultPipe)
+{
+#ifndef _WIN32
+	FarmJob job;
+	while (readFully(jobPipe, &job, sizeof(job)) && job.tile >= 0)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		FarmResult result;
+		result.job = job;
+		resetRayCounters(&result.counters);
+		result.samples = renderJob(job, &result.counters);
+		result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (!writeFully(resultPipe, &result, sizeof(result))) break;
+	}
+#endif
+}
+
+
+// render every job on the workers and wait for them all
+int RenderFarm::render(const std::vector<FarmJob>& jobs, RayCounters* counters)
+{
+	resetRayCounters(counters);
+
+#ifdef _WIN32
+	return -1;
+#else
+	std::deque<FarmJob> queue(jobs.begin(), jobs.end());
+	size_t remaining = jobs.size();				// jobs (including split off halves) not finished yet
+	unsigned int samplesRendered = 0;
+
+	// the job each worker is rendering (if it is busy)
+	std::vector<FarmJob> current(workers.size());
+	std::vector<bool> busy(workers.size(), false);
+
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		int pid = stats[i].pid;
+		stats[i] = FarmWorkerStats();
+		stats[i].pid = pid;
+	}
+
+	std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
+	// a worker that has gone hands its job back to the queue for the others
+	auto workerDied = [&](unsigned int w)
+	{
+		printf("worker process %d has died, its work goes to the other workers\n", workers[w].pid);
+		workers[w].alive = false;
+		if (busy[w])
+		{
+			queue.push_front(current[w]);
+			busy[w] = false;
+		}
+	};
+
+	// hand an idle worker the next job
+	auto dispatch = [&](unsigned int w)
+	{
+		if (queue.empty() || !workers[w].alive) return;
+
+		FarmJob job = queue.front();
+		queue.pop_front();
+
+		// once fewer jobs are left than there are workers, cut them in half so the last ones finish close together
+		unsigned int alive = 0;
+		for (size_t i = 0; i < workers.size(); ++i) alive += workers[i].alive ? 1 : 0;
+		if (queue.size() + 1 < alive && job.y1 - job.y0 >= 2 * MIN_SPLIT_ROWS)
+		{
+			FarmJob rest = job;
+			rest.y0 = job.y0 + (job.y1 - job.y0) / 2;
+			job.y1 = rest.y0;
+			queue.push_front(rest);
+			remaining++;
+			stats[w].jobsSplit++;
+		}
+
+		current[w] = job;
+		busy[w] = true;
+		if (!writeFully(workers[w].jobPipe, &job, sizeof(job))) workerDied(w);
+	};
+
+	for (unsigned int w = 0; w < numWorkers; ++w)
+	{
+		dispatch(w);
+	}
+
+	std::vector<pollfd> fds;
+	std::vector<unsigned int> fdWorkers;
+	while (remaining > 0)
+	{
+		fds.clear();
+		fdWorkers.clear();
+		for (unsigned int w = 0; w < numWorkers; ++w)
+		{
+			if (!busy[w]) continue;
+			pollfd fd = { workers[w].resultPipe, POLLIN, 0 };
+			fds.push_back(fd);
+			fdWorkers.push_back(w);
+		}
+
+		// nobody busy with jobs left means every worker has died (or the last busy one just did and its job is queued)
+		if (fds.empty())
+		{
+			bool anyAlive = false;
+			for (unsigned int w = 0; w < numWorkers; ++w)
+			{
+				anyAlive = anyAlive || workers[w].alive;
+				dispatch(w);
+			}
+			if (!anyAlive)
+			{
+				printf("Every worker process has died, %u jobs weren't rendered\n", (unsigned int)remaining);
+				return -1;
+			}
+			continue;
+		}
+
+		if (poll(fds.data(), fds.size(), -1) < 0)
+		{
+			if (errno == EINTR) continue;
+			printf("Couldn't wait for the worker processes: %s\n", strerror(errno));
+			return -1;
+		}
+
+		for (size_t i = 0; i < fds.size(); ++i)
+		{
+			if (fds[i].revents == 0) continue;
+
+			unsigned int w = fdWorkers[i];
+			FarmResult result;
+			if (!readFully(workers[w].resultPipe, &result, sizeof(result)))
+			{
+				workerDied(w);
+				continue;
+			}
+
+			busy[w] = false;
+			remaining--;
+			samplesRendered += result.samples;
+			addRayCounters(counters, &result.counters);
+			stats[w].jobsRendered++;
+			stats[w].busyMs += result.ms;
+
+			dispatch(w);
+		}
+
+		// a job handed back by a worker that died goes to whoever is idle
+		for (unsigned int w = 0; w < numWorkers && !queue.empty(); ++w)
+		{
+			if (!busy[w]) dispatch(w);
+		}
+	}
+
+	// whatever part of the frame a worker didn't spend rendering it spent idle
+	double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		stats[i].idleMs = std::max(frameMs - stats[i].busyMs, 0.0);
+	}
+
+	return (int)samplesRendered;
+#endif
+}
@@ -0,0 +1,73 @@
+#ifndef __RENDER_FARM_H
+#define __RENDER_FARM_H
+
+#include <vector>
+#include <functional>
+#include "RayCounters.h"
+
+// a rectangle of pixels [x0, x1) x [y0, y1) of the frame (from the bottom left), all in frame tile number tile
+typedef struct FarmJob
+{
+	int tile;
+	int x0, y0, x1, y1;
+} FarmJob;
+
+// what one worker process did during a frame
+typedef struct FarmWorkerStats
+{
+	int pid;							// process id of the worker
+	unsigned int jobsRendered;			// tiles (or bands of rows of tiles) finished
+	unsigned int jobsSplit;				// times a tile was cut in half by rows before being handed to the worker
+	double busyMs;						// time spent rendering (as the worker measured it)
+	double idleMs;						// rest of the frame (waiting for the coordinator and for the last job)
+} FarmWorkerStats;
+
+// local render farm: renders the tiles of a frame on worker processes forked from this one, for standing in for
+// rendering across machines on one box (POSIX only, there are no workers elsewhere)
+// the workers are forked once the scene has been loaded and built, so they share it (copy on write, and they only read it)
+// rather than each loading it again, and render into a frame buffer shared with the coordinator (see createSharedFrameBuffer)
+// jobs go to each worker and the results come back over a pair of pipes per worker, one job at a time: a worker is handed
+// its next job when it finishes one, so a slow worker takes fewer, and once fewer jobs are left than there are workers each
+// one is cut in half by rows as it is handed out, so the end of the frame isn't left waiting on a slow worker's big tile
+// a worker that dies has its job handed to another one
+class RenderFarm
+{
+public:
+	// renders a job in a worker process, adding its rays to counters and returning the samples rendered
+	typedef std::function<unsigned int(const FarmJob& job, RayCounters* counters)> JobFunction;
+
+	// called in a worker process once it has been told to exit, to free what its jobs set up (the worker's threads, say)
+	// before the process ends without running any destructors
+	typedef std::function<void()> WorkerExitFunction;
+
+	// fork numWorkers worker processes that render the jobs they are handed with renderJob, and call workerExit (if there is one) as they exit
+	// prints the reason and starts no workers (numWorkers is 0) if they can't be started
+	RenderFarm(unsigned int numWorkers, JobFunction renderJob, WorkerExitFunction workerExit = WorkerExitFunction());
+
+	// tell the workers to exit and wait for them
+	~RenderFarm();
+
+	// render every job on the workers and wait for them all (and for the frame buffer to be written)
+	// the rays of the frame are counted into counters, returns the samples rendered or -1 if every worker has died
+	int render(const std::vector<FarmJob>& jobs, RayCounters* counters);
+
+	unsigned int numWorkers;
+	FarmWorkerStats* stats;
+
+private:
+	typedef struct Worker
+	{
+		int pid;
+		int jobPipe;					// coordinator writes jobs (tile -1 to exit)
+		int resultPipe;					// worker writes results
+		bool alive;
+	} Worker;
+
+	void workerLoop(int jobPipe, int resultPipe);
+
+	JobFunction renderJob;
+	WorkerExitFunction workerExit;
+	std::vector<Worker> workers;
+};
+
+#endif // __RENDER_FARM_H
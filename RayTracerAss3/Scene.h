@@ -30,6 +30,34 @@ typedef struct Scene
 	Light* lightContainer;
 	Sphere* sphereContainer;
 	Box* boxContainer;
+
+	// bounding volume hierarchy over the spheres and boxes (see BVH.h)
+	// primitives are numbered spheres first, then boxes (key numSpheres + i is box i)
+	unsigned int numBvhNodes;
+	BVHNode* bvhNodeContainer;
+	unsigned int* bvhPrimitiveContainer;
+
+	// sphere centres and radii squared, and box bounds, as structures of arrays indexed by BVH primitive slot (see PrimitiveSoA.h)
+	// only used by the AVX2 tests, when useSphereSoA / useBoxSoA is set
+	float* sphereX;
+	float* sphereY;
+	float* sphereZ;
+	float* sphereRadiusSq;
+	float* boxMinX;
+	float* boxMinY;
+	float* boxMinZ;
+	float* boxMaxX;
+	float* boxMaxY;
+	float* boxMaxZ;
+	bool useSphereSoA;
+	bool useBoxSoA;
+
+	// tree of bounding boxes over the lights (see LightTree.h)
+	unsigned int numLightNodes;
+	LightNode* lightNodeContainer;
+
+	// most that all the lights applyLighting() skips at one intersection may add up to in a colour channel (0 only skips lights behind the surface)
+	float lightCullEpsilon;
 } Scene;
 
 bool init(const char* inputName, Scene& scene);
@@ -0,0 +1,25 @@
+#ifndef __SIMD_H
+#define __SIMD_H
+
+#include <immintrin.h>
+
+// msvc allows AVX2 intrinsics in any function, gcc and clang need the functions using them marking
+// (only call these functions once cpuHasAVX2() has said the CPU can run them)
+#if defined(__GNUC__)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define AVX2_FUNCTION
+#endif
+
+// std::fmin and std::fmax for 8 lanes (NaN only if both are NaN, unlike _mm256_min_ps and _mm256_max_ps)
+AVX2_FUNCTION inline __m256 fminLanes(__m256 a, __m256 b)
+{
+	return _mm256_blendv_ps(_mm256_min_ps(a, b), a, _mm256_cmp_ps(b, b, _CMP_UNORD_Q));
+}
+
+AVX2_FUNCTION inline __m256 fmaxLanes(__m256 a, __m256 b)
+{
+	return _mm256_blendv_ps(_mm256_max_ps(a, b), a, _mm256_cmp_ps(b, b, _CMP_UNORD_Q));
+}
+
+#endif // __SIMD_H
@@ -0,0 +1,73 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+	: numWorkers(numThreads > 0 ? numThreads : 1), job(NULL), generation(0), running(0), stopping(false)
+{
+	// worker 0 is whoever calls run(), the rest get their own thread
+	for (unsigned int i = 1; i < numWorkers; ++i)
+	{
+		threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+	}
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
+	}
+}
+
+
+// run job(workerIndex) once on every worker and wait for all of them to return
+void ThreadPool::run(const std::function<void(unsigned int)>& newJob)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &newJob;
+		running = numWorkers - 1;
+		++generation;
+	}
+	jobReady.notify_all();
+
+	// the calling thread does its share as well
+	newJob(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	jobDone.wait(lock, [this] { return running == 0; });
+	job = NULL;
+}
+
+
+// wait for jobs and run each one until the pool is destroyed
+void ThreadPool::workerLoop(unsigned int workerIndex)
+{
+	unsigned int lastGeneration = 0;
+
+	for (;;)
+	{
+		const std::function<void(unsigned int)>* currentJob;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobReady.wait(lock, [&] { return stopping || generation != lastGeneration; });
+			if (stopping) return;
+
+			lastGeneration = generation;
+			currentJob = job;
+		}
+
+		(*currentJob)(workerIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--running == 0) jobDone.notify_one();
+		}
+	}
+}
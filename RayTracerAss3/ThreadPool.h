@@ -0,0 +1,39 @@
+#ifndef __THREAD_POOL_H
+#define __THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// fixed set of worker threads, created once and reused for every frame
+// the calling thread takes part in each job as worker 0, so a pool of size 1 starts no extra threads
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned int numThreads);
+	~ThreadPool();
+
+	// number of workers taking part in each job (including the calling thread)
+	unsigned int size() const { return numWorkers; }
+
+	// run job(workerIndex) once on every worker and wait for all of them to return
+	void run(const std::function<void(unsigned int)>& job);
+
+private:
+	void workerLoop(unsigned int workerIndex);
+
+	unsigned int numWorkers;
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable jobReady;						// signalled when a new job is posted (or the pool is stopping)
+	std::condition_variable jobDone;						// signalled when the last worker finishes a job
+	const std::function<void(unsigned int)>* job;			// current job (only valid while run() is waiting)
+	unsigned int generation;								// incremented for every job so workers know when a new one arrives
+	unsigned int running;									// workers still busy with the current job
+	bool stopping;
+};
+
+#endif // __THREAD_POOL_H
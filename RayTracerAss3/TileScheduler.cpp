@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <vector>
+#include "TileScheduler.h"
+
+TileScheduler::TileScheduler(unsigned int numWorkers)
+	: numWorkers(numWorkers), pending(0), searching(0), workPosted(0)
+{
+	stats = new WorkerStats[numWorkers];
+	queues = new WorkerQueue[numWorkers];
+}
+
+
+TileScheduler::~TileScheduler()
+{
+	delete[] stats;
+	delete[] queues;
+}
+
+
+// cut the part of the image being rendered into its tiles, deal them out to the workers in contiguous runs and clear the stats
+void TileScheduler::reset(const int width, const int height, const FramePart* part)
+{
+	// the part's tiles in scanline order (edge tiles are clipped to the part, and to the even number of rows
+	// and columns that are rendered, relative to the centre of the image)
+	std::vector<Tile> tiles;
+	for (int block = part->firstTile; block <= part->lastTile; ++block)
+	{
+		Tile tile;
+		if (!framePartTile(part, block, &tile.x0, &tile.y0, &tile.x1, &tile.y1)) continue;
+
+		tile.x0 -= width / 2;
+		tile.y0 -= height / 2;
+		tile.x1 = std::min(tile.x1 - width / 2, width / 2);
+		tile.y1 = std::min(tile.y1 - height / 2, height / 2);
+		if (tile.x0 < tile.x1 && tile.y0 < tile.y1) tiles.push_back(tile);
+	}
+	const int totalBlocks = (int)tiles.size();
+
+	// contiguous runs keep neighbouring (similarly expensive) tiles on the same worker, stealing evens out the rest
+	for (unsigned int worker = 0; worker < numWorkers; ++worker)
+	{
+		int first = (int)((long long)totalBlocks * worker / numWorkers);
+		int last = (int)((long long)totalBlocks * (worker + 1) / numWorkers);
+
+		std::lock_guard<std::mutex> lock(queues[worker].lock);
+		queues[worker].tiles.clear();
+
+		// pushed in reverse, so the owner (taking from the back) works through its run in scanline order
+		for (int block = last - 1; block >= first; --block)
+		{
+			queues[worker].tiles.push_back(tiles[block]);
+		}
+
+		stats[worker] = WorkerStats();
+	}
+
+	pending = totalBlocks;
+	searching = 0;
+}
+
+
+// get the next tile for a worker, stealing if its own deque is empty
+// returns false once every tile of the frame has been finished
+bool TileScheduler::next(unsigned int worker, Tile* tile)
+{
+	// newest tile from our own deque
+	{
+		std::lock_guard<std::mutex> lock(queues[worker].lock);
+		if (!queues[worker].tiles.empty())
+		{
+			*tile = queues[worker].tiles.back();
+			queues[worker].tiles.pop_back();
+			return true;
+		}
+	}
+
+	// out of work, let the busy workers know so they split what they are rendering
+	searching++;
+
+	while (pending.load() > 0)
+	{
+		// anything posted after this is seen by the search below or wakes the wait after it
+		unsigned int posted;
+		{
+			std::lock_guard<std::mutex> lock(idleLock);
+			posted = workPosted;
+		}
+
+		// oldest tile from the other deques, starting with our neighbour so thieves spread out
+		for (unsigned int i = 1; i < numWorkers; ++i)
+		{
+			WorkerQueue& victim = queues[(worker + i) % numWorkers];
+
+			std::lock_guard<std::mutex> lock(victim.lock);
+			if (!victim.tiles.empty())
+			{
+				*tile = victim.tiles.front();
+				victim.tiles.pop_front();
+				stats[worker].tilesStolen++;
+				searching--;
+				return true;
+			}
+		}
+
+		// everything left is being rendered, sleep until a split or the end of the frame
+		std::unique_lock<std::mutex> lock(idleLock);
+		workReady.wait(lock, [&] { return workPosted != posted || pending.load() == 0; });
+	}
+
+	searching--;
+	return false;
+}
+
+
+// called between rows of a tile, with nextRow the first row not rendered yet
+// if another worker is idle and this worker has nothing else queued, the top half of the remaining rows
+// [mid, y1) is handed back to the worker's deque for stealing and the tile is shrunk to the bottom half [nextRow, mid),
+// which this worker carries on walking upwards
+bool TileScheduler::trySplit(unsigned int worker, Tile* tile, int nextRow)
+{
+	// cheap test first, this is checked for every row
+	if (searching.load(std::memory_order_relaxed) == 0 || tile->y1 - nextRow < 2 * MIN_SPLIT_ROWS) return false;
+
+	{
+		std::lock_guard<std::mutex> lock(queues[worker].lock);
+
+		// queued tiles can be stolen as they are, only split when there is nothing else to take
+		if (!queues[worker].tiles.empty()) return false;
+
+		Tile remainder = *tile;
+		remainder.y0 = nextRow + (tile->y1 - nextRow) / 2;
+		tile->y1 = remainder.y0;
+
+		pending++;
+		stats[worker].tilesSplit++;
+		queues[worker].tiles.push_back(remainder);
+	}
+
+	// wake an idle worker to steal it
+	{
+		std::lock_guard<std::mutex> lock(idleLock);
+		workPosted++;
+	}
+	workReady.notify_one();
+
+	return true;
+}
+
+
+// mark a tile returned by next() as finished
+void TileScheduler::finished(unsigned int worker)
+{
+	stats[worker].tilesRendered++;
+
+	// the last tile of the frame lets every idle worker go
+	if (--pending == 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(idleLock);
+			workPosted++;
+		}
+		workReady.notify_all();
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef __TILE_SCHEDULER_H
+#define __TILE_SCHEDULER_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "FramePart.h"
+
+// rows a split tile keeps at the least (a tile is only split while it has twice this many rows left)
+#define MIN_SPLIT_ROWS 2
+
+// a rectangle of pixels [x0, x1) x [y0, y1), in coordinates relative to the centre of the image
+typedef struct Tile
+{
+	int x0, y0;
+	int x1, y1;
+} Tile;
+
+// what one worker did during a frame
+typedef struct WorkerStats
+{
+	unsigned int tilesRendered;			// tiles (or parts of tiles) finished
+	unsigned int tilesStolen;			// tiles taken from another worker's deque
+	unsigned int tilesSplit;			// times the remainder of a tile was handed back for stealing
+	double busyMs;						// time spent rendering
+	double idleMs;						// rest of the frame (looking for work and waiting for the last tile)
+	unsigned long long shadowRays;		// shadow rays cast
+	unsigned long long shadowCacheHits;	// shadow rays blocked by the light's remembered occluder
+} WorkerStats;
+
+// work-stealing tile queue
+// every worker owns a deque, takes its own tiles from the back and steals from the front of the others when it runs dry
+class TileScheduler
+{
+public:
+	TileScheduler(unsigned int numWorkers);
+	~TileScheduler();
+
+	// cut the part of the image being rendered into its tiles, deal them out to the workers in contiguous runs and clear the stats
+	void reset(const int width, const int height, const FramePart* part);
+
+	// get the next tile for a worker, stealing if its own deque is empty
+	// returns false once every tile of the frame has been finished
+	bool next(unsigned int worker, Tile* tile);
+
+	// called between rows of a tile, with nextRow the first row not rendered yet
+	// if another worker is idle and this worker has nothing else queued, the top half of the remaining rows
+	// [mid, y1) is handed back to the worker's deque for stealing and the tile is shrunk to the bottom half [nextRow, mid),
+	// which this worker carries on walking upwards
+	bool trySplit(unsigned int worker, Tile* tile, int nextRow);
+
+	// mark a tile returned by next() as finished
+	void finished(unsigned int worker);
+
+	unsigned int numWorkers;
+	WorkerStats* stats;
+
+private:
+	typedef struct WorkerQueue
+	{
+		std::mutex lock;
+		std::deque<Tile> tiles;
+	} WorkerQueue;
+
+	WorkerQueue* queues;
+	std::atomic<int> pending;			// tiles not finished yet (including split off parts)
+	std::atomic<int> searching;			// workers currently trying to steal
+
+	// idle workers sleep on workReady until a split hands back work or the frame is finished
+	std::mutex idleLock;
+	std::condition_variable workReady;
+	unsigned int workPosted;			// bumped (under idleLock) every time they should look again
+};
+
+#endif // __TILE_SCHEDULER_H
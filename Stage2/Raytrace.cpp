@@ -296,6 +296,9 @@ int main(int argc, char* argv[])
 	int times = 1;
 	bool testMode = false;
 
+	// directory compiled kernel binaries are cached in (NULL disables the cache)
+	const char* programCacheDir = "ProgramCache";
+
 	// default input / output filenames
 	const char* inputFilename = "Scenes/5000spheres.txt";
 
@@ -330,6 +333,14 @@ int main(int argc, char* argv[])
 		{
 			testMode = true;
 		}
+		else if (strcmp(argv[i], "-programCache") == 0)
+		{
+			programCacheDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "-noProgramCache") == 0)
+		{
+			programCacheDir = NULL;
+		}
 		else
 		{
 			fprintf(stderr, "unknown argument: %s\n", argv[i]);
@@ -396,6 +407,10 @@ int main(int argc, char* argv[])
 
 		// get the device
 		err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
+		if (err == CL_DEVICE_NOT_FOUND) {
+			// no GPU, fall back to whatever the platform has (eg. a CPU runtime such as PoCL)
+			err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 1, &device, NULL);
+		}
 		if (err != CL_SUCCESS) {
 			printf("Couldn't find any devices\n");
 			exit(1);
@@ -415,15 +430,12 @@ int main(int argc, char* argv[])
 			exit(1);
 		}
 
-		// use load source to load the main cl file
-		program = clLoadSource(context, "Stage2/Render.cl", &err);
-		if (err != CL_SUCCESS) {
+		// load the main cl file and build it (or reuse a cached binary of it) and check for any errors
+		program = clLoadProgramCached(context, device, "Stage2/Render.cl", NULL, programCacheDir, &err);
+		if (program == NULL) {
 			printf("Couldn't load/create the program\n");
 			exit(1);
 		}
-
-		// build the program and check for any errors
-		err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
 		if (err != CL_SUCCESS) {
 			char* program_log;
 			size_t log_size;
@@ -4,9 +4,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <string>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 #include "LoadCL.h"
 
-cl_program clLoadSource(cl_context context, char* filename, cl_int* err)
+cl_program clLoadSource(cl_context context, const char* filename, cl_int* err)
 {
 	cl_program program;
 	FILE *program_handle;
@@ -31,3 +38,166 @@ cl_program clLoadSource(cl_context context, char* filename, cl_int* err)
 
 	return program;
 }
+
+
+// read a whole file into memory, returns false if it couldn't be opened
+static bool readFile(const char* filename, std::string& contents)
+{
+	FILE* handle = fopen(filename, "rb");
+	if (handle == NULL) return false;
+
+	fseek(handle, 0, SEEK_END);
+	contents.resize(ftell(handle));
+	rewind(handle);
+	if (!contents.empty()) fread(&contents[0], sizeof(char), contents.size(), handle);
+	fclose(handle);
+
+	return true;
+}
+
+
+// expand every #include "file" line in place so the whole kernel is a single source string
+// includes are resolved relative to the working directory, the same way the OpenCL compiler resolves them
+static bool expandSource(const char* filename, std::string& expanded, int depth)
+{
+	std::string source;
+	if (depth > 32 || !readFile(filename, source))
+	{
+		printf("Couldn't find the program file %s\n", filename);
+		return false;
+	}
+
+	size_t lineStart = 0;
+	while (lineStart < source.size())
+	{
+		size_t lineEnd = source.find('\n', lineStart);
+		lineEnd = (lineEnd == std::string::npos) ? source.size() : lineEnd + 1;
+
+		// skip leading whitespace to see if this is an include directive
+		size_t c = source.find_first_not_of(" \t", lineStart);
+		if (c < lineEnd && source.compare(c, 8, "#include") == 0)
+		{
+			size_t open = source.find('"', c);
+			size_t close = (open < lineEnd) ? source.find('"', open + 1) : std::string::npos;
+			if (close < lineEnd)
+			{
+				std::string includeName = source.substr(open + 1, close - open - 1);
+				if (!expandSource(includeName.c_str(), expanded, depth + 1)) return false;
+				expanded += '\n';
+				lineStart = lineEnd;
+				continue;
+			}
+		}
+
+		expanded.append(source, lineStart, lineEnd - lineStart);
+		lineStart = lineEnd;
+	}
+
+	return true;
+}
+
+
+// 64-bit FNV-1a hash, continuing on from a previous hash value
+static unsigned long long hashBytes(unsigned long long hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+// hash a device info string (name, vendor, driver version...) into the cache key
+static unsigned long long hashDeviceInfo(unsigned long long hash, cl_device_id device, cl_device_info param)
+{
+	char value[1024];
+	size_t size = 0;
+	if (clGetDeviceInfo(device, param, sizeof(value), value, &size) != CL_SUCCESS) size = 0;
+
+	return hashBytes(hash, value, size);
+}
+
+
+// write the device binary of a built program to the cache file
+// written to a temporary name first so a concurrent reader never sees a partial binary
+static void saveBinary(cl_program program, const char* cacheDir, const char* cacheFilename)
+{
+	size_t binarySize = 0;
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binarySize), &binarySize, NULL) != CL_SUCCESS || binarySize == 0) return;
+
+	unsigned char* binary = (unsigned char*)malloc(binarySize);
+	if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) == CL_SUCCESS)
+	{
+#ifdef _WIN32
+		_mkdir(cacheDir);
+#else
+		mkdir(cacheDir, 0755);
+#endif
+		std::string tempFilename = std::string(cacheFilename) + ".tmp";
+		FILE* handle = fopen(tempFilename.c_str(), "wb");
+		if (handle != NULL)
+		{
+			bool written = fwrite(binary, 1, binarySize, handle) == binarySize;
+			written = (fclose(handle) == 0) && written;
+
+			remove(cacheFilename);
+			if (!written || rename(tempFilename.c_str(), cacheFilename) != 0) remove(tempFilename.c_str());
+		}
+	}
+	free(binary);
+}
+
+
+cl_program clLoadProgramCached(cl_context context, cl_device_id device, const char* filename, const char* options, const char* cacheDir, cl_int* err)
+{
+	std::string source;
+	if (!expandSource(filename, source, 0))
+	{
+		*err = CL_INVALID_VALUE;
+		return NULL;
+	}
+
+	char cacheFilename[1024];
+	if (cacheDir != NULL)
+	{
+		// cache key covers everything that can change the compiled binary
+		unsigned long long hash = 14695981039346656037ULL;
+		hash = hashBytes(hash, source.c_str(), source.size() + 1);
+		hash = hashBytes(hash, options ? options : "", options ? strlen(options) + 1 : 1);
+		hash = hashDeviceInfo(hash, device, CL_DEVICE_NAME);
+		hash = hashDeviceInfo(hash, device, CL_DEVICE_VENDOR);
+		hash = hashDeviceInfo(hash, device, CL_DEVICE_VERSION);
+		hash = hashDeviceInfo(hash, device, CL_DRIVER_VERSION);
+
+		snprintf(cacheFilename, sizeof(cacheFilename), "%s/%016llx.bin", cacheDir, hash);
+
+		// try the cached binary first, any failure (missing, truncated, rejected by the driver) falls back to a source build
+		std::string binary;
+		if (readFile(cacheFilename, binary) && !binary.empty())
+		{
+			const unsigned char* binaryPtr = (const unsigned char*)binary.data();
+			size_t binarySize = binary.size();
+			cl_int binaryStatus;
+			cl_program program = clCreateProgramWithBinary(context, 1, &device, &binarySize, &binaryPtr, &binaryStatus, err);
+			if (*err == CL_SUCCESS && binaryStatus == CL_SUCCESS)
+			{
+				*err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+				if (*err == CL_SUCCESS) return program;
+			}
+			if (program != NULL) clReleaseProgram(program);
+		}
+	}
+
+	const char* sourcePtr = source.c_str();
+	size_t sourceSize = source.size();
+	cl_program program = clCreateProgramWithSource(context, 1, &sourcePtr, &sourceSize, err);
+	if (*err != CL_SUCCESS) return NULL;
+
+	*err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+	if (*err == CL_SUCCESS && cacheDir != NULL) saveBinary(program, cacheDir, cacheFilename);
+
+	return program;
+}
@@ -3,6 +3,12 @@
 
 #include <CL/cl.h>
 
-cl_program clLoadSource(cl_context context, char* filename, cl_int* err);
+cl_program clLoadSource(cl_context context, const char* filename, cl_int* err);
 
-#endif
\ No newline at end of file
+// load filename (with its #include chain expanded) and build it for device
+// the built binary is kept in cacheDir, keyed by a hash of the expanded source, the build options and the device/driver,
+// and later loads with the same key skip the source compile (pass a NULL cacheDir to always compile from source)
+// returns NULL if the program couldn't be created, otherwise *err holds the build result (check the build log on failure)
+cl_program clLoadProgramCached(cl_context context, cl_device_id device, const char* filename, const char* options, const char* cacheDir, cl_int* err);
+
+#endif
@@ -0,0 +1,241 @@
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include "BVH.h"
+
+// axis aligned bounding box used while building
+typedef struct Bounds
+{
+	float lo[3];
+	float hi[3];
+} Bounds;
+
+
+// an empty box that any grow() replaces
+static Bounds emptyBounds()
+{
+	Bounds b = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+	return b;
+}
+
+
+// grow a box to contain another one
+static void grow(Bounds* b, const Bounds& other)
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		b->lo[axis] = std::min(b->lo[axis], other.lo[axis]);
+		b->hi[axis] = std::max(b->hi[axis], other.hi[axis]);
+	}
+}
+
+
+// half the surface area of a box (the SAH only compares ratios)
+static float halfArea(const Bounds& b)
+{
+	if (b.lo[0] > b.hi[0]) return 0.0f;
+
+	float dx = b.hi[0] - b.lo[0], dy = b.hi[1] - b.lo[1], dz = b.hi[2] - b.lo[2];
+	return dx * dy + dy * dz + dz * dx;
+}
+
+
+// padded box around a primitive
+static Bounds primitiveBounds(const Scene* scene, unsigned int key)
+{
+	Bounds b;
+
+	if (key < scene->numSpheres)
+	{
+		const Sphere& s = scene->sphereContainer[key];
+		float pos[3] = { s.pos.x, s.pos.y, s.pos.z };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			b.lo[axis] = pos[axis] - s.size;
+			b.hi[axis] = pos[axis] + s.size;
+		}
+	}
+	else
+	{
+		const Box& box = scene->boxContainer[key - scene->numSpheres];
+		float p1[3] = { box.p1.x, box.p1.y, box.p1.z };
+		float p2[3] = { box.p2.x, box.p2.y, box.p2.z };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			b.lo[axis] = std::min(p1[axis], p2[axis]);
+			b.hi[axis] = std::max(p1[axis], p2[axis]);
+		}
+	}
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float pad = BVH_BOUNDS_PADDING * (b.hi[axis] - b.lo[axis] + std::max(fabsf(b.lo[axis]), fabsf(b.hi[axis])) + 1.0f);
+		b.lo[axis] -= pad;
+		b.hi[axis] += pad;
+	}
+
+	return b;
+}
+
+
+// everything the recursive build needs
+typedef struct BuildState
+{
+	std::vector<BVHNode> nodes;
+	std::vector<unsigned int> keys;				// primitive keys, reordered so every leaf is a contiguous run
+	std::vector<Bounds> bounds;					// padded bounds of each primitive, indexed by key
+	std::vector<float> centroids;				// 3 floats per primitive, indexed by key
+} BuildState;
+
+
+// turn node into a leaf or split it at the best binned SAH plane and recurse into both halves
+static void buildNode(BuildState& state, unsigned int nodeIndex, unsigned int first, unsigned int count, int depth)
+{
+	// bounds of the primitives and of their centroids
+	Bounds nodeBounds = emptyBounds(), centroidBounds = emptyBounds();
+	for (unsigned int i = first; i < first + count; ++i)
+	{
+		unsigned int key = state.keys[i];
+		grow(&nodeBounds, state.bounds[key]);
+
+		Bounds c;
+		for (int axis = 0; axis < 3; ++axis) c.lo[axis] = c.hi[axis] = state.centroids[key * 3 + axis];
+		grow(&centroidBounds, c);
+	}
+
+	BVHNode& node = state.nodes[nodeIndex];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		node.boundsMin[axis] = nodeBounds.lo[axis];
+		node.boundsMax[axis] = nodeBounds.hi[axis];
+	}
+	node.first = first;
+	node.count = count;
+
+	if (count <= BVH_MAX_LEAF_SIZE || depth >= BVH_MAX_DEPTH) return;
+
+	// a small scene is left as a single leaf
+	if (depth == 0 && count <= BVH_LINEAR_MAX_PRIMITIVES) return;
+
+	// find the cheapest split plane between bins on any axis
+	float bestCost = FLT_MAX;
+	int bestAxis = -1, bestSplit = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = centroidBounds.hi[axis] - centroidBounds.lo[axis];
+		if (extent <= 0.0f) continue;
+
+		Bounds binBounds[BVH_NUM_BINS];
+		unsigned int binCount[BVH_NUM_BINS] = { 0 };
+		for (int bin = 0; bin < BVH_NUM_BINS; ++bin) binBounds[bin] = emptyBounds();
+
+		float scale = BVH_NUM_BINS / extent;
+		for (unsigned int i = first; i < first + count; ++i)
+		{
+			unsigned int key = state.keys[i];
+			int bin = std::min((int)((state.centroids[key * 3 + axis] - centroidBounds.lo[axis]) * scale), BVH_NUM_BINS - 1);
+			binCount[bin]++;
+			grow(&binBounds[bin], state.bounds[key]);
+		}
+
+		// sweep from the right to get the area and count of everything right of each plane
+		float rightArea[BVH_NUM_BINS];
+		unsigned int rightCount[BVH_NUM_BINS];
+		Bounds right = emptyBounds();
+		unsigned int rightTotal = 0;
+		for (int bin = BVH_NUM_BINS - 1; bin > 0; --bin)
+		{
+			grow(&right, binBounds[bin]);
+			rightTotal += binCount[bin];
+			rightArea[bin] = halfArea(right);
+			rightCount[bin] = rightTotal;
+		}
+
+		// then from the left, costing the plane after each bin
+		Bounds left = emptyBounds();
+		unsigned int leftTotal = 0;
+		for (int bin = 0; bin < BVH_NUM_BINS - 1; ++bin)
+		{
+			grow(&left, binBounds[bin]);
+			leftTotal += binCount[bin];
+			if (leftTotal == 0 || rightCount[bin + 1] == 0) continue;
+
+			float cost = halfArea(left) * leftTotal + rightArea[bin + 1] * rightCount[bin + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = bin;
+			}
+		}
+	}
+
+	// all centroids in the same place, or splitting costs more than testing everything here
+	float area = halfArea(nodeBounds);
+	if (bestAxis < 0 || (area > 0.0f && BVH_TRAVERSAL_COST + bestCost / area >= count)) return;
+
+	// move the primitives left of the plane to the front
+	float scale = BVH_NUM_BINS / (centroidBounds.hi[bestAxis] - centroidBounds.lo[bestAxis]);
+	float lo = centroidBounds.lo[bestAxis];
+	unsigned int* middle = std::partition(&state.keys[first], &state.keys[first] + count, [&](unsigned int key)
+	{
+		return std::min((int)((state.centroids[key * 3 + bestAxis] - lo) * scale), BVH_NUM_BINS - 1) <= bestSplit;
+	});
+	unsigned int leftCount = (unsigned int)(middle - &state.keys[first]);
+
+	// children are allocated as a pair (this invalidates node)
+	unsigned int leftChild = (unsigned int)state.nodes.size();
+	state.nodes.resize(leftChild + 2);
+	state.nodes[nodeIndex].first = leftChild;
+	state.nodes[nodeIndex].count = 0;
+
+	buildNode(state, leftChild, first, leftCount, depth + 1);
+	buildNode(state, leftChild + 1, first + leftCount, count - leftCount, depth + 1);
+}
+
+
+// build the bounding volume hierarchy over the scene's spheres and boxes (binned surface area heuristic)
+// fills in numBvhNodes, bvhNodeContainer and bvhPrimitiveContainer, has to be redone if spheres or boxes move
+void buildBVH(Scene* scene)
+{
+	unsigned int numPrimitives = scene->numSpheres + scene->numBoxes;
+
+	BuildState state;
+	state.keys.resize(numPrimitives);
+	state.bounds.resize(numPrimitives);
+	state.centroids.resize(numPrimitives * 3);
+	for (unsigned int key = 0; key < numPrimitives; ++key)
+	{
+		state.keys[key] = key;
+		state.bounds[key] = primitiveBounds(scene, key);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			state.centroids[key * 3 + axis] = 0.5f * (state.bounds[key].lo[axis] + state.bounds[key].hi[axis]);
+		}
+	}
+
+	// at most 2n - 1 nodes
+	state.nodes.reserve(numPrimitives * 2 + 1);
+	state.nodes.resize(1);
+	buildNode(state, 0, 0, numPrimitives, 0);
+
+	// an empty scene still gets a (zero sized, empty) root
+	if (numPrimitives == 0)
+	{
+		for (int axis = 0; axis < 3; ++axis) state.nodes[0].boundsMin[axis] = state.nodes[0].boundsMax[axis] = 0.0f;
+	}
+
+	// leaves keep their primitives in scene order, so ties within a leaf are settled without any extra work when tracing
+	for (size_t i = 0; i < state.nodes.size(); ++i)
+	{
+		if (state.nodes[i].count > 0) std::sort(state.keys.begin() + state.nodes[i].first, state.keys.begin() + state.nodes[i].first + state.nodes[i].count);
+	}
+
+	scene->numBvhNodes = (unsigned int)state.nodes.size();
+	scene->bvhNodeContainer = new BVHNode[scene->numBvhNodes];
+	std::copy(state.nodes.begin(), state.nodes.end(), scene->bvhNodeContainer);
+
+	// never allocate zero elements, so the container can always be uploaded as it is
+	scene->bvhPrimitiveContainer = new unsigned int[std::max(numPrimitives, 1u)];
+	std::copy(state.keys.begin(), state.keys.end(), scene->bvhPrimitiveContainer);
+}
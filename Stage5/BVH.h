@@ -0,0 +1,34 @@
+#ifndef __BVH_H
+#define __BVH_H
+
+#include "Scene.h"
+
+// most primitives a leaf is split down to (leaves can be bigger if splitting them doesn't pay off)
+#define BVH_MAX_LEAF_SIZE 4
+
+// scenes with at most this many spheres and boxes are left as a single leaf, which the tracers test one object after another
+// (walking even a few nodes costs more than testing that many objects)
+#define BVH_LINEAR_MAX_PRIMITIVES 16
+
+// cost of visiting an inner node (testing both children's bounds) relative to testing one sphere or box
+#define BVH_TRAVERSAL_COST 2.0f
+
+// number of bins the SAH split is searched over per axis
+#define BVH_NUM_BINS 16
+
+// deepest node the builder creates, traversal stacks need BVH_MAX_DEPTH + 1 entries
+#define BVH_MAX_DEPTH 48
+#define BVH_STACK_SIZE (BVH_MAX_DEPTH + 1)
+
+// primitive bounds are grown by this fraction of their size and position, so rounding in the sphere and box tests
+// can never report a hit just outside a node that the node test then misses
+#define BVH_BOUNDS_PADDING 1e-4f
+
+// rays whose squared direction length is further than this from 1 skip the BVH and test every object
+#define BVH_UNIT_TOLERANCE 1e-6f
+
+// build the bounding volume hierarchy over the scene's spheres and boxes (binned surface area heuristic)
+// fills in numBvhNodes, bvhNodeContainer and bvhPrimitiveContainer, has to be redone if spheres or boxes move
+void buildBVH(Scene* scene);
+
+#endif // __BVH_H
@@ -0,0 +1,56 @@
+#ifndef __BENCHMARK_H
+#define __BENCHMARK_H
+
+#include <vector>
+#include "RayCounters.h"
+
+// value of a time that wasn't measured (written as null in JSON and left empty in CSV)
+#define BENCHMARK_NOT_MEASURED -1.0
+
+// times of one run (of the -runs repeats of rendering the frame), in milliseconds
+typedef struct BenchmarkRun
+{
+	double totalMs;							// wall clock time of the whole run
+	double kernelMs;						// time spent rendering (device time of the kernels for OpenCL)
+	double readbackMs;						// device time of reading the image back
+} BenchmarkRun;
+
+// what was rendered, how long each phase took, and every run, for writing as a machine readable line
+typedef struct Benchmark
+{
+	const char* program;					// name of the executable (without its directory)
+	const char* scene;						// scene file
+	int width, height;						// image size
+	int samples;							// anti-aliasing level
+	int blockSize;							// tile size
+	const char* device;						// what rendered it
+	const char* mode;						// how it was rendered
+
+	// one off phases, in milliseconds (BENCHMARK_NOT_MEASURED if they don't apply)
+	double setupMs;							// creating the threads or the OpenCL context and program
+	double loadMs;							// parsing the scene file
+	double bvhMs;							// building the acceleration structures
+	double uploadMs;						// copying the scene to the device
+	double writeMs;							// writing what's left of the image file after the last run
+
+	// comparison with a reference image (see compareWithReference), mae is BENCHMARK_NOT_MEASURED if there wasn't one
+	double mae;								// mean absolute error
+	int maxDiff;							// largest difference in a channel
+	bool passed;							// whether the error was within the threshold
+
+	// rays and tests of the last run (NULL if they weren't counted), the rays per second are worked out over the median run
+	const RayCounters* counters;
+
+	std::vector<BenchmarkRun> runs;			// every run, in order
+} Benchmark;
+
+// set everything to not measured and drop any runs
+void resetBenchmark(Benchmark* benchmark);
+
+// append the benchmark to filename as a single line, "-" writes it to stdout
+// filenames ending in .csv get a CSV row (after a header row if the file is new or empty), anything else a JSON object
+// the summary (min, median, 95th percentile, max of the run times) leaves out the first run when there is more than one
+// prints the reason and returns false if the file can't be written
+bool writeBenchmark(const Benchmark* benchmark, const char* filename);
+
+#endif // __BENCHMARK_H
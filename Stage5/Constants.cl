@@ -1,9 +1,6 @@
 #ifndef __CONSTANTS_CL
 #define __CONSTANTS_CL
 
-// maximum size of image
-__constant int MAX_WIDTH = 2048, MAX_HEIGHT = 2048;
-
 // math constants
 __constant float PI = 3.14159265358979323846f;
 __constant float PIOVER180 = 0.017453292519943295769236907684886f;
@@ -20,4 +17,19 @@ __constant int MAX_RAYS_CAST = 10;
 // default refractive index (of air effectively)
 __constant float DEFAULT_REFRACTIVE_INDEX = 1.0f;
 
+// BVH traversal stack size (BVH_MAX_DEPTH + 1 from BVH.h)
+#define BVH_STACK_SIZE 49
+
+// rays whose squared direction length is further than this from 1 skip the BVH and test every object (as in BVH.h)
+__constant float BVH_UNIT_TOLERANCE = 1e-6f;
+
+// light tree traversal stack size (LIGHT_TREE_MAX_DEPTH + 1 from LightTree.h)
+#define LIGHT_TREE_STACK_SIZE 33
+
+// number of lights whose last occluder each work-item remembers (smaller than the CPU's, the cache lives in private memory)
+#define SHADOW_CACHE_SIZE 16
+
+// shadow cache slot value for a light nothing has blocked yet
+#define NO_OCCLUDER 0xFFFFFFFF
+
 #endif //__CONSTANTS_H
\ No newline at end of file
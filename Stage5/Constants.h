@@ -7,9 +7,6 @@
 
 #include <algorithm>
 
-// maximum size of image
-const int MAX_WIDTH = 2048, MAX_HEIGHT = 2048;
-
 // math constants
 const float PI = 3.14159265358979323846f;
 const float PIOVER180 = 0.017453292519943295769236907684886f;
@@ -0,0 +1,49 @@
+#ifndef __FRAME_BUFFER_H
+#define __FRAME_BUFFER_H
+
+#include <stddef.h>
+
+// alignment of a frame buffer and of the start of each of its rows (a cache line, and a whole number of AVX registers)
+#define FRAME_ALIGNMENT 64
+
+// a width x height window onto pixels in 0x00BBGGRR format with rows stride pixels apart (row 0 is the bottom of the image)
+// views of part of a frame let tiles and crops be written straight into their place in it
+typedef struct FrameView
+{
+	unsigned int* pixels;					// first pixel of row 0
+	int width, height;						// size of the window
+	int stride;								// pixels from the start of one row to the start of the next
+} FrameView;
+
+// the pixels of a frame, allocated for the size of the job rather than the largest image there could be
+typedef struct FrameBuffer
+{
+	FrameView view;							// the whole frame, every row starting on a FRAME_ALIGNMENT boundary
+	void* allocation;						// start of the allocation (NULL if there is none)
+	size_t allocatedBytes;					// size of the allocation (rounded up to whole pages if it was mapped)
+	int allocationType;						// how it was allocated, so it is freed the same way (see FrameBuffer.cpp)
+	bool hugePages;							// whether the frame is backed by huge (large) pages
+} FrameBuffer;
+
+// allocate a black width x height frame, on huge pages if asked for and the system can give them (otherwise on normal pages, saying so)
+// huge pages cut the TLB misses of writing and reading back very large frames
+// prints the reason and returns false if the frame can't be allocated
+bool createFrameBuffer(FrameBuffer* frame, int width, int height, bool hugePages);
+
+// allocate a black width x height frame that processes forked after it share, so what they render into it is seen by the rest
+// (not on Windows, which has no fork), on huge pages if asked for and there are some set aside
+// prints the reason and returns false if the frame can't be allocated
+bool createSharedFrameBuffer(FrameBuffer* frame, int width, int height, bool hugePages);
+
+void releaseFrameBuffer(FrameBuffer* frame);
+
+// the part [x0, x0 + width) x [y0, y0 + height) of a view (cut down to fit inside it), with the same stride
+FrameView subFrameView(const FrameView* view, int x0, int y0, int width, int height);
+
+// pixel (x, y) of a view
+inline unsigned int* framePixel(const FrameView* view, int x, int y)
+{
+	return view->pixels + (size_t)y * view->stride + x;
+}
+
+#endif // __FRAME_BUFFER_H
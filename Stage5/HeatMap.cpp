@@ -0,0 +1,140 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "HeatMap.h"
+#include "ImageIO.h"
+
+// size the heat map for a width x height frame, with no work recorded
+void createHeatMap(HeatMap* heatMap, int width, int height)
+{
+	heatMap->width = width;
+	heatMap->height = height;
+	heatMap->tests.assign((size_t)width * height, 0);
+	heatMap->rays.assign((size_t)width * height, 0);
+}
+
+
+// false colour (in 0x00BBGGRR format) of a cost from 0 (cheapest) to 1 (most expensive)
+static unsigned int heatColour(double cost)
+{
+	// dark blue, light blue, green, yellow, red
+	static const int stops[5][3] = { { 0, 0, 96 }, { 0, 128, 255 }, { 0, 200, 0 }, { 255, 230, 0 }, { 255, 0, 0 } };
+
+	double position = std::min(std::max(cost, 0.0), 1.0) * 4.0;
+	int stop = std::min((int)position, 3);
+	double blend = position - stop;
+
+	int channels[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		channels[c] = (int)(stops[stop][c] + blend * (stops[stop + 1][c] - stops[stop][c]) + 0.5);
+	}
+
+	return (channels[2] << 16) | (channels[1] << 8) | channels[0];
+}
+
+
+// write each pixel's tests as a false colour BMP and a line per tile of the part to a CSV file next to it
+bool writeHeatMap(const HeatMap* heatMap, const FramePart* part, const char* filename)
+{
+	const int width = heatMap->width, height = heatMap->height, tileSize = part->tileSize;
+	const size_t pixels = (size_t)width * height;
+	if (pixels == 0 || tileSize < 1) return false;
+
+	// log scale between the cheapest and the most expensive pixel of the part, a few very expensive pixels would leave the rest all one colour
+	// (the pixels outside it weren't rendered, so they would only drag the cheapest pixel and the mean down to nothing)
+	unsigned int leastTests = ~0u, mostTests = 0;
+	unsigned long long partTests = 0;
+	size_t partPixels = 0;
+	for (int y = part->imageY0; y < part->imageY1; ++y)
+	{
+		for (int x = part->imageX0; x < part->imageX1; ++x)
+		{
+			if (!inFramePart(part, x, y)) continue;
+
+			unsigned int tests = heatMap->tests[(size_t)y * width + x];
+			leastTests = std::min(leastTests, tests);
+			mostTests = std::max(mostTests, tests);
+			partTests += tests;
+			++partPixels;
+		}
+	}
+	if (partPixels == 0) return false;
+	double range = log1p((double)(mostTests - leastTests));
+	double meanTests = (double)partTests / partPixels;
+
+	// pixels outside the part are left black
+	std::vector<unsigned int> image(pixels, 0);
+	for (int y = part->imageY0; y < part->imageY1; ++y)
+	{
+		for (int x = part->imageX0; x < part->imageX1; ++x)
+		{
+			size_t i = (size_t)y * width + x;
+			if (inFramePart(part, x, y)) image[i] = heatColour(range > 0.0 ? log1p((double)(heatMap->tests[i] - leastTests)) / range : 0.0);
+		}
+	}
+	write_bmp(filename, image.data(), width, height, width);
+
+	// the CSV file has the image's name with .csv instead of .bmp (or added to it)
+	char csvFilename[1000];
+	size_t length = strlen(filename);
+	if (length >= 4 && strcmp(filename + length - 4, ".bmp") == 0) length -= 4;
+	sprintf(csvFilename, "%.*s.csv", (int)std::min(length, sizeof(csvFilename) - 5), filename);
+
+	FILE* file = fopen(csvFilename, "w");
+	if (file == NULL)
+	{
+		printf("Couldn't write the heat map tiles to %s\n", csvFilename);
+		return false;
+	}
+
+	// each of the part's tiles' totals (of its pixels in the part), how much of the part's work it was, and its cost per pixel compared with the part's
+	fprintf(file, "tileX,tileY,x0,y0,x1,y1,pixels,tests,rays,testsPerPixel,raysPerPixel,maxPixelTests,shareOfTests,relativeCost\n");
+
+	const int tilesWide = frameTilesWide(part);
+	int worstX = 0, worstY = 0;
+	double worstTestsPerPixel = -1.0;
+	for (int tile = part->firstTile; tile <= part->lastTile; ++tile)
+	{
+		int x0, y0, x1, y1;
+		if (!framePartTile(part, tile, &x0, &y0, &x1, &y1)) continue;
+
+		const int tileX = tile % tilesWide, tileY = tile / tilesWide;
+		unsigned long long tests = 0, rays = 0;
+		unsigned int maxPixelTests = 0;
+		for (int y = y0; y < y1; ++y)
+		{
+			for (int x = x0; x < x1; ++x)
+			{
+				size_t i = (size_t)y * width + x;
+				tests += heatMap->tests[i];
+				rays += heatMap->rays[i];
+				maxPixelTests = std::max(maxPixelTests, heatMap->tests[i]);
+			}
+		}
+
+		int tilePixels = (x1 - x0) * (y1 - y0);
+		double testsPerPixel = (double)tests / tilePixels;
+		fprintf(file, "%d,%d,%d,%d,%d,%d,%d,%llu,%llu,%.2f,%.2f,%u,%.3f,%.3f\n", tileX, tileY, x0, y0, x1, y1, tilePixels, tests, rays,
+			testsPerPixel, (double)rays / tilePixels, maxPixelTests, partTests ? 100.0 * tests / partTests : 0.0, meanTests > 0.0 ? testsPerPixel / meanTests : 0.0);
+
+		if (testsPerPixel > worstTestsPerPixel)
+		{
+			worstTestsPerPixel = testsPerPixel;
+			worstX = tileX;
+			worstY = tileY;
+		}
+	}
+
+	fclose(file);
+
+	printf("heat map written to %s and %s: %.1f tests per pixel (%u to %u), the most expensive %dx%d tile is (%d, %d) with %.1f, %.1fx the mean\n",
+		filename, csvFilename, meanTests, leastTests, mostTests, tileSize, tileSize, worstX, worstY, worstTestsPerPixel, meanTests > 0.0 ? worstTestsPerPixel / meanTests : 0.0);
+
+	return true;
+}
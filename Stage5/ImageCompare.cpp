@@ -0,0 +1,74 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "ImageCompare.h"
+#include "ImageIO.h"
+
+// compare a rendered image with the reference BMP file, straight from memory
+bool compareWithReference(const unsigned int* image, int width, int height, int stride, const char* referenceFilename, const char* diffFilename, ImageDifference* difference)
+{
+	int referenceWidth, referenceHeight;
+	unsigned int* reference = read_bmp(referenceFilename, &referenceWidth, &referenceHeight);
+	if (reference == NULL)
+	{
+		return false;
+	}
+
+	if (referenceWidth != width || referenceHeight != height)
+	{
+		printf("Reference %s is %dx%d, the image is %dx%d\n", referenceFilename, referenceWidth, referenceHeight, width, height);
+		delete[] reference;
+		return false;
+	}
+
+	unsigned int* diffImage = (diffFilename != NULL) ? new unsigned int[(size_t)width * height] : NULL;
+
+	// totals over every channel (64 bit, a 2048x2048 image can have 12M channels of up to 255 squared)
+	unsigned long long absoluteTotal = 0, squaredTotal = 0;
+	difference->maxDiff = 0;
+	difference->pixelsDifferent = 0;
+
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			unsigned int pixel = image[(size_t)y * stride + x];
+			unsigned int referencePixel = reference[(size_t)y * width + x];
+			int pixelMax = 0;
+
+			for (int shift = 0; shift < 24; shift += 8)
+			{
+				int diff = abs((int)((pixel >> shift) & 0xFF) - (int)((referencePixel >> shift) & 0xFF));
+				absoluteTotal += diff;
+				squaredTotal += diff * diff;
+				if (diff > pixelMax) pixelMax = diff;
+			}
+
+			if (pixelMax > 0) difference->pixelsDifferent++;
+			if (pixelMax > difference->maxDiff) difference->maxDiff = pixelMax;
+
+			if (diffImage != NULL)
+			{
+				// differing pixels in red (the low byte, written last as BMPs store blue first), the rest a quarter as bright as the reference
+				diffImage[(size_t)y * width + x] = pixelMax > 0 ? 0xFF : (referencePixel >> 2) & 0x3F3F3F;
+			}
+		}
+	}
+
+	double channels = 3.0 * width * height;
+	difference->mae = absoluteTotal / channels;
+	difference->psnr = (squaredTotal == 0) ? INFINITY : 10.0 * log10(255.0 * 255.0 / (squaredTotal / channels));
+
+	if (diffImage != NULL)
+	{
+		write_bmp(diffFilename, diffImage, width, height, width);
+		delete[] diffImage;
+	}
+
+	delete[] reference;
+	return true;
+}
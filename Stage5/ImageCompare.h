@@ -0,0 +1,18 @@
+#ifndef __IMAGE_COMPARE_H
+#define __IMAGE_COMPARE_H
+
+// how far a rendered image is from a reference image, over every channel of every pixel (channels are 0-255)
+typedef struct ImageDifference
+{
+	double mae;								// mean absolute error (what magick compare -metric mae gives, before normalising)
+	double psnr;							// peak signal to noise ratio in dB (infinite if the images are identical)
+	int maxDiff;							// largest difference in a single channel
+	unsigned int pixelsDifferent;			// pixels with any channel different
+} ImageDifference;
+
+// compare a rendered image (width x height, rows stride pixels apart) with the reference BMP file, straight from memory
+// if diffFilename is not NULL, a diff image is written to it: differing pixels in red over a dimmed copy of the reference
+// prints the reason and returns false if the reference can't be read or isn't the same size
+bool compareWithReference(const unsigned int* image, int width, int height, int stride, const char* referenceFilename, const char* diffFilename, ImageDifference* difference);
+
+#endif // __IMAGE_COMPARE_H
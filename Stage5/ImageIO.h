@@ -3,10 +3,25 @@
 #ifndef __IMAGE_IO_H
 #define __IMAGE_IO_H
 
-// image file writing functions
+#include <iosfwd>
+
+// image file reading and writing functions (read_bmp returns a new[]'d buffer, NULL if the file can't be read)
 //bool read_bmp(const char *name, Texture& t);
+unsigned int* read_bmp(const char *name, int* width, int* height);
 void write_bmp(const char *name, unsigned int *screen, int width, int height, int stride);
 void write_tga(const char *name, unsigned int *screen, int width, int height, int stride);
 void write_ppm(const char *name, unsigned int *screen, int width, int height, int stride);
 
+// bmp file written a band of rows at a time, so finished rows can be saved while later rows are still rendering
+typedef struct BmpStream
+{
+	std::ofstream* file;
+	int width, height;
+	int rowsWritten;
+} BmpStream;
+
+bool open_bmp_stream(BmpStream* stream, const char *name, int width, int height);
+void write_bmp_rows(BmpStream* stream, unsigned int *screen, int firstRow, int numRows, int stride);
+void close_bmp_stream(BmpStream* stream);
+
 #endif //__IMAGE_IO_H
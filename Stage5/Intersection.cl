@@ -86,6 +86,40 @@ bool isBoxIntersected(__global const Box* b, const Ray* r, float* t)
 }
 
 
+// whether the whole BVH is one leaf (small scenes, or an empty one whose root has no children either)
+bool isSingleLeafBVH(const Scene* scene)
+{
+	return scene->bvhNodeContainer[0].count > 0 || SCENE_SPHERES(scene) + SCENE_BOXES(scene) == 0;
+}
+
+
+// test to see if a ray passes through a BVH node's bounds somewhere before time t (invDir is 1 / the ray direction)
+// tEntry is set to the time the ray enters the bounds, so the nearer child can be visited first
+// this is the same slab test as isBoxIntersected, but the node bounds are padded, so it never misses a sphere or box inside
+// (the comparisons skip the NaN a ray lying in a slab plane produces)
+bool isNodeIntersected(__global const BVHNode* node, const Ray* r, const Vector* invDir, float t, float* tEntry)
+{
+	float start[3] = { r->start.x, r->start.y, r->start.z };
+	float inv[3] = { invDir->x, invDir->y, invDir->z };
+	float tmin = -MAX_RAY_DISTANCE, tmax = MAX_RAY_DISTANCE;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float t0 = (node->boundsMin[axis] - start[axis]) * inv[axis];
+		float t1 = (node->boundsMax[axis] - start[axis]) * inv[axis];
+		float tnear = t0 < t1 ? t0 : t1;
+		float tfar = t0 < t1 ? t1 : t0;
+		tmin = tnear > tmin ? tnear : tmin;
+		tmax = tfar < tmax ? tfar : tmax;
+	}
+
+	*tEntry = tmin;
+
+	// a hit equal to t can still win a tie (see objectIntersection), so only reject nodes entered strictly after t
+	return tmin <= tmax && tmax > 0.0f && tmin <= t;
+}
+
+
 // calculate collision normal, viewProjection, object's material, and test to see if inside collision object
 void calculateIntersectionResponse(const Scene* scene, const Ray* viewRay, Intersection* intersect)
 {
@@ -144,47 +178,168 @@ void calculateIntersectionResponse(const Scene* scene, const Ray* viewRay, Inter
 }
 
 
-// test to see if collision between ray and any object in the scene
-// updates intersection structure if collision occurs
-bool objectIntersection(const Scene* scene, const Ray* viewRay, Intersection* intersect)
+// test every sphere and then every box for the closest collision (key as used by the BVH)
+bool intersectAllObjects(const Scene* scene, const Ray* viewRay, float* t, unsigned int* closest)
 {
-	// set default distance to be a long long way away
-	float t = MAX_RAY_DISTANCE;
+	bool found = false;
 
-	// no intersection found by default
-	intersect->objectType = NONE;
+	COUNT_RAYS(scene->rayCounters, COUNT_SPHERE_TESTS, SCENE_SPHERES(scene));
+	COUNT_RAYS(scene->rayCounters, COUNT_BOX_TESTS, SCENE_BOXES(scene));
 
 	// search for sphere collisions, storing closest one found
-	for (unsigned int i = 0; i < scene->numSpheres; ++i)
+	for (unsigned int i = 0; i < SCENE_SPHERES(scene); ++i)
 	{
-		if (isSphereIntersected(&scene->sphereContainer[i], viewRay, &t))
+		if (isSphereIntersected(&scene->sphereContainer[i], viewRay, t))
 		{
-			intersect->objectType = SPHERE;
-			intersect->sphere = &scene->sphereContainer[i];
+			*closest = i;
+			found = true;
 		}
 	}
 
-
 	// search for box collisions, storing closest one found
-	for (unsigned int i = 0; i < scene->numBoxes; ++i)
+	for (unsigned int i = 0; i < SCENE_BOXES(scene); ++i)
 	{
-		if (isBoxIntersected(&scene->boxContainer[i], viewRay, &t))
+		if (isBoxIntersected(&scene->boxContainer[i], viewRay, t))
 		{
-			intersect->objectType = BOX;
-			intersect->box = &scene->boxContainer[i];
+			*closest = SCENE_SPHERES(scene) + i;
+			found = true;
 		}
 	}
-	
-	// nothing detected, return false
-	if (intersect->objectType == NONE)
+
+	return found;
+}
+
+
+// find the closest object the ray collides with, setting *t to the distance and *closest to its key
+// walks the BVH nearest child first, the result is the same as testing every sphere and then every box in order:
+// the closest hit wins and on equal distance the object that comes first (spheres before boxes, lower index first)
+bool closestObject(const Scene* scene, const Ray* viewRay, float* tClosest, unsigned int* closestKey)
+{
+	// set default distance to be a long long way away
+	float t = MAX_RAY_DISTANCE;
+
+	// key of the closest object found so far (spheres first, then boxes)
+	unsigned int closest = 0;
+	bool found = false;
+
+	Vector invDir = 1.0f / viewRay->dir;
+
+	// nodes still to visit and where the ray enters them
+	unsigned int stack[BVH_STACK_SIZE];
+	float stackEntry[BVH_STACK_SIZE];
+	int stackSize = 0;
+
+	// the sphere test assumes a unit length direction, which rays reflected from inside an object don't have
+	// those can report sphere hits outside the sphere's bounds, so they are tested against everything instead
+	// (as are all rays in scenes small enough for the whole BVH to be a single leaf)
+	if (isSingleLeafBVH(scene) || fabs(dot(viewRay->dir, viewRay->dir) - 1.0f) > BVH_UNIT_TOLERANCE)
 	{
-		return false;
+		found = intersectAllObjects(scene, viewRay, &t, &closest);
+	}
+	else
+	{
+		COUNT_RAYS(scene->rayCounters, COUNT_NODE_TESTS, 1);
+		if (isNodeIntersected(&scene->bvhNodeContainer[0], viewRay, &invDir, t, &stackEntry[0])) stack[stackSize++] = 0;
+	}
+
+	while (stackSize > 0)
+	{
+		--stackSize;
+
+		// a closer hit may have been found since the node was pushed
+		if (stackEntry[stackSize] > t) continue;
+
+		__global const BVHNode* node = &scene->bvhNodeContainer[stack[stackSize]];
+
+		if (node->count > 0)
+		{
+			// test the leaf's objects
+			for (unsigned int i = node->first; i < node->first + node->count; ++i)
+			{
+				unsigned int key = scene->bvhPrimitiveContainer[i];
+
+				// an earlier object also wins at exactly the same distance
+				float limit = (found && key < closest) ? nextafter(t, MAX_RAY_DISTANCE) : t;
+
+				COUNT_RAYS(scene->rayCounters, (key < SCENE_SPHERES(scene)) ? COUNT_SPHERE_TESTS : COUNT_BOX_TESTS, 1);
+
+				bool hit = (key < SCENE_SPHERES(scene)) ?
+					isSphereIntersected(&scene->sphereContainer[key], viewRay, &limit) :
+					isBoxIntersected(&scene->boxContainer[key - SCENE_SPHERES(scene)], viewRay, &limit);
+
+				if (hit)
+				{
+					t = limit;
+					closest = key;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			// visit the nearer child first (pushed last), skipping any the ray misses or only reaches after the closest hit
+			float tLeft, tRight;
+			COUNT_RAYS(scene->rayCounters, COUNT_NODE_TESTS, 2);
+			bool hitLeft = isNodeIntersected(&scene->bvhNodeContainer[node->first], viewRay, &invDir, t, &tLeft);
+			bool hitRight = isNodeIntersected(&scene->bvhNodeContainer[node->first + 1], viewRay, &invDir, t, &tRight);
+
+			if (hitLeft && hitRight && tRight < tLeft)
+			{
+				stack[stackSize] = node->first; stackEntry[stackSize++] = tLeft;
+				stack[stackSize] = node->first + 1; stackEntry[stackSize++] = tRight;
+			}
+			else
+			{
+				if (hitRight) { stack[stackSize] = node->first + 1; stackEntry[stackSize++] = tRight; }
+				if (hitLeft) { stack[stackSize] = node->first; stackEntry[stackSize++] = tLeft; }
+			}
+		}
+	}
+
+	*tClosest = t;
+	*closestKey = closest;
+
+	if (found) COUNT_RAYS(scene->rayCounters, COUNT_HITS, 1);
+
+	return found;
+}
+
+
+// fill in the object and point of intersection for a hit on object key at distance t
+void setIntersection(const Scene* scene, const Ray* viewRay, unsigned int key, float t, Intersection* intersect)
+{
+	if (key < SCENE_SPHERES(scene))
+	{
+		intersect->objectType = SPHERE;
+		intersect->sphere = &scene->sphereContainer[key];
+	}
+	else
+	{
+		intersect->objectType = BOX;
+		intersect->box = &scene->boxContainer[key - SCENE_SPHERES(scene)];
 	}
 
 	// calculate the point of the intersection
 	intersect->pos = viewRay->start + viewRay->dir * t;
+}
+
+
+// test to see if collision between ray and any object in the scene
+// updates intersection structure if collision occurs
+bool objectIntersection(const Scene* scene, const Ray* viewRay, Intersection* intersect)
+{
+	float t;
+	unsigned int closest;
+
+	// nothing detected, return false
+	if (!closestObject(scene, viewRay, &t, &closest))
+	{
+		intersect->objectType = NONE;
+		return false;
+	}
+
+	setIntersection(scene, viewRay, closest, t, intersect);
 
 	return true;
 }
 
-
@@ -125,42 +125,136 @@ void calculateIntersectionResponse(const Scene* scene, const Ray* viewRay, Inter
 }
 
 
-// test to see if collision between ray and any object in the scene
-// updates intersection structure if collision occurs
-bool objectIntersection(const Scene* scene, const Ray* viewRay, Intersection* intersect)
+// test every sphere and then every box for the closest collision (key as used by the BVH)
+static bool intersectAllObjects(const Scene* scene, const Ray* viewRay, float* t, unsigned int* closest)
 {
-	// set default distance to be a long long way away
-    float t = MAX_RAY_DISTANCE;
-
-	// no intersection found by default
-	intersect->objectType = Intersection::NONE;
+	bool found = false;
 
 	// search for sphere collisions, storing closest one found
 	for (unsigned int i = 0; i < scene->numSpheres; ++i)
 	{
-		if (isSphereIntersected(&scene->sphereContainer[i], viewRay, &t))
+		if (isSphereIntersected(&scene->sphereContainer[i], viewRay, t))
 		{
-			intersect->objectType = Intersection::SPHERE;
-			intersect->sphere = &scene->sphereContainer[i];
+			*closest = i;
+			found = true;
 		}
 	}
 
 	// search for box collisions, storing closest one found
 	for (unsigned int i = 0; i < scene->numBoxes; ++i)
 	{
-		if (isBoxIntersected(&scene->boxContainer[i], viewRay, &t))
+		if (isBoxIntersected(&scene->boxContainer[i], viewRay, t))
+		{
+			*closest = scene->numSpheres + i;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+
+// test to see if collision between ray and any object in the scene
+// updates intersection structure if collision occurs
+// walks the BVH nearest child first, the result is the same as testing every sphere and then every box in order:
+// the closest hit wins and on equal distance the object that comes first (spheres before boxes, lower index first)
+bool objectIntersection(const Scene* scene, const Ray* viewRay, Intersection* intersect)
+{
+	// set default distance to be a long long way away
+	float t = MAX_RAY_DISTANCE;
+
+	// key of the closest object found so far (spheres first, then boxes)
+	unsigned int closest = 0;
+	bool found = false;
+
+	Vector invDir = { 1.0f / viewRay->dir.x, 1.0f / viewRay->dir.y, 1.0f / viewRay->dir.z };
+
+	// nodes still to visit and where the ray enters them
+	unsigned int stack[BVH_STACK_SIZE];
+	float stackEntry[BVH_STACK_SIZE];
+	int stackSize = 0;
+
+	// the sphere test assumes a unit length direction, which rays reflected from inside an object don't have
+	// those can report sphere hits outside the sphere's bounds, so they are tested against everything instead
+	// (as are all rays in scenes small enough for the whole BVH to be a single leaf)
+	if (scene->numBvhNodes == 1 || fabsf(viewRay->dir.dot() - 1.0f) > BVH_UNIT_TOLERANCE)
+	{
+		found = intersectAllObjects(scene, viewRay, &t, &closest);
+	}
+	else if (isNodeIntersected(&scene->bvhNodeContainer[0], viewRay, &invDir, t, &stackEntry[0]))
+	{
+		stack[stackSize++] = 0;
+	}
+
+	while (stackSize > 0)
+	{
+		--stackSize;
+
+		// a closer hit may have been found since the node was pushed
+		if (stackEntry[stackSize] > t) continue;
+
+		const BVHNode* node = &scene->bvhNodeContainer[stack[stackSize]];
+
+		if (node->count > 0)
 		{
-			intersect->objectType = Intersection::BOX;
-			intersect->box = &scene->boxContainer[i];
+			// test the leaf's objects
+			for (unsigned int i = node->first; i < node->first + node->count; ++i)
+			{
+				unsigned int key = scene->bvhPrimitiveContainer[i];
+
+				// an earlier object also wins at exactly the same distance
+				float limit = (found && key < closest) ? nextafterf(t, MAX_RAY_DISTANCE) : t;
+
+				bool hit = (key < scene->numSpheres) ?
+					isSphereIntersected(&scene->sphereContainer[key], viewRay, &limit) :
+					isBoxIntersected(&scene->boxContainer[key - scene->numSpheres], viewRay, &limit);
+
+				if (hit)
+				{
+					t = limit;
+					closest = key;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			// visit the nearer child first (pushed last), skipping any the ray misses or only reaches after the closest hit
+			float tLeft, tRight;
+			bool hitLeft = isNodeIntersected(&scene->bvhNodeContainer[node->first], viewRay, &invDir, t, &tLeft);
+			bool hitRight = isNodeIntersected(&scene->bvhNodeContainer[node->first + 1], viewRay, &invDir, t, &tRight);
+
+			if (hitLeft && hitRight && tRight < tLeft)
+			{
+				stack[stackSize] = node->first; stackEntry[stackSize++] = tLeft;
+				stack[stackSize] = node->first + 1; stackEntry[stackSize++] = tRight;
+			}
+			else
+			{
+				if (hitRight) { stack[stackSize] = node->first + 1; stackEntry[stackSize++] = tRight; }
+				if (hitLeft) { stack[stackSize] = node->first; stackEntry[stackSize++] = tLeft; }
+			}
 		}
 	}
 
 	// nothing detected, return false
-	if (intersect->objectType == Intersection::NONE)
+	if (!found)
 	{
+		intersect->objectType = Intersection::NONE;
 		return false;
 	}
 
+	if (closest < scene->numSpheres)
+	{
+		intersect->objectType = Intersection::SPHERE;
+		intersect->sphere = &scene->sphereContainer[closest];
+	}
+	else
+	{
+		intersect->objectType = Intersection::BOX;
+		intersect->box = &scene->boxContainer[closest - scene->numSpheres];
+	}
+
 	// calculate the point of the intersection
 	intersect->pos = viewRay->start + viewRay->dir * t;
 
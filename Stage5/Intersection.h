@@ -7,6 +7,7 @@
 
 #include "Scene.h"
 #include "SceneObjects.h"
+#include "BVH.h"
 
 // all pertinant information about an intersection of a ray with an object
 typedef struct Intersection
@@ -36,6 +37,32 @@ bool isSphereIntersected(const Sphere* b, const Ray* r, float* t);
 // updates closest collision time (/distance) if collision occurs
 bool isBoxIntersected(const Box* b, const Ray* r, float* t);
 
+// test to see if a ray passes through a BVH node's bounds somewhere before time t (invDir is 1 / the ray direction)
+// tEntry is set to the time the ray enters the bounds, so the nearer child can be visited first
+// this is the same slab test as isBoxIntersected, but the node bounds are padded, so it never misses a sphere or box inside
+// (inline as it runs several times per ray, the comparisons skip the NaN a ray lying in a slab plane produces)
+inline bool isNodeIntersected(const BVHNode* node, const Ray* r, const Vector* invDir, float t, float* tEntry)
+{
+	float start[3] = { r->start.x, r->start.y, r->start.z };
+	float inv[3] = { invDir->x, invDir->y, invDir->z };
+	float tmin = -MAX_RAY_DISTANCE, tmax = MAX_RAY_DISTANCE;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float t0 = (node->boundsMin[axis] - start[axis]) * inv[axis];
+		float t1 = (node->boundsMax[axis] - start[axis]) * inv[axis];
+		float tnear = t0 < t1 ? t0 : t1;
+		float tfar = t0 < t1 ? t1 : t0;
+		tmin = tnear > tmin ? tnear : tmin;
+		tmax = tfar < tmax ? tfar : tmax;
+	}
+
+	*tEntry = tmin;
+
+	// a hit equal to t can still win a tie (see objectIntersection), so only reject nodes entered strictly after t
+	return tmin <= tmax && tmax > 0.0f && tmin <= t;
+}
+
 // calculate collision normal, viewProjection, object's material, and test to see if inside collision object
 void calculateIntersectionResponse(const Scene* scene, const Ray* viewRay, Intersection* intersect); 
 
@@ -7,24 +7,92 @@ It is free to use for educational purpose and cannot be redistributed outside of
 
 #include "Stage5/Texturing.cl"
 
-bool isInShadow(const Scene* scene, const Ray* lightRay, const float lightDist)
+// per work-item memory of which object last blocked each light (light j uses slot j % SHADOW_CACHE_SIZE)
+// the anti-aliasing samples and bounces of a pixel are usually blocked by the same object, so it is tested before walking the scene
+typedef struct ShadowCache
+{
+	unsigned int lastOccluder[SHADOW_CACHE_SIZE];	// sphere index, or numSpheres + box index (NO_OCCLUDER if none)
+} ShadowCache;
+
+
+// forget all occluders
+void resetShadowCache(ShadowCache* cache)
+{
+	for (unsigned int i = 0; i < SHADOW_CACHE_SIZE; ++i)
+	{
+		cache->lastOccluder[i] = NO_OCCLUDER;
+	}
+}
+
+
+// test a light ray against one sphere or box (sphere index, or numSpheres + box index)
+bool isOccludedBy(const Scene* scene, unsigned int key, const Ray* lightRay, const float lightDist)
 {
 	float t = lightDist;
 
-	// search for sphere collision
-	for (unsigned int i = 0; i < scene->numSpheres; ++i)
+	COUNT_RAYS(scene->rayCounters, (key < SCENE_SPHERES(scene)) ? COUNT_SPHERE_TESTS : COUNT_BOX_TESTS, 1);
+
+	return (key < SCENE_SPHERES(scene)) ?
+		isSphereIntersected(&scene->sphereContainer[key], lightRay, &t) :
+		isBoxIntersected(&scene->boxContainer[key - SCENE_SPHERES(scene)], lightRay, &t);
+}
+
+
+// test to see if light ray collides with any of the scene's objects
+// short-circuits when first intersection discovered, because no matter what the object will be in shadow
+// so the BVH is walked in whatever order is cheapest, without sorting the children
+// *occluder is tested first and is set to the blocking object when one is found
+bool isInShadow(const Scene* scene, const Ray* lightRay, const float lightDist, unsigned int* occluder)
+{
+	// whatever blocked this light last time is the most likely thing to block it now
+	if (*occluder < SCENE_SPHERES(scene) + SCENE_BOXES(scene) && isOccludedBy(scene, *occluder, lightRay, lightDist)) return true;
+
+	// the whole BVH is a single leaf in small scenes, test everything without the bounds test
+	if (isSingleLeafBVH(scene))
 	{
-		if (isSphereIntersected(&scene->sphereContainer[i], lightRay, &t))
+		for (unsigned int key = 0; key < SCENE_SPHERES(scene) + SCENE_BOXES(scene); ++key)
 		{
-			return true;
+			if (key != *occluder && isOccludedBy(scene, key, lightRay, lightDist))
+			{
+				*occluder = key;
+				return true;
+			}
 		}
+		return false;
 	}
-	// search for box collision
-	for (unsigned int i = 0; i < scene->numBoxes; ++i)
+
+	Vector invDir = 1.0f / lightRay->dir;
+
+	// nodes still to visit
+	unsigned int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
 	{
-		if (isBoxIntersected(&scene->boxContainer[i], lightRay, &t))
+		__global const BVHNode* node = &scene->bvhNodeContainer[stack[--stackSize]];
+
+		float tEntry;
+		COUNT_RAYS(scene->rayCounters, COUNT_NODE_TESTS, 1);
+		if (!isNodeIntersected(node, lightRay, &invDir, lightDist, &tEntry)) continue;
+
+		if (node->count == 0)
 		{
-			return true;
+			stack[stackSize++] = node->first + 1;
+			stack[stackSize++] = node->first;
+			continue;
+		}
+
+		// search the leaf's spheres and boxes for a collision (the remembered occluder has already missed)
+		for (unsigned int i = node->first; i < node->first + node->count; ++i)
+		{
+			unsigned int key = scene->bvhPrimitiveContainer[i];
+
+			if (key != *occluder && isOccludedBy(scene, key, lightRay, lightDist))
+			{
+				*occluder = key;
+				return true;
+			}
 		}
 	}
 
@@ -36,22 +104,21 @@ bool isInShadow(const Scene* scene, const Ray* lightRay, const float lightDist)
 // apply diffuse lighting with respect to material's colouring
 Colour applyDiffuse(const Ray* lightRay, __global const Light* currentLight, const Intersection* intersect)
 {
-	Colour output;
+	// plain (GOURAUD) colour unless the material is one of the textures, a scene specialised build only tests for the textures it uses
+	Colour output = intersect->material->diffuse;
+	int type = intersect->material->type;
 
-	switch (intersect->material->type)
+	if (SCENE_HAS_MATERIAL(CHECKERBOARD) && type == CHECKERBOARD)
 	{
-	case GOURAUD:
-		output = intersect->material->diffuse;
-		break;
-	case CHECKERBOARD:
 		output = applyCheckerboard(intersect);
-		break;
-	case CIRCLES:
+	}
+	else if (SCENE_HAS_MATERIAL(CIRCLES) && type == CIRCLES)
+	{
 		output = applyCircles(intersect);
-		break;
-	case WOOD:
+	}
+	else if (SCENE_HAS_MATERIAL(WOOD) && type == WOOD)
+	{
 		output = applyWood(intersect);
-		break;
 	}
 
 	float lambert = dot(lightRay->dir, intersect->normal);
@@ -74,8 +141,74 @@ Colour applySpecular(const Ray* lightRay, __global const Light* currentLight, co
 }
 
 
+// largest cosine of the angle between axis and any direction inside a cone (both given by their cosines and the cone's half angle sine)
+float maxCosInCone(float cosAxis, float sinHalfAngle, float cosHalfAngle)
+{
+	if (cosAxis >= cosHalfAngle) return 1.0f;
+
+	float sinAxis = sqrt(max(1.0f - cosAxis * cosAxis, 0.0f));
+	return cosAxis * cosHalfAngle + sinAxis * sinHalfAngle;
+}
+
+
+// largest absolute channel of a colour
+float maxChannel(Colour c)
+{
+	Colour a = fabs(c);
+	return max(a.x, max(a.y, a.z));
+}
+
+
+// whether all of a light tree node's lights are behind the surface at an intersection (so none of them can light it)
+// the box corner furthest along the normal is tested, with some slack so rounding never skips a light the plain test would use
+bool isLightNodeBehind(__global const LightNode* node, const Intersection* intersect)
+{
+	Vector n = intersect->normal;
+	float dx = ((n.x > 0.0f) ? node->boundsMax[0] : node->boundsMin[0]) - intersect->pos.x;
+	float dy = ((n.y > 0.0f) ? node->boundsMax[1] : node->boundsMin[1]) - intersect->pos.y;
+	float dz = ((n.z > 0.0f) ? node->boundsMax[2] : node->boundsMin[2]) - intersect->pos.z;
+
+	return dx * n.x + dy * n.y + dz * n.z < -1e-4f * (fabs(dx * n.x) + fabs(dy * n.y) + fabs(dz * n.z));
+}
+
+
+// most a light tree node's lights could add to any colour channel at an intersection (shadows aside)
+float lightNodeBound(__global const LightNode* node, const Ray* viewRay, const Intersection* intersect)
+{
+	__global const Material* material = intersect->material;
+	if (material->power < 0.0f) return MAXFLOAT;
+
+	// the directions to the lights lie inside the cone from the intersection around the sphere that bounds the box
+	Vector boundsMin = { node->boundsMin[0], node->boundsMin[1], node->boundsMin[2] };
+	Vector boundsMax = { node->boundsMax[0], node->boundsMax[1], node->boundsMax[2] };
+	Vector toCentre = 0.5f * (boundsMin + boundsMax) - intersect->pos;
+	float dist = length(toCentre), radius = length(0.5f * (boundsMax - boundsMin));
+
+	// largest cosine between a light direction and the normal, and between a light direction and the view ray
+	float viewLength = length(viewRay->dir);
+	float lambertMax = 1.0f, viewMax = 1.0f;
+	if (dist > radius)
+	{
+		float sinHalfAngle = radius / dist, cosHalfAngle = sqrt(1.0f - sinHalfAngle * sinHalfAngle);
+		lambertMax = maxCosInCone(dot(toCentre, intersect->normal) / dist, sinHalfAngle, cosHalfAngle);
+		viewMax = maxCosInCone(dot(toCentre, viewRay->dir) / (dist * viewLength), sinHalfAngle, cosHalfAngle);
+	}
+	lambertMax = max(lambertMax, 0.0f);
+
+	// Blinn's term is at most 1, and at most the largest numerator over the smallest length of (light direction - view direction)
+	float blinnMax = 1.0f;
+	float lengthSquared = 1.0f + viewLength * viewLength - 2.0f * viewLength * viewMax;
+	if (lengthSquared > 0.0f) blinnMax = min((lambertMax - intersect->viewProjection) * rsqrt(lengthSquared), 1.0f);
+
+	float diffuseMax = max(maxChannel(material->diffuse), maxChannel(material->diffuse2));
+	return node->intensity * (lambertMax * diffuseMax + pow(max(blinnMax, 0.0f), material->power) * maxChannel(material->specular));
+}
+
+
 // apply diffuse and specular lighting contributions for all lights in scene taking shadowing into account
-Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection* intersect)
+// the light tree is walked left to right, so the lights that aren't skipped are still added up in scene order
+// the cache remembers the last occluder of each light between calls (and the shadow rays are counted into the scene's counters)
+Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection* intersect, ShadowCache* cache)
 {
 	// colour to return (starts as black)
 	Colour output = { 0.0f, 0.0f, 0.0f };
@@ -83,42 +216,101 @@ Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection*
 	// same starting point for each light ray
 	Ray lightRay = { intersect->pos };
 
-	// loop through all the lights
-	for (unsigned int j = 0; j < scene->numLights; ++j)
+	// how much more the lights that get skipped may leave out of each colour channel
+	float budget = scene->lightCullEpsilon;
+
+	// light tree nodes still to visit (nothing at all in a scene without lights)
+	unsigned int stack[LIGHT_TREE_STACK_SIZE];
+	int stackSize = 0;
+	if (SCENE_LIGHTS(scene) > 0) stack[stackSize++] = 0;
+
+	while (stackSize > 0)
 	{
-		// get reference to current light
-		__global const Light* currentLight = &scene->lightContainer[j];
+		__global const LightNode* node = &scene->lightNodeContainer[stack[--stackSize]];
 
-		// light ray direction need to equal the normalised vector in the direction of the current light
-		// as we need to reuse all the intermediate components for other calculations, 
-		// we calculate the normalised vector by hand instead of using the normalise function
-		lightRay.dir = currentLight->pos - intersect->pos;
-		float angleBetweenLightAndNormal = dot(lightRay.dir, intersect->normal);
+		// skip groups of lights that are all behind the surface, or (with an error budget) too dim to matter here between them
+		if (isLightNodeBehind(node, intersect)) continue;
+		if (budget > 0.0f)
+		{
+			float bound = lightNodeBound(node, viewRay, intersect);
+			if (bound <= budget)
+			{
+				budget -= bound;
+				continue;
+			}
+		}
 
-		// skip this light if it's behind the object (ie. both light and normal pointing in the same direction)
-		if (angleBetweenLightAndNormal <= 0.0f)
+		if (node->count == 0)
 		{
+			stack[stackSize++] = node->first + 1;
+			stack[stackSize++] = node->first;
 			continue;
 		}
 
-		// distance to light from intersection point (and it's inverse)
-		float lightDist = sqrt(dot(lightRay.dir, lightRay.dir));
-		float invLightDist = 1.0f / lightDist;
+		// loop through the leaf's lights
+		for (unsigned int j = node->first; j < node->first + node->count; ++j)
+		{
+			// get reference to current light
+			__global const Light* currentLight = &scene->lightContainer[j];
 
-		// light ray projection
-		float lightProjection = invLightDist * angleBetweenLightAndNormal;
+			// light ray direction need to equal the normalised vector in the direction of the current light
+			// as we need to reuse all the intermediate components for other calculations, 
+			// we calculate the normalised vector by hand instead of using the normalise function
+			lightRay.dir = currentLight->pos - intersect->pos;
+			float angleBetweenLightAndNormal = dot(lightRay.dir, intersect->normal);
 
-		// normalise the light direction
-		lightRay.dir = lightRay.dir * invLightDist;
+			// skip this light if it's behind the object (ie. both light and normal pointing in the same direction)
+			if (angleBetweenLightAndNormal <= 0.0f)
+			{
+				continue;
+			}
 
-		// only apply lighting from this light if not in shadow of some other object
-		if (!isInShadow(scene, &lightRay, lightDist))
-		{
-			// add diffuse lighting from colour / texture
-			output += applyDiffuse(&lightRay, currentLight, intersect);
+			// distance to light from intersection point (and it's inverse)
+			float lightDist = sqrt(dot(lightRay.dir, lightRay.dir));
+			float invLightDist = 1.0f / lightDist;
+
+			// light ray projection
+			float lightProjection = invLightDist * angleBetweenLightAndNormal;
+
+			// normalise the light direction
+			lightRay.dir = lightRay.dir * invLightDist;
+
+			// with an error budget left, the light's contribution is worked out first
+			// and a light too dim to matter here is left out without casting its shadow ray
+			Colour contribution;
+			bool budgeted = budget > 0.0f;
+			if (budgeted)
+			{
+				contribution = applyDiffuse(&lightRay, currentLight, intersect) + applySpecular(&lightRay, currentLight, lightProjection, viewRay, intersect);
+
+				float largest = maxChannel(contribution);
+				if (largest <= budget)
+				{
+					budget -= largest;
+					continue;
+				}
+			}
+
+			// only apply lighting from this light if not in shadow of some other object
+			unsigned int* occluder = &cache->lastOccluder[j % SHADOW_CACHE_SIZE];
+			unsigned int lastOccluder = *occluder;
+			bool inShadow = isInShadow(scene, &lightRay, lightDist, occluder);
+
+			COUNT_RAYS(scene->rayCounters, COUNT_SHADOW_RAYS, 1);
+			if (inShadow && *occluder == lastOccluder) COUNT_RAYS(scene->rayCounters, COUNT_SHADOW_CACHE_HITS, 1);
+
+			if (!inShadow && budgeted)
+			{
+				output += contribution;
+			}
+			else if (!inShadow)
+			{
+				// add diffuse lighting from colour / texture
+				output += applyDiffuse(&lightRay, currentLight, intersect);
 
-			// add specular lighting
-			output += applySpecular(&lightRay, currentLight, lightProjection, viewRay, intersect);
+				// add specular lighting
+				output += applySpecular(&lightRay, currentLight, lightProjection, viewRay, intersect);
+			}
 		}
 	}
 
@@ -6,27 +6,87 @@ It is free to use for educational purpose and cannot be redistributed outside of
 #include "Colour.h"
 #include "Intersection.h"
 #include "Texturing.h"
+#include "LightTree.h"
+#include <algorithm>
+#include <cfloat>
+
+// forget all occluders and zero the counters
+void resetShadowCache(ShadowCache* cache)
+{
+	for (unsigned int i = 0; i < SHADOW_CACHE_SIZE; ++i)
+	{
+		cache->lastOccluder[i] = NO_OCCLUDER;
+	}
+	cache->shadowRays = 0;
+	cache->cacheHits = 0;
+}
+
+
+// test a light ray against one sphere or box (sphere index, or numSpheres + box index)
+static inline bool isOccludedBy(const Scene* scene, unsigned int key, const Ray* lightRay, const float lightDist)
+{
+	float t = lightDist;
+
+	return (key < scene->numSpheres) ?
+		isSphereIntersected(&scene->sphereContainer[key], lightRay, &t) :
+		isBoxIntersected(&scene->boxContainer[key - scene->numSpheres], lightRay, &t);
+}
+
 
 // test to see if light ray collides with any of the scene's objects
 // short-circuits when first intersection discovered, because no matter what the object will be in shadow
-bool isInShadow(const Scene* scene, const Ray* lightRay, const float lightDist)
+// so the BVH is walked in whatever order is cheapest, without sorting the children
+// *occluder is tested first and is set to the blocking object when one is found
+bool isInShadow(const Scene* scene, const Ray* lightRay, const float lightDist, unsigned int* occluder)
 {
-	float t = lightDist;
+	// whatever blocked this light last time is the most likely thing to block it now
+	if (*occluder < scene->numSpheres + scene->numBoxes && isOccludedBy(scene, *occluder, lightRay, lightDist)) return true;
 
-	// search for sphere collision
-	for (unsigned int i = 0; i < scene->numSpheres; ++i)
+	// the whole BVH is a single leaf in small scenes, test everything without the bounds test
+	if (scene->numBvhNodes == 1)
 	{
-		if (isSphereIntersected(&scene->sphereContainer[i], lightRay, &t))
+		for (unsigned int key = 0; key < scene->numSpheres + scene->numBoxes; ++key)
 		{
-			return true;
+			if (key != *occluder && isOccludedBy(scene, key, lightRay, lightDist))
+			{
+				*occluder = key;
+				return true;
+			}
 		}
+		return false;
 	}
-	// search for box collision
-	for (unsigned int i = 0; i < scene->numBoxes; ++i)
+
+	Vector invDir = { 1.0f / lightRay->dir.x, 1.0f / lightRay->dir.y, 1.0f / lightRay->dir.z };
+
+	// nodes still to visit
+	unsigned int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
 	{
-		if (isBoxIntersected(&scene->boxContainer[i], lightRay, &t))
+		const BVHNode* node = &scene->bvhNodeContainer[stack[--stackSize]];
+
+		float tEntry;
+		if (!isNodeIntersected(node, lightRay, &invDir, lightDist, &tEntry)) continue;
+
+		if (node->count == 0)
+		{
+			stack[stackSize++] = node->first + 1;
+			stack[stackSize++] = node->first;
+			continue;
+		}
+
+		// search the leaf's spheres and boxes for a collision (the remembered occluder has already missed)
+		for (unsigned int i = node->first; i < node->first + node->count; ++i)
 		{
-			return true;
+			unsigned int key = scene->bvhPrimitiveContainer[i];
+
+			if (key != *occluder && isOccludedBy(scene, key, lightRay, lightDist))
+			{
+				*occluder = key;
+				return true;
+			}
 		}
 	}
 
@@ -76,8 +136,78 @@ Colour applySpecular(const Ray* lightRay, const Light* currentLight, const float
 }
 
 
+// largest cosine of the angle between axis and any direction inside a cone (both given by their cosines and the cone's half angle sine)
+static inline float maxCosInCone(float cosAxis, float sinHalfAngle, float cosHalfAngle)
+{
+	if (cosAxis >= cosHalfAngle) return 1.0f;
+
+	float sinAxis = sqrtf(std::max(1.0f - cosAxis * cosAxis, 0.0f));
+	return cosAxis * cosHalfAngle + sinAxis * sinHalfAngle;
+}
+
+
+// largest absolute channel of a colour
+static inline float maxChannel(const Colour& c)
+{
+	return std::max(fabsf(c.red), std::max(fabsf(c.green), fabsf(c.blue)));
+}
+
+
+// whether all of a light tree node's lights are behind the surface at an intersection (so none of them can light it)
+// the box corner furthest along the normal is tested, with some slack so rounding never skips a light the plain test would use
+static inline bool isLightNodeBehind(const LightNode* node, const Intersection* intersect)
+{
+	const Vector& n = intersect->normal;
+	float dx = ((n.x > 0.0f) ? node->boundsMax[0] : node->boundsMin[0]) - intersect->pos.x;
+	float dy = ((n.y > 0.0f) ? node->boundsMax[1] : node->boundsMin[1]) - intersect->pos.y;
+	float dz = ((n.z > 0.0f) ? node->boundsMax[2] : node->boundsMin[2]) - intersect->pos.z;
+
+	return dx * n.x + dy * n.y + dz * n.z < -1e-4f * (fabsf(dx * n.x) + fabsf(dy * n.y) + fabsf(dz * n.z));
+}
+
+
+// most a light tree node's lights could add to any colour channel at an intersection (shadows aside)
+static float lightNodeBound(const LightNode* node, const Ray* viewRay, const Intersection* intersect)
+{
+	const Material* material = intersect->material;
+	if (material->power < 0.0f) return FLT_MAX;
+
+	// the directions to the lights lie inside the cone from the intersection around the sphere that bounds the box
+	Vector toCentre = {
+		0.5f * (node->boundsMin[0] + node->boundsMax[0]) - intersect->pos.x,
+		0.5f * (node->boundsMin[1] + node->boundsMax[1]) - intersect->pos.y,
+		0.5f * (node->boundsMin[2] + node->boundsMax[2]) - intersect->pos.z };
+	Vector halfSize = {
+		0.5f * (node->boundsMax[0] - node->boundsMin[0]),
+		0.5f * (node->boundsMax[1] - node->boundsMin[1]),
+		0.5f * (node->boundsMax[2] - node->boundsMin[2]) };
+	float dist = sqrtf(toCentre.dot()), radius = sqrtf(halfSize.dot());
+
+	// largest cosine between a light direction and the normal, and between a light direction and the view ray
+	float viewLength = sqrtf(viewRay->dir.dot());
+	float lambertMax = 1.0f, viewMax = 1.0f;
+	if (dist > radius)
+	{
+		float sinHalfAngle = radius / dist, cosHalfAngle = sqrtf(1.0f - sinHalfAngle * sinHalfAngle);
+		lambertMax = maxCosInCone(toCentre * intersect->normal / dist, sinHalfAngle, cosHalfAngle);
+		viewMax = maxCosInCone(toCentre * viewRay->dir / (dist * viewLength), sinHalfAngle, cosHalfAngle);
+	}
+	lambertMax = std::max(lambertMax, 0.0f);
+
+	// Blinn's term is at most 1, and at most the largest numerator over the smallest length of (light direction - view direction)
+	float blinnMax = 1.0f;
+	float lengthSquared = 1.0f + viewLength * viewLength - 2.0f * viewLength * viewMax;
+	if (lengthSquared > 0.0f) blinnMax = std::min((lambertMax - intersect->viewProjection) * invsqrtf(lengthSquared), 1.0f);
+
+	float diffuseMax = std::max(maxChannel(material->diffuse), maxChannel(material->diffuse2));
+	return node->intensity * (lambertMax * diffuseMax + powf(std::max(blinnMax, 0.0f), material->power) * maxChannel(material->specular));
+}
+
+
 // apply diffuse and specular lighting contributions for all lights in scene taking shadowing into account
-Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection* intersect)
+// the light tree is walked left to right, so the lights that aren't skipped are still added up in scene order
+// the cache remembers the last occluder of each light between calls and counts the shadow rays cast
+Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection* intersect, ShadowCache* cache)
 {
 	// colour to return (starts as black)
 	Colour output(0.0f, 0.0f, 0.0f);
@@ -85,42 +215,101 @@ Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection*
 	// same starting point for each light ray
 	Ray lightRay = { intersect->pos };
 
-	// loop through all the lights
-	for (unsigned int j = 0; j < scene->numLights; ++j)
+	// how much more the lights that get skipped may leave out of each colour channel
+	float budget = scene->lightCullEpsilon;
+
+	// light tree nodes still to visit (nothing at all in a scene without lights)
+	unsigned int stack[LIGHT_TREE_STACK_SIZE];
+	int stackSize = 0;
+	if (scene->numLights > 0) stack[stackSize++] = 0;
+
+	while (stackSize > 0)
 	{
-		// get reference to current light
-		const Light* currentLight = &scene->lightContainer[j];
+		const LightNode* node = &scene->lightNodeContainer[stack[--stackSize]];
 
-		// light ray direction need to equal the normalised vector in the direction of the current light
-		// as we need to reuse all the intermediate components for other calculations, 
-		// we calculate the normalised vector by hand instead of using the normalise function
-		lightRay.dir = currentLight->pos - intersect->pos;
-		float angleBetweenLightAndNormal = lightRay.dir * intersect->normal;
+		// skip groups of lights that are all behind the surface, or (with an error budget) too dim to matter here between them
+		if (isLightNodeBehind(node, intersect)) continue;
+		if (budget > 0.0f)
+		{
+			float bound = lightNodeBound(node, viewRay, intersect);
+			if (bound <= budget)
+			{
+				budget -= bound;
+				continue;
+			}
+		}
 
-		// skip this light if it's behind the object (ie. both light and normal pointing in the same direction)
-		if (angleBetweenLightAndNormal <= 0.0f)
+		if (node->count == 0)
 		{
+			stack[stackSize++] = node->first + 1;
+			stack[stackSize++] = node->first;
 			continue;
 		}
 
-		// distance to light from intersection point (and it's inverse)
-		float lightDist = sqrtf(lightRay.dir.dot());
-		float invLightDist = 1.0f / lightDist;
+		// loop through the leaf's lights
+		for (unsigned int j = node->first; j < node->first + node->count; ++j)
+		{
+			// get reference to current light
+			const Light* currentLight = &scene->lightContainer[j];
 
-		// light ray projection
-		float lightProjection = invLightDist * angleBetweenLightAndNormal;
+			// light ray direction need to equal the normalised vector in the direction of the current light
+			// as we need to reuse all the intermediate components for other calculations, 
+			// we calculate the normalised vector by hand instead of using the normalise function
+			lightRay.dir = currentLight->pos - intersect->pos;
+			float angleBetweenLightAndNormal = lightRay.dir * intersect->normal;
 
-		// normalise the light direction
-		lightRay.dir = lightRay.dir * invLightDist;
+			// skip this light if it's behind the object (ie. both light and normal pointing in the same direction)
+			if (angleBetweenLightAndNormal <= 0.0f)
+			{
+				continue;
+			}
 
-		// only apply lighting from this light if not in shadow of some other object
-		if (!isInShadow(scene, &lightRay, lightDist))
-		{
-			// add diffuse lighting from colour / texture
-			output += applyDiffuse(&lightRay, currentLight, intersect);
+			// distance to light from intersection point (and it's inverse)
+			float lightDist = sqrtf(lightRay.dir.dot());
+			float invLightDist = 1.0f / lightDist;
+
+			// light ray projection
+			float lightProjection = invLightDist * angleBetweenLightAndNormal;
+
+			// normalise the light direction
+			lightRay.dir = lightRay.dir * invLightDist;
+
+			// with an error budget left, the light's contribution is worked out first
+			// and a light too dim to matter here is left out without casting its shadow ray
+			Colour contribution;
+			bool budgeted = budget > 0.0f;
+			if (budgeted)
+			{
+				contribution = applyDiffuse(&lightRay, currentLight, intersect) + applySpecular(&lightRay, currentLight, lightProjection, viewRay, intersect);
+
+				float largest = maxChannel(contribution);
+				if (largest <= budget)
+				{
+					budget -= largest;
+					continue;
+				}
+			}
+
+			// only apply lighting from this light if not in shadow of some other object
+			unsigned int* occluder = &cache->lastOccluder[j % SHADOW_CACHE_SIZE];
+			unsigned int lastOccluder = *occluder;
+			bool inShadow = isInShadow(scene, &lightRay, lightDist, occluder);
+
+			cache->shadowRays++;
+			if (inShadow && *occluder == lastOccluder) cache->cacheHits++;
+
+			if (!inShadow && budgeted)
+			{
+				output += contribution;
+			}
+			else if (!inShadow)
+			{
+				// add diffuse lighting from colour / texture
+				output += applyDiffuse(&lightRay, currentLight, intersect);
 
-			// add specular lighting
-			output += applySpecular(&lightRay, currentLight, lightProjection, viewRay, intersect);
+				// add specular lighting
+				output += applySpecular(&lightRay, currentLight, lightProjection, viewRay, intersect);
+			}
 		}
 	}
 
@@ -8,8 +8,27 @@
 #include "Scene.h"
 #include "Intersection.h"
 
+// number of lights whose last occluder is remembered (lights beyond this share slots, light j uses slot j % SHADOW_CACHE_SIZE)
+#define SHADOW_CACHE_SIZE 64
+
+// slot value for a light nothing has blocked yet
+#define NO_OCCLUDER 0xFFFFFFFF
+
+// per thread memory of which object last blocked each light, plus shadow ray counters
+// neighbouring shading points are usually blocked by the same object, so it is tested before walking the scene
+typedef struct ShadowCache
+{
+	unsigned int lastOccluder[SHADOW_CACHE_SIZE];	// sphere index, or numSpheres + box index (NO_OCCLUDER if none)
+	unsigned long long shadowRays;					// shadow rays cast
+	unsigned long long cacheHits;					// shadow rays answered by the remembered occluder
+} ShadowCache;
+
+// forget all occluders and zero the counters
+void resetShadowCache(ShadowCache* cache);
+
 // test to see if light ray collides with any of the scene's objects
-bool isInShadow(const Scene* scene, const Ray* lightRay, const float lightDist);
+// *occluder is tested first and is set to the blocking object when one is found
+bool isInShadow(const Scene* scene, const Ray* lightRay, const float lightDist, unsigned int* occluder);
 
 // apply diffuse lighting with respect to material's colouring
 Colour applyDiffuse(const Ray* lightRay, const Light* currentLight, const Intersection* intersect);
@@ -18,7 +37,7 @@ Colour applyDiffuse(const Ray* lightRay, const Light* currentLight, const Inters
 Colour applySpecular(const Ray* lightRay, const Light* currentLight, const float fLightProjection, const Ray* viewRay, const Intersection* intersect);
 
 // apply diffuse and specular lighting contributions for all lights in scene taking shadowing into account
-Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection* intersect); 
+Colour applyLighting(const Scene* scene, const Ray* viewRay, const Intersection* intersect, ShadowCache* cache); 
 
 
 #endif // __LIGHTING_H
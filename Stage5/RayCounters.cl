@@ -0,0 +1,107 @@
+#ifndef __RAY_COUNTERS_CL
+#define __RAY_COUNTERS_CL
+
+// optional instrumentation, built in with -DRAY_COUNTERS (the host adds it for -counters)
+// each work-item counts into its own RayCounters in private memory, and at the end of the kernel the work-group
+// adds its items' counts up in local memory before one item adds the group's totals to the frame's in global memory
+
+// what is counted (the same order as RayCounters.h)
+#define COUNT_PRIMARY_RAYS 0		// rays from the camera, one per sample
+#define COUNT_REFLECTION_RAYS 1		// reflected rays traced
+#define COUNT_REFRACTION_RAYS 2		// refracted rays traced
+#define COUNT_SHADOW_RAYS 3			// rays from a hit towards a light
+#define COUNT_SHADOW_CACHE_HITS 4	// shadow rays blocked by whatever last blocked that light
+#define COUNT_NODE_TESTS 5			// ray against BVH node bounds tests
+#define COUNT_SPHERE_TESTS 6		// ray against sphere tests
+#define COUNT_BOX_TESTS 7			// ray against box tests
+#define COUNT_HITS 8				// primary, reflection and refraction rays that hit something
+#define COUNT_DEPTH 9				// samples that traced 1 ray, COUNT_DEPTH + 1 for 2 rays, ... up to MAX_RAYS_CAST rays
+#define NUM_RAY_COUNTERS 19			// COUNT_DEPTH + MAX_RAYS_CAST
+
+// a work-item's counts (small enough not to overflow 32 bits, the totals are 64 bit)
+typedef struct RayCounters
+{
+	unsigned int counts[NUM_RAY_COUNTERS];
+} RayCounters;
+
+#ifdef RAY_COUNTERS
+#define COUNT_RAYS(counters, counter, n) ((counters)->counts[counter] += (n))
+#else
+#define COUNT_RAYS(counters, counter, n) ((void)0)
+#endif
+
+
+// zero every counter
+void resetRayCounters(RayCounters* counters)
+{
+	for (int i = 0; i < NUM_RAY_COUNTERS; ++i)
+	{
+		counters->counts[i] = 0;
+	}
+}
+
+
+// node, sphere and box tests
+unsigned int countedTests(const RayCounters* counters)
+{
+	return counters->counts[COUNT_NODE_TESTS] + counters->counts[COUNT_SPHERE_TESTS] + counters->counts[COUNT_BOX_TESTS];
+}
+
+
+// primary, reflection, refraction and shadow rays
+unsigned int countedRays(const RayCounters* counters)
+{
+	return counters->counts[COUNT_PRIMARY_RAYS] + counters->counts[COUNT_REFLECTION_RAYS] + counters->counts[COUNT_REFRACTION_RAYS] + counters->counts[COUNT_SHADOW_RAYS];
+}
+
+
+#ifdef RAY_COUNTERS
+// the totals are 64 bit counts kept as a low and a high word, OpenCL 1.2 only has 32 bit atomics
+// atomic_add returns the low word from before the add, so the add that wraps it round knows to carry into the high word
+void addLocalCount(volatile __local unsigned int* total, unsigned int low, unsigned int high)
+{
+	unsigned int old = atomic_add(&total[0], low);
+	high += (old + low < old) ? 1 : 0;
+	if (high) atomic_add(&total[1], high);
+}
+
+void addGlobalCount(volatile __global unsigned int* total, unsigned int low, unsigned int high)
+{
+	unsigned int old = atomic_add(&total[0], low);
+	high += (old + low < old) ? 1 : 0;
+	if (high) atomic_add(&total[1], high);
+}
+#endif
+
+
+// add a work-item's counts to the frame's totals (2 * NUM_RAY_COUNTERS words, low then high word of each)
+// groupCounts is the work-group's local scratch (2 * NUM_RAY_COUNTERS words), so there is one global atomic per counter per group
+// every work-item of the group has to call it, as it has barriers (does nothing without RAY_COUNTERS)
+void reduceRayCounters(const RayCounters* counters, __local unsigned int* groupCounts, __global unsigned int* frameCounts)
+{
+#ifdef RAY_COUNTERS
+	bool firstItem = get_local_id(0) == 0 && get_local_id(1) == 0;
+
+	if (firstItem)
+	{
+		for (int i = 0; i < 2 * NUM_RAY_COUNTERS; ++i) groupCounts[i] = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = 0; i < NUM_RAY_COUNTERS; ++i)
+	{
+		if (counters->counts[i]) addLocalCount(&groupCounts[2 * i], counters->counts[i], 0);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (firstItem)
+	{
+		for (int i = 0; i < NUM_RAY_COUNTERS; ++i)
+		{
+			if (groupCounts[2 * i] || groupCounts[2 * i + 1]) addGlobalCount(&frameCounts[2 * i], groupCounts[2 * i], groupCounts[2 * i + 1]);
+		}
+	}
+#endif
+}
+
+#endif // __RAY_COUNTERS_CL
@@ -0,0 +1,95 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include "RayCounters.h"
+
+// zero every counter
+void resetRayCounters(RayCounters* counters)
+{
+	for (int i = 0; i < NUM_RAY_COUNTERS; ++i)
+	{
+		counters->counts[i] = 0;
+	}
+}
+
+
+// add counters into total
+void addRayCounters(RayCounters* total, const RayCounters* counters)
+{
+	for (int i = 0; i < NUM_RAY_COUNTERS; ++i)
+	{
+		total->counts[i] += counters->counts[i];
+	}
+}
+
+
+// name of a counter below COUNT_DEPTH as it appears in the benchmark output
+const char* rayCounterName(int counter)
+{
+	static const char* names[COUNT_DEPTH] = { "primaryRays", "reflectionRays", "refractionRays", "shadowRays", "shadowCacheHits", "nodeTests", "sphereTests", "boxTests", "hits" };
+
+	return (counter >= 0 && counter < COUNT_DEPTH) ? names[counter] : "";
+}
+
+
+// primary, reflection, refraction and shadow rays
+unsigned long long totalRays(const RayCounters* counters)
+{
+	const unsigned long long* c = counters->counts;
+	return c[COUNT_PRIMARY_RAYS] + c[COUNT_REFLECTION_RAYS] + c[COUNT_REFRACTION_RAYS] + c[COUNT_SHADOW_RAYS];
+}
+
+
+// node, sphere and box tests
+unsigned long long totalTests(const RayCounters* counters)
+{
+	const unsigned long long* c = counters->counts;
+	return c[COUNT_NODE_TESTS] + c[COUNT_SPHERE_TESTS] + c[COUNT_BOX_TESTS];
+}
+
+
+// node, sphere and box tests per ray (0 if there were no rays)
+double testsPerRay(const RayCounters* counters)
+{
+	unsigned long long rays = totalRays(counters);
+
+	return rays ? (double)totalTests(counters) / rays : 0.0;
+}
+
+
+// millions of rays (of all kinds) per second for a frame that took frameMs
+double megaRaysPerSecond(const RayCounters* counters, double frameMs)
+{
+	return frameMs > 0.0 ? totalRays(counters) / (frameMs * 1000.0) : 0.0;
+}
+
+
+// percentage of part in whole (0 if whole is 0)
+static double percentage(unsigned long long part, unsigned long long whole)
+{
+	return whole ? 100.0 * part / whole : 0.0;
+}
+
+
+// print the counters of a frame that took frameMs
+void outputRayCounters(const RayCounters* counters, double frameMs)
+{
+	const unsigned long long* c = counters->counts;
+	unsigned long long traced = c[COUNT_PRIMARY_RAYS] + c[COUNT_REFLECTION_RAYS] + c[COUNT_REFRACTION_RAYS];
+
+	printf("rays: %llu primary, %llu reflection, %llu refraction, %llu shadow (%.1f%% blocked by the cached occluder), %.2fM rays per second\n",
+		c[COUNT_PRIMARY_RAYS], c[COUNT_REFLECTION_RAYS], c[COUNT_REFRACTION_RAYS], c[COUNT_SHADOW_RAYS],
+		percentage(c[COUNT_SHADOW_CACHE_HITS], c[COUNT_SHADOW_RAYS]), megaRaysPerSecond(counters, frameMs));
+	printf("tests: %llu node, %llu sphere, %llu box, %.2f per ray, %llu hits (%.1f%% of the primary, reflection and refraction rays)\n",
+		c[COUNT_NODE_TESTS], c[COUNT_SPHERE_TESTS], c[COUNT_BOX_TESTS], testsPerRay(counters), c[COUNT_HITS], percentage(c[COUNT_HITS], traced));
+
+	// share of the samples that stopped after each number of rays (leaving out the numbers no sample stopped at)
+	printf("rays per sample:");
+	for (int i = 0; i < MAX_RAYS_CAST; ++i)
+	{
+		if (c[COUNT_DEPTH + i]) printf(" %d: %.1f%%", i + 1, percentage(c[COUNT_DEPTH + i], c[COUNT_PRIMARY_RAYS]));
+	}
+	printf("\n");
+}
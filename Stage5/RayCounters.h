@@ -0,0 +1,52 @@
+#ifndef __RAY_COUNTERS_H
+#define __RAY_COUNTERS_H
+
+#include "Constants.h"
+
+// what the optional instrumentation counts, indices into RayCounters::counts (Stage5/RayCounters.cl numbers them the same)
+enum RayCounter
+{
+	COUNT_PRIMARY_RAYS,						// rays from the camera, one per sample
+	COUNT_REFLECTION_RAYS,					// reflected rays traced
+	COUNT_REFRACTION_RAYS,					// refracted rays traced
+	COUNT_SHADOW_RAYS,						// rays from a hit towards a light
+	COUNT_SHADOW_CACHE_HITS,				// shadow rays blocked by whatever last blocked that light
+	COUNT_NODE_TESTS,						// ray against BVH node bounds tests
+	COUNT_SPHERE_TESTS,						// ray against sphere tests
+	COUNT_BOX_TESTS,						// ray against box tests
+	COUNT_HITS,								// primary, reflection and refraction rays that hit something
+	COUNT_DEPTH,							// samples that traced 1 ray (no bounces), COUNT_DEPTH + 1 for 2 rays, ... up to MAX_RAYS_CAST rays
+	NUM_RAY_COUNTERS = COUNT_DEPTH + MAX_RAYS_CAST
+};
+
+// rays cast and the tests they took over a frame (each worker or work-group counts its own and they are added up at the end)
+typedef struct RayCounters
+{
+	unsigned long long counts[NUM_RAY_COUNTERS];
+} RayCounters;
+
+// zero every counter
+void resetRayCounters(RayCounters* counters);
+
+// add counters into total
+void addRayCounters(RayCounters* total, const RayCounters* counters);
+
+// name of a counter below COUNT_DEPTH as it appears in the benchmark output (eg. "primaryRays")
+const char* rayCounterName(int counter);
+
+// primary, reflection, refraction and shadow rays
+unsigned long long totalRays(const RayCounters* counters);
+
+// node, sphere and box tests
+unsigned long long totalTests(const RayCounters* counters);
+
+// node, sphere and box tests per ray (0 if there were no rays)
+double testsPerRay(const RayCounters* counters);
+
+// millions of rays (of all kinds) per second for a frame that took frameMs
+double megaRaysPerSecond(const RayCounters* counters, double frameMs);
+
+// print the counters of a frame that took frameMs: the rays of each kind, the tests, and how many rays each sample traced
+void outputRayCounters(const RayCounters* counters, double frameMs);
+
+#endif // __RAY_COUNTERS_H
@@ -2,7 +2,11 @@
 Ray tracing tutorial of http://www.codermind.com/articles/Raytracer-in-C++-Introduction-What-is-ray-tracing.html
 It is free to use for educational purpose and cannot be redistributed outside of the tutorial pages. */
 
+#ifdef _WIN32
 #define TARGET_WINDOWS
+#else
+#define TARGET_MACLINUX
+#endif
 
 #pragma warning(disable: 4996)
 #include <stdio.h>
@@ -12,23 +16,26 @@ It is free to use for educational purpose and cannot be redistributed outside of
 #include "Lighting.h"
 #include "Intersection.h"
 #include "ImageIO.h"
-#include "LoadCL.h"
-
-unsigned int buffer[MAX_WIDTH * MAX_HEIGHT];
-unsigned int* out = buffer;
-unsigned int buffer2[MAX_WIDTH * MAX_HEIGHT];
-unsigned int* out2 = buffer2;
-//unsigned int outCopy[MAX_WIDTH * MAX_HEIGHT];
+#include "RenderContext.h"
+#include "SceneBuffers.h"
+#include "TilePipeline.h"
+#include "Wavefront.h"
+#include "LightTree.h"
+#include "Benchmark.h"
+#include "ImageCompare.h"
+#include "RayCounters.h"
+#include "HeatMap.h"
+#include "FrameBuffer.h"
+#include "FramePart.h"
+
+// the frame being rendered (allocated in main for the size of the job, only the part's image when part of the image is rendered)
+FrameView frame;
 
 typedef struct kernelPass {
 	cl_uint aaLevel;												// aaLevel
 	cl_int testMode;												// testMode
-	cl_int i;														// totaldivision of workload
-	cl_int totWidth;
-	cl_int totHeight;
-	cl_uint curBlock;
-	cl_uint numBW;
-	cl_uint numBH;
+	cl_int totWidth;												// width of the whole image
+	cl_int totHeight;												// height of the whole image
 	__declspec(align(16)) cl_float3 cameraPosition;					// camera location
 	cl_float cameraRotation;										// direction camera points
 	cl_float cameraFieldOfView;										// field of view for the camera
@@ -40,6 +47,7 @@ typedef struct kernelPass {
 	cl_uint numLights;												// numLights
 	cl_uint numSpheres;												// numSpheres
 	cl_uint numBoxes;												// numBoxes
+	cl_float lightCullEpsilon;										// error budget for lights skipped at an intersection
 } kernelPass;
 
 // reflect the ray from an object
@@ -89,7 +97,7 @@ Ray calculateRefraction(const Ray* viewRay, const Intersection* intersect, float
 
 
 // follow a single ray until it's final destination (or maximum number of steps reached)
-Colour traceRay(const Scene* scene, Ray viewRay)
+Colour traceRay(const Scene* scene, Ray viewRay, ShadowCache* shadowCache)
 {
 	Colour output(0.0f, 0.0f, 0.0f); 								// colour value to be output
 	float currentRefractiveIndex = DEFAULT_REFRACTIVE_INDEX;		// current refractive index
@@ -107,7 +115,7 @@ Colour traceRay(const Scene* scene, Ray viewRay)
 		calculateIntersectionResponse(scene, &viewRay, &intersect);
 
 		// apply the diffuse and specular lighting 
-		if (!intersect.insideObject) output += coef * applyLighting(scene, &viewRay, &intersect);
+		if (!intersect.insideObject) output += coef * applyLighting(scene, &viewRay, &intersect, shadowCache);
 
 		// if object has reflection or refraction component, adjust the view ray and coefficent of calculation and continue looping
 		if (intersect.material->reflection)
@@ -144,12 +152,13 @@ int render(Scene* scene, const int width, const int height, const int aaLevel, b
 	// angle between each successive ray cast (per pixel, anti-aliasing uses a fraction of this)
 	const float dirStepSize = 1.0f / (0.5f * width / tanf(PIOVER180 * 0.5f * scene->cameraFieldOfView));
 
-	// pointer to output buffer
-	//unsigned int* out = buffer;
-
 	// count of samples rendered
 	unsigned int samplesRendered = 0;
 
+	// occluders remembered from pixel to pixel
+	ShadowCache shadowCache;
+	resetShadowCache(&shadowCache);
+
 	// loop through all the pixels
 	for (int y = -height / 2; y < height / 2; ++y)
 	{
@@ -178,7 +187,7 @@ int render(Scene* scene, const int width, const int height, const int aaLevel, b
 					Ray viewRay = { scene->cameraPosition, normalise(rotatedDir) };
 
 					// follow ray and add proportional of the result to the final pixel colour
-					output += sampleRatio * traceRay(scene, viewRay);
+					output += sampleRatio * traceRay(scene, viewRay, &shadowCache);
 
 					// count this sample
 					samplesRendered++;
@@ -188,12 +197,12 @@ int render(Scene* scene, const int width, const int height, const int aaLevel, b
 			if (!testMode)
 			{
 				// store saturated final colour value in image buffer
-				*out++ = output.convertToPixel(scene->exposure);
+				*framePixel(&frame, x + width / 2, y + height / 2) = output.convertToPixel(scene->exposure);
 			}
 			else
 			{
 				// store colour (calculated from x,y coordinates) in image buffer 
-				*out++ = Colour((x + width / 2) % 256 / 256.0f, 0, (y + height / 2) % 256 / 256.0f).convertToPixel();
+				*framePixel(&frame, x + width / 2, y + height / 2) = Colour((x + width / 2) % 256 / 256.0f, 0, (y + height / 2) % 256 / 256.0f).convertToPixel();
 			}
 		}
 	}
@@ -292,6 +301,92 @@ void outputInfo(const Scene* scene)
 }
 
 
+// build options that specialise Render.cl for a scene (see SCENE_SPECIALISED in Scene.cl)
+// the program cache keys binaries on the options, so each scene signature is only compiled once
+void sceneBuildOptions(const Scene* scene, unsigned int aaLevel, char* options)
+{
+	// bit n set if any material is of type n
+	unsigned int materialTypes = 0;
+	for (unsigned int i = 0; i < scene->numMaterials; ++i)
+	{
+		materialTypes |= 1u << scene->materialContainer[i].type;
+	}
+
+	sprintf(options, "-DSCENE_SPECIALISED -DSCENE_NUM_SPHERES=%uu -DSCENE_NUM_BOXES=%uu -DSCENE_NUM_LIGHTS=%uu -DSCENE_AA_LEVEL=%uu -DSCENE_MATERIAL_TYPES=%uu",
+		scene->numSpheres, scene->numBoxes, scene->numLights, aaLevel, materialTypes);
+}
+
+
+// zero the device's ray counters (2 * NUM_RAY_COUNTERS words, see RayCounters.cl) before a run
+bool clearDeviceRayCounters(const RenderContext* rc, cl_mem rayCounterBuffer)
+{
+	const cl_uint zeros[2 * NUM_RAY_COUNTERS] = { 0 };
+	cl_int err = clEnqueueWriteBuffer(rc->queue, rayCounterBuffer, CL_TRUE, 0, sizeof(zeros), zeros, 0, NULL, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError resetting the ray counters. Error code: %d\n", err);
+		return false;
+	}
+
+	return true;
+}
+
+
+// read the device's ray counters back once a run has finished, joining each one's low and high words
+bool readDeviceRayCounters(const RenderContext* rc, cl_mem rayCounterBuffer, RayCounters* counters)
+{
+	cl_uint words[2 * NUM_RAY_COUNTERS];
+	cl_int err = clEnqueueReadBuffer(rc->queue, rayCounterBuffer, CL_TRUE, 0, sizeof(words), words, 0, NULL, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError reading the ray counters. Error code: %d\n", err);
+		return false;
+	}
+
+	for (int i = 0; i < NUM_RAY_COUNTERS; ++i)
+	{
+		counters->counts[i] = words[2 * i] | ((unsigned long long)words[2 * i + 1] << 32);
+	}
+
+	return true;
+}
+
+
+// read each pixel's tests and rays back from the device's heat map buffer (two words per pixel)
+bool readHeatMap(const RenderContext* rc, cl_mem heatMapBuffer, int width, int height, HeatMap* heatMap)
+{
+	std::vector<cl_uint> words((size_t)2 * width * height);
+	cl_int err = clEnqueueReadBuffer(rc->queue, heatMapBuffer, CL_TRUE, 0, sizeof(cl_uint) * words.size(), words.data(), 0, NULL, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError reading the heat map. Error code: %d\n", err);
+		return false;
+	}
+
+	createHeatMap(heatMap, width, height);
+	for (size_t i = 0; i < heatMap->tests.size(); ++i)
+	{
+		heatMap->tests[i] = words[2 * i];
+		heatMap->rays[i] = words[2 * i + 1];
+	}
+
+	return true;
+}
+
+
+// the file name part of a path (either kind of slash)
+const char* baseName(const char* path)
+{
+	const char* name = path;
+	for (const char* c = path; *c; ++c)
+	{
+		if (*c == '/' || *c == '\\') name = c + 1;
+	}
+
+	return name;
+}
+
+
 // read command line arguments, render, and write out BMP file
 int main(int argc, char* argv[])
 {
@@ -299,14 +394,35 @@ int main(int argc, char* argv[])
 	int height = 2048;
 	int samples = 1;
 	unsigned int blockSize = 512;
-	int workDiv = 1;
-	unsigned int curBlock = 0;
-	unsigned int numBW;
-	unsigned int numBH;
+	unsigned int tilesInFlight = 4;
 
 	// rendering options
 	int times = 1;
 	bool testMode = false;
+	bool wavefront = false;
+	bool specialise = true;
+	bool countRays = false;
+	bool hugePages = false;
+
+	// part of the image to render (x0 y0 x1 y1, from the bottom left) and range of its tiles, the whole image unless given (see FramePart.h)
+	bool renderRegion = false;
+	int region[4];
+	int firstTile = 0, lastTile = -1;
+	float lightEpsilon = 0.0f;
+
+	// where the false colour image of each pixel's work is written, with a CSV summary of each tile (NULL for none, see writeHeatMap)
+	const char* heatMapFilename = NULL;
+
+	// directory compiled kernel binaries are cached in (NULL disables the cache)
+	const char* programCacheDir = "ProgramCache";
+
+	// file the timings are appended to as a JSON or CSV line (NULL for none, see writeBenchmark)
+	const char* benchmarkFilename = NULL;
+
+	// reference image to compare the frame with (NULL for none), the most mean absolute error that passes, and where to write a diff image
+	const char* referenceFilename = NULL;
+	double compareThreshold = 0.0;
+	const char* diffFilename = NULL;
 
 	// default input / output filenames
 	const char* inputFilename = "Scenes/cornell.txt";
@@ -342,10 +458,71 @@ int main(int argc, char* argv[])
 		{
 			blockSize = atoi(argv[++i]);
 		}
+		else if (strcmp(argv[i], "-tilesInFlight") == 0)
+		{
+			tilesInFlight = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-lightEpsilon") == 0)
+		{
+			lightEpsilon = (float)atof(argv[++i]);
+		}
 		else if (strcmp(argv[i], "-testMode") == 0)
 		{
 			testMode = true;
 		}
+		else if (strcmp(argv[i], "-wavefront") == 0)
+		{
+			wavefront = true;
+		}
+		else if (strcmp(argv[i], "-genericKernel") == 0)
+		{
+			specialise = false;
+		}
+		else if (strcmp(argv[i], "-counters") == 0)
+		{
+			countRays = true;
+		}
+		else if (strcmp(argv[i], "-heatmap") == 0)
+		{
+			heatMapFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-region") == 0)
+		{
+			renderRegion = true;
+			for (int k = 0; k < 4; ++k) region[k] = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-tiles") == 0)
+		{
+			if (!parseTileRange(argv[++i], &firstTile, &lastTile)) return -1;
+		}
+		else if (strcmp(argv[i], "-hugePages") == 0)
+		{
+			hugePages = true;
+		}
+		else if (strcmp(argv[i], "-programCache") == 0)
+		{
+			programCacheDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "-noProgramCache") == 0)
+		{
+			programCacheDir = NULL;
+		}
+		else if (strcmp(argv[i], "-benchmark") == 0)
+		{
+			benchmarkFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-compare") == 0)
+		{
+			referenceFilename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-compareThreshold") == 0)
+		{
+			compareThreshold = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-compareDiff") == 0)
+		{
+			diffFilename = argv[++i];
+		}
 		else
 		{
 			fprintf(stderr, "unknown argument: %s\n", argv[i]);
@@ -353,316 +530,264 @@ int main(int argc, char* argv[])
 	}
 
 	// nasty (and fragile) kludge to make an ok-ish default output filename (can be overriden with "-output" command line option)
-	sprintf(outputFilenameBuffer, "Outputs/%s_%dx%dx%d_%s.bmp", (strrchr(inputFilename, '/') + 1), width, height, samples, (strrchr(argv[0], '\\') + 1));
+	sprintf(outputFilenameBuffer, "Outputs/%s_%dx%dx%d_%s.bmp", baseName(inputFilename), width, height, samples, baseName(argv[0]));
 
 	// read scene file
+	Timer loadTimer;
 	Scene scene;
 	if (!init(inputFilename, scene))
 	{
 		fprintf(stderr, "Failure when reading the Scene file.\n");
 		return -1;
 	}
+	loadTimer.end();
+	int loadTime = loadTimer.getMilliseconds();
 
+	// everything timed is also kept for -benchmark
+	Benchmark benchmark;
+	resetBenchmark(&benchmark);
+	benchmark.loadMs = loadTimer.getMillisecondsExact();
 
-	// display info about the current scene
-	//outputInfo(&scene);
-
-	Timer timer;																						// create timer
-
-	// OpenCL setup code goes here
-
-	// first time and total time taken to render all runs (used to calculate average)
-	int firstTime = 0;
-	int totalTime = 0;
-	int samplesRendered = 0;
-	for (int i = 0; i < times; i++)
-	{
-		if (i > 0) timer.start();
-
-		// OpenCL execution code replaces this call to render()
-
-		// cl variables
-		cl_int err;
-		cl_platform_id platform;
-		cl_device_id device;
-		cl_context context;
-		cl_command_queue queue;
-		cl_program program;
-		cl_kernel kernel;
-		cl_mem clBufferOut;
-		cl_mem clbufferInMaterial;
-		cl_mem clbufferInLight;
-		cl_mem clbufferInSphere;
-		cl_mem clbufferInBox;
-		cl_mem clbufferInOut;
-
-
-		unsigned int numBlocksHigh = ((height - 1) / (blockSize + 1));
-		unsigned int numBlocksWide = ((width - 1) / (blockSize + 1));
+	// build the acceleration structures (timed separately from parsing the file)
+	loadTimer.start();
+	buildBVH(&scene);
+	buildLightTree(&scene);
+	loadTimer.end();
+	int bvhTime = loadTimer.getMilliseconds();
+	benchmark.bvhMs = loadTimer.getMillisecondsExact();
+	printf("scene load time: %dms, BVH build time: %dms (%u nodes, %u light nodes)\n", loadTime, bvhTime, scene.numBvhNodes, scene.numLightNodes);
 
-		numBlocksWide++;
-		numBlocksHigh++;
+	// lights may be skipped at an intersection as long as they add up to no more than this (0 keeps the image exact)
+	scene.lightCullEpsilon = lightEpsilon;
 
-		if ((width % blockSize) != 0) {
-			//numBlocksWide++;
-		}
-		if ((height % blockSize) != 0) {
-			//numBlocksHigh++;
-		}
-
-		unsigned int totalBlocks = (numBlocksHigh) * (numBlocksWide);
-
-		unsigned int jobSizeX = blockSize;
-		unsigned int jobSizeY = blockSize;
 
-		for (int j = 0; j < totalBlocks; ++j) {
-
-			// rendering a width x height image
+	// display info about the current scene
+	//outputInfo(&scene);
 
-			size_t workOffset[] = { 0, 0 };
+	// the tiles of the image (or of the part of it given by -region and -tiles) that this run renders
+	FramePart framePart;
+	if (!createFramePart(&framePart, width, height, blockSize, renderRegion ? region : NULL, firstTile, lastTile))
+	{
+		return -1;
+	}
+	bool wholeFrame = isWholeFrame(&framePart);
 
-			//_putenv_s("CUDA_CACHE_DISABLE", "1");
+	// the wavefront kernels render whole rows, and a part is compared once it has been merged with the rest of the frame
+	if (!wholeFrame && wavefront)
+	{
+		fprintf(stderr, "part of the image is rendered in tiles\n");
+		wavefront = false;
+	}
+	if (!wholeFrame && referenceFilename != NULL)
+	{
+		fprintf(stderr, "only whole frames are compared with a reference, compare the merged image\n");
+		referenceFilename = NULL;
+	}
 
-			// get the platform
-			err = clGetPlatformIDs(1, &platform, NULL);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clGetPlatformIDs. Error code: %d\n", err);
-				exit(1);
-			}
+	Timer timer;																						// create timer
 
-			// get the device
-			err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
-			if (err != CL_SUCCESS) {
-				printf("Couldn't find any devices\n");
-				exit(1);
-			}
+	// OpenCL setup (platform, device, context, queue, program and kernel) is done once and shared by every tile and run
+	// the program is built for this scene's counts, material types and sample count unless -genericKernel is given
+	// and with the ray counters compiled in for -counters, and the per pixel counts kept for -heatmap (see RayCounters.cl)
+	// the work of the wavefront kernels isn't kept pixel by pixel, so the heat map is made with the render kernel
+	if (heatMapFilename != NULL && wavefront)
+	{
+		fprintf(stderr, "the heat map is made with the render kernel\n");
+		wavefront = false;
+	}
 
-			//create cl context
-			context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
-			if (err != CL_SUCCESS) {
-				printf("Couldn't create a context\n");
-				exit(1);
-			}
+	char buildOptions[256] = "";
+	if (specialise) sceneBuildOptions(&scene, samples, buildOptions);
+	if (countRays || heatMapFilename != NULL) strcat(buildOptions, specialise ? " -DRAY_COUNTERS" : "-DRAY_COUNTERS");
+	if (heatMapFilename != NULL) strcat(buildOptions, " -DHEATMAP");
+	printf("kernel: %s\n", specialise ? buildOptions : (countRays || heatMapFilename != NULL) ? "generic, counted" : "generic");
 
-			// create a commande queue
-			queue = clCreateCommandQueue(context, device, 0, &err);
-			if (err != CL_SUCCESS) {
-				printf("Couldn't create the command queue\n");
-				exit(1);
-			}
+	RenderContext rc;
+	if (!createRenderContext(&rc, "Stage5/Render.cl", buildOptions[0] ? buildOptions : NULL, programCacheDir, benchmarkFilename != NULL))
+	{
+		exit(1);
+	}
 
-			// use load source to load the main cl file
-			program = clLoadSource(context, "Stage5/Render.cl", &err);
-			if (err != CL_SUCCESS) {
-				printf("Couldn't load/create the program\n");
-				exit(1);
-			}
+	timer.end();
+	int setupTime = timer.getMilliseconds();															// record setup time
+	benchmark.setupMs = timer.getMillisecondsExact();
 
-			// build the program and check for any errors
-			err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-			if (err != CL_SUCCESS) {
-				char* program_log;
-				size_t log_size;
-
-				clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-				program_log = (char*)malloc(log_size + 1);
-				program_log[log_size] = '\0';
-				clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size + 1, program_log, NULL);
-				printf("%s\n", program_log);
-				free(program_log);
-				exit(1);
-			}
+	// copy the scene to the device once, it stays resident for every tile and run
+	timer.start();
+	SceneBuffers sceneBuffers;
+	if (!uploadScene(&rc, &scene, &sceneBuffers))
+	{
+		exit(1);
+	}
 
-			// create the kernel and run the "render" function
-			kernel = clCreateKernel(program, "render", &err);
-			if (err != CL_SUCCESS) {
-				printf("Couldn't create the kernel\n");
-				exit(1);
-			}
+	timer.end();
+	int uploadTime = timer.getMilliseconds();															// record upload time
+	benchmark.uploadMs = timer.getMillisecondsExact();
 
-			// set the out buffer
-			clBufferOut = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(*out) * width * height, out, &err);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clCreateBufferIn. Error code: %d\n", err);
-				exit(1);
-			}
+	// one device image for the whole frame, every tile renders straight into its own region of it
+	cl_int err;
+	cl_mem clBufferOut = clCreateBuffer(rc.context, CL_MEM_WRITE_ONLY, sizeof(unsigned int) * width * height, NULL, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError calling clCreateBufferIn. Error code: %d\n", err);
+		exit(1);
+	}
 
+	// set the ninth argument to be the out buffer
+	err = clSetKernelArg(rc.kernel, 8, sizeof(clBufferOut), &clBufferOut);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError calling clSetKernelArg2. Error code: %d\n", err);
+		exit(1);
+	}
 
+	// the frame's ray counts, low and high word of each (the kernels only add to them when built with -DRAY_COUNTERS)
+	cl_mem clRayCounters = clCreateBuffer(rc.context, CL_MEM_READ_WRITE, sizeof(cl_uint) * 2 * NUM_RAY_COUNTERS, NULL, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError creating the ray counter buffer. Error code: %d\n", err);
+		exit(1);
+	}
 
-			// data to pass through the kernel
-			struct kernelPass data = { samples,
-				int(testMode),
-				blockSize,
-				width,
-				height,
-				j,
-				numBlocksWide,
-				numBlocksHigh,
-				{ scene.cameraPosition.x, scene.cameraPosition.y, scene.cameraPosition.z },
-				scene.cameraRotation,
-				scene.cameraFieldOfView,
-				scene.exposure,
-				scene.skyboxMaterialId,
-				scene.numMaterials,
-				scene.numLights,
-				scene.numSpheres,
-				scene.numBoxes };
-
-			// create buffer for material container
-			clbufferInMaterial = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(*scene.materialContainer) * scene.numMaterials, scene.materialContainer, &err);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clCreateBufferIn1. Error code: %d\n", err);
-				exit(1);
-			}
+	err = clSetKernelArg(rc.kernel, 9, sizeof(clRayCounters), &clRayCounters);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError calling clSetKernelArg10. Error code: %d\n", err);
+		exit(1);
+	}
 
-			// create buffer for light container
-			clbufferInLight = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(*scene.lightContainer) * scene.numLights, scene.lightContainer, &err);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clCreateBufferIn1. Error code: %d\n", err);
-				exit(1);
-			}
+	// each pixel's tests and rays for the heat map (only written when built with -DHEATMAP, so otherwise it is a token buffer)
+	// it covers the whole frame but only the part's pixels are rendered, so the rest are zeroed rather than left as whatever the device had there
+	HeatMap heatMap;
+	const size_t heatMapSize = sizeof(cl_uint) * 2 * (heatMapFilename != NULL ? (size_t)width * height : 1);
+	cl_mem clHeatMap = clCreateBuffer(rc.context, CL_MEM_READ_WRITE, heatMapSize, NULL, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError creating the heat map buffer. Error code: %d\n", err);
+		exit(1);
+	}
 
-			// make sure that the sphere buffer does not have size zero
-			int temp = scene.numSpheres;
-			if (scene.numSpheres == 0) {
-				temp = 1;
-			}
+	const cl_uint heatMapZero = 0;
+	err = clEnqueueFillBuffer(rc.queue, clHeatMap, &heatMapZero, sizeof(heatMapZero), 0, heatMapSize, 0, NULL, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError clearing the heat map buffer. Error code: %d\n", err);
+		exit(1);
+	}
 
-			// set sphere buffer
-			clbufferInSphere = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Sphere) * temp, scene.sphereContainer, &err);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clCreateBufferIn1. Error code: %d\n", err);
-				exit(1);
-			}
+	err = clSetKernelArg(rc.kernel, 10, sizeof(clHeatMap), &clHeatMap);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError calling clSetKernelArg11. Error code: %d\n", err);
+		exit(1);
+	}
 
-			// make sure that the box buffer does not have size zero
-			temp = scene.numBoxes;
-			if (scene.numBoxes == 0) {
-				temp = 1;
-			}
+	// the host's copy of the frame is sized for the job, every row aligned (the device's rows aren't padded)
+	// a part of the image only needs room for the part on the host, the device renders into a whole frame's buffer
+	FrameBuffer frameBuffer;
+	if (!createFrameBuffer(&frameBuffer, framePart.imageX1 - framePart.imageX0, framePart.imageY1 - framePart.imageY0, hugePages))
+	{
+		exit(1);
+	}
+	frame = frameBuffer.view;
 
-			// set box buffer
-			clbufferInBox = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Box) * temp, scene.boxContainer, &err);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clCreateBufferIn1. Error code: %d\n", err);
-				exit(1);
-			}
+	// split the image into blockSize x blockSize tiles, keeping tilesInFlight of them queued on the device at once
+	TilePipeline pipeline;
+	createTilePipeline(&pipeline, width, height, blockSize, tilesInFlight, &framePart);
 
-			// set the first argument to be the kernelPass data struct
-			err = clSetKernelArg(kernel, 0, sizeof(kernelPass), &data);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clSetKernelArg1. Error code: %d\n", err);
-				exit(1);
-			}
+	// or follow every path of a batch of rows a bounce at a time with the wavefront kernels
+	WavefrontPipeline wavefrontPipeline;
+	if (wavefront)
+	{
+		if (!createWavefrontPipeline(&wavefrontPipeline, &rc, &sceneBuffers, width, height, samples, scene.numLights, clRayCounters))
+		{
+			exit(1);
+		}
+		printf("wavefront kernels: %u rows per batch, %u paths shaded per launch\n", wavefrontPipeline.rowsPerBatch, wavefrontPipeline.pathsPerShade);
+	}
 
-			// set the second argument to be the material buffer
-			err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &clbufferInMaterial);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clSetKernelArg2. Error code: %d\n", err);
-				exit(1);
-			}
+	// the first run writes the output file band by band as tiles finish, overlapping the write with rendering (whole frames only)
+	BmpStream outputStream;
+	bool streamOutput = wholeFrame && open_bmp_stream(&outputStream, outputFilename, width, height);
 
-			// set the third argument to be the light buffer
-			err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &clbufferInLight);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clSetKernelArg2. Error code: %d\n", err);
-				exit(1);
-			}
+	// first time and total time taken to render all runs (used to calculate average)
+	int firstTime = 0;
+	int totalTime = 0;
+	int samplesRendered = 0;
+	RayCounters rayCounters;
+	for (int i = 0; i < times; i++)
+	{
+		if (countRays && !clearDeviceRayCounters(&rc, clRayCounters))
+		{
+			exit(1);
+		}
 
-			// set the fourth argument to be the sphere buffer
-			err = clSetKernelArg(kernel, 3, sizeof(cl_mem), &clbufferInSphere);
-			if (err != CL_SUCCESS)
-			{
-				printf("\nError calling clSetKernelArg2. Error code: %d\n", err);
-				exit(1);
-			}
+		timer.start();
+
+		// data to pass through the kernel (the same for every tile, so camera or exposure changes only touch this argument)
+		struct kernelPass data = { samples,
+			int(testMode),
+			width,
+			height,
+			{ scene.cameraPosition.x, scene.cameraPosition.y, scene.cameraPosition.z },
+			scene.cameraRotation,
+			scene.cameraFieldOfView,
+			scene.exposure,
+			scene.skyboxMaterialId,
+			scene.numMaterials,
+			scene.numLights,
+			scene.numSpheres,
+			scene.numBoxes,
+			scene.lightCullEpsilon };
+
+		// set the first argument to be the kernelPass data struct
+		err = clSetKernelArg(rc.kernel, 0, sizeof(kernelPass), &data);
+		if (err != CL_SUCCESS)
+		{
+			printf("\nError calling clSetKernelArg1. Error code: %d\n", err);
+			exit(1);
+		}
 
-			// set the fith argument to be the box buffer
-			err = clSetKernelArg(kernel, 4, sizeof(cl_mem), &clbufferInBox);
-			if (err != CL_SUCCESS)
+		if (wavefront)
+		{
+			for (int k = 0; k < WavefrontPipeline::NUM_KERNELS; ++k)
 			{
-				printf("\nError calling clSetKernelArg2. Error code: %d\n", err);
-				exit(1);
+				err = clSetKernelArg(wavefrontPipeline.kernels[k], 0, sizeof(kernelPass), &data);
+				if (err != CL_SUCCESS)
+				{
+					printf("\nError calling clSetKernelArg1. Error code: %d\n", err);
+					exit(1);
+				}
 			}
 
-
-			// set the sixth argument to be the out buffer
-			err = clSetKernelArg(kernel, 5, sizeof(clBufferOut), &clBufferOut);
-			if (err != CL_SUCCESS)
+			if (!renderWavefront(&wavefrontPipeline, &rc, clBufferOut, &frame, (i == 0 && streamOutput) ? &outputStream : NULL))
 			{
-				printf("\nError calling clSetKernelArg2. Error code: %d\n", err);
-				exit(1);
-			}
-
-			// get default x and y jobsize
-			jobSizeX = blockSize;
-			jobSizeY = blockSize;
-
-			// check if last block to do on the x axis
-			if ((j != 0) && ((j % (numBlocksWide)) == numBlocksWide - 1) && (width % blockSize != 0)) {
-				jobSizeX = width % blockSize;
-			}
-
-
-			// check if last block to do on the y axis
-			if ((j != 0) && (totalBlocks - j <= numBlocksWide) && height % blockSize != 0) {
-				jobSizeY = height % blockSize;
-			}
-
-			// set the worksize
-			size_t workSize[] = { jobSizeX, jobSizeY };
-
-
-			// pass the worksize and workoffset
-			err = clEnqueueNDRangeKernel(queue, kernel, 2, workOffset, workSize, NULL, 0, NULL, NULL);
-			if (err != CL_SUCCESS) {
-				printf("Couldn't enqueue the kernel execution command\n");
-				exit(1);
-			}
-
-			// read out the values to *out
-			clEnqueueReadBuffer(queue, clBufferOut, CL_TRUE, 0, sizeof(*out) * width * height, out, 0, NULL, NULL);
-			if (err != CL_SUCCESS) {
-				printf("Couldn't enqueue the read buffer command\n");
 				exit(1);
 			}
+		}
+		else if (!renderTiles(&pipeline, &rc, clBufferOut, &frame, (i == 0 && streamOutput) ? &outputStream : NULL))
+		{
+			exit(1);
+		}
 
-			// pass the out into final array since the out values do persist between runs
-			for (int k = 0; k < (width * height); k++) {
-
-				if (out[k] != 0) {
-
-					out2[k] = out[k];
-
-				}
-
-			}
-
-			// clean up
-
-			clReleaseMemObject(clBufferOut);
-			clReleaseMemObject(clbufferInMaterial);
-			clReleaseMemObject(clbufferInLight);
-			clReleaseMemObject(clbufferInSphere);
-			clReleaseMemObject(clbufferInBox);
-			clReleaseCommandQueue(queue);
-			clReleaseProgram(program);
-			clReleaseKernel(kernel);
-			clReleaseContext(context);
+		timer.end();																					// record end time
 
+		// device time of the kernels and readbacks is only measured for -benchmark (profiling queues)
+		const DeviceTimes& deviceTimes = wavefront ? wavefrontPipeline.times : pipeline.times;
+		BenchmarkRun run = { timer.getMillisecondsExact(), BENCHMARK_NOT_MEASURED, BENCHMARK_NOT_MEASURED };
+		if (rc.profiling)
+		{
+			run.kernelMs = deviceTimes.kernelMs;
+			run.readbackMs = deviceTimes.readbackMs;
 		}
+		benchmark.runs.push_back(run);
 
+		// the counts are read back after the run is timed
+		if (countRays && !readDeviceRayCounters(&rc, clRayCounters, &rayCounters))
+		{
+			exit(1);
+		}
 
-		timer.end();																					// record end time
 		if (i > 0)
 		{
 			totalTime += timer.getMilliseconds();														// record total time taken
@@ -673,7 +798,25 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	// output timing information (first run, times run and average)
+	// the last run's work of each pixel
+	if (heatMapFilename != NULL && !readHeatMap(&rc, clHeatMap, width, height, &heatMap))
+	{
+		exit(1);
+	}
+
+	releaseTilePipeline(&pipeline);
+	if (wavefront)
+	{
+		releaseWavefrontPipeline(&wavefrontPipeline);
+	}
+	clReleaseMemObject(clBufferOut);
+	clReleaseMemObject(clRayCounters);
+	clReleaseMemObject(clHeatMap);
+	releaseSceneBuffers(&sceneBuffers);
+	releaseRenderContext(&rc);
+
+	// output timing information (setup, first run, times run and average)
+	printf("OpenCL setup time: %dms, scene upload time: %dms\n", setupTime, uploadTime);
 	if (times > 1)
 	{
 		printf("first run time: %dms, subsequent average time taken (%d run(s)): %.1fms\n", firstTime, times - 1, totalTime / (float)(times - 1));
@@ -682,6 +825,70 @@ int main(int argc, char* argv[])
 	{
 		printf("first run time: %dms, subsequent average time taken (%d run(s)): N/A\n", firstTime, times - 1);
 	}
-	// output BMP file
-	write_bmp(outputFilename, out2, width, height, width);
+
+	// rays and tests of the last run, and the rate they were traced at
+	if (countRays && !benchmark.runs.empty()) outputRayCounters(&rayCounters, benchmark.runs.back().totalMs);
+
+	// where the last run's work went, by pixel and by tile
+	if (heatMapFilename != NULL && !writeHeatMap(&heatMap, &framePart, heatMapFilename))
+	{
+		return 1;
+	}
+
+	// output BMP file (already written during the first run unless it couldn't be opened then)
+	// or the part's image and where it goes, for MergeParts
+	timer.start();
+	if (streamOutput)
+	{
+		close_bmp_stream(&outputStream);
+	}
+	else if (wholeFrame)
+	{
+		write_bmp(outputFilename, frame.pixels, width, height, frame.stride);
+	}
+	else if (!writeFramePart(&framePart, &frame, outputFilename))
+	{
+		return 1;
+	}
+	timer.end();
+	benchmark.writeMs = timer.getMillisecondsExact();
+
+	// compare the frame with the reference straight from memory, the run fails if it's too far off
+	if (referenceFilename != NULL)
+	{
+		ImageDifference difference;
+		if (!compareWithReference(frame.pixels, width, height, frame.stride, referenceFilename, diffFilename, &difference))
+		{
+			return 1;
+		}
+
+		benchmark.mae = difference.mae;
+		benchmark.maxDiff = difference.maxDiff;
+		benchmark.passed = difference.mae <= compareThreshold;
+		printf("compared with %s: MAE %.4f (%.6f normalised), PSNR %.2f dB, max difference %d, %u pixels differ: %s\n", referenceFilename,
+			difference.mae, difference.mae / 255.0, difference.psnr, difference.maxDiff, difference.pixelsDifferent, benchmark.passed ? "passed" : "FAILED");
+	}
+
+	// one machine readable line with what was rendered and every timing
+	if (benchmarkFilename != NULL)
+	{
+		benchmark.program = baseName(argv[0]);
+		benchmark.scene = inputFilename;
+		benchmark.width = width;
+		benchmark.height = height;
+		benchmark.samples = samples;
+		benchmark.blockSize = blockSize;
+		benchmark.device = rc.deviceName;
+		benchmark.counters = countRays ? &rayCounters : NULL;
+		benchmark.mode = wavefront ? (specialise ? "wavefront, specialised" : "wavefront, generic") : (specialise ? "tiles, specialised" : "tiles, generic");
+		if (!writeBenchmark(&benchmark, benchmarkFilename))
+		{
+			return 1;
+		}
+	}
+
+	releaseFrameBuffer(&frameBuffer);
+
+	// a failed comparison fails the run (after everything has been written)
+	return benchmark.passed ? 0 : 1;
 }
@@ -1,4 +1,8 @@
 
+// the wavefront kernels split each path's work between several kernels, contracting a multiply and add into a
+// fused multiply add in one kernel but not another would give different colours to the single render kernel
+#pragma OPENCL FP_CONTRACT OFF
+
 #include "Stage5/Scene.cl"
 #include "Stage5/Constants.cl"
 #include "Stage5/Intersection.cl"
@@ -141,15 +145,17 @@ Ray calculateRefraction(const Ray* viewRay, const Intersection* intersect, float
 
 
 // follow a single ray until it's final destination (or maximum number of steps reached)
-Colour traceRay(const Scene* scene, Ray viewRay)
+// the reflected and refracted rays traced and the number of rays the sample took are counted into the scene's counters
+Colour traceRay(const Scene* scene, Ray viewRay, ShadowCache* shadowCache)
 {
 	Colour output = { 0.0f, 0.0f, 0.0f }; 								// colour value to be output
 	float currentRefractiveIndex = DEFAULT_REFRACTIVE_INDEX;		// current refractive index
 	float coef = 1.0f;												// amount of ray left to transmit
 	Intersection intersect;											// properties of current intersection
+	int level;														// rays traced so far, less one
 
 																	// loop until reached maximum ray cast limit (unless loop is broken out of)
-	for (int level = 0; level < MAX_RAYS_CAST; ++level)
+	for (level = 0; level < MAX_RAYS_CAST; ++level)
 	{
 		// check for intersections between the view ray and any of the objects in the scene
 		// exit the loop if no intersection found
@@ -160,27 +166,33 @@ Colour traceRay(const Scene* scene, Ray viewRay)
 
 
 		// apply the diffuse and specular lighting 
-		if (!intersect.insideObject) output += coef * applyLighting(scene, &viewRay, &intersect);
+		if (!intersect.insideObject) output += coef * applyLighting(scene, &viewRay, &intersect, shadowCache);
 
 		// if object has reflection or refraction component, adjust the view ray and coefficent of calculation and continue looping
+		// (the new ray is only counted if there is a bounce left to trace it)
 		if (intersect.material->reflection)
 		{
 			viewRay = calculateReflection(&viewRay, &intersect);
 			coef *= intersect.material->reflection;
+			if (level + 1 < MAX_RAYS_CAST) COUNT_RAYS(scene->rayCounters, COUNT_REFLECTION_RAYS, 1);
 		}
 		else if (intersect.material->refraction)
 		{
 			viewRay = calculateRefraction(&viewRay, &intersect, &currentRefractiveIndex);
 			coef *= intersect.material->refraction;
+			if (level + 1 < MAX_RAYS_CAST) COUNT_RAYS(scene->rayCounters, COUNT_REFRACTION_RAYS, 1);
 		}
 		else
 		{
 			// if no reflection or refraction, then finish looping (cast no more rays)
+			COUNT_RAYS(scene->rayCounters, COUNT_DEPTH + level, 1);
 			return output;
 		}
 
 	}
 
+	COUNT_RAYS(scene->rayCounters, COUNT_DEPTH + min(level, MAX_RAYS_CAST - 1), 1);
+
 	// if the calculation coefficient is non-zero, read from the environment map
 
 	if (coef > 0.0f)
@@ -198,12 +210,8 @@ Colour traceRay(const Scene* scene, Ray viewRay)
 typedef struct kernelPass {
 	unsigned int aaLevel;					// aaLevel
 	int testMode;							// testMode
-	unsigned int i;							// total workload division
-	unsigned int totWidth;
-	unsigned int totHeight;
-	unsigned int curBlock;							// total workload division
-	unsigned int numBW;
-	unsigned int numBH;
+	unsigned int totWidth;					// width of the whole image
+	unsigned int totHeight;					// height of the whole image
 	float3 cameraPositions;					// camera location
 	float cameraRotation;					// direction camera points
 	float cameraFieldOfView;				// field of view for the camera
@@ -215,62 +223,130 @@ typedef struct kernelPass {
 	unsigned int numLights;					// numLight
 	unsigned int numSpheres;				// numSphere
 	unsigned int numBoxes;					// numBoxes
+	float lightCullEpsilon;					// error budget for lights skipped at an intersection
 }kernelPass;
 
-__kernel void render(struct kernelPass data, __global struct Material* materialContainer, __global struct Light* lightContainer, __global struct Sphere* sphereContainer, __global struct Box* boxContainer, __global unsigned int* out)
-{
-	// get the j (x) and i (y) values from the global ID
-	unsigned int i = get_global_id(0);
-	unsigned int j = get_global_id(1);
+// samples per pixel side, a constant in a scene specialised build (see Scene.cl)
+#ifdef SCENE_SPECIALISED
+#define PASS_AA_LEVEL(data) SCENE_AA_LEVEL
+#else
+#define PASS_AA_LEVEL(data) ((data).aaLevel)
+#endif
+
 
+// link the kernel's scene data and containers together into a scene struct (every kernel takes them as its first eight arguments)
+Scene makeScene(const struct kernelPass* data, __global struct Material* materialContainer, __global struct Light* lightContainer, __global struct Sphere* sphereContainer, __global struct Box* boxContainer, __global struct BVHNode* bvhNodeContainer, __global unsigned int* bvhPrimitiveContainer, __global struct LightNode* lightNodeContainer)
+{
 	// Create new scene struct to link data too
 	Scene clScene;
 
-	//set aaLevel and testMode 
-	unsigned int aaLevel = data.aaLevel;
-	int testMode = data.testMode;
-
 	// set cl scene camera positions to the scene camera positions passed through to the kernel.
-	clScene.cameraPosition.x = data.cameraPositions.x;
-	clScene.cameraPosition.y = data.cameraPositions.y;
-	clScene.cameraPosition.z = data.cameraPositions.z;
+	clScene.cameraPosition.x = data->cameraPositions.x;
+	clScene.cameraPosition.y = data->cameraPositions.y;
+	clScene.cameraPosition.z = data->cameraPositions.z;
 
 	// set other struct data and containers through to the cl scene struct
-	clScene.cameraRotation = data.cameraRotation;
-	clScene.cameraFieldOfView = (data.cameraFieldOfView);
-	clScene.exposure = data.exposure;
-	clScene.skyboxMaterialId = data.skyboxMaterialId;
-	clScene.numMaterials = data.numMaterials;
-	clScene.numLights = data.numLights;
-	clScene.numSpheres = data.numSpheres;
-	clScene.numBoxes = data.numBoxes;
+	clScene.cameraRotation = data->cameraRotation;
+	clScene.cameraFieldOfView = (data->cameraFieldOfView);
+	clScene.exposure = data->exposure;
+	clScene.skyboxMaterialId = data->skyboxMaterialId;
+	clScene.numMaterials = data->numMaterials;
+	clScene.numLights = data->numLights;
+	clScene.numSpheres = data->numSpheres;
+	clScene.numBoxes = data->numBoxes;
 
 	clScene.materialContainer = materialContainer;
 	clScene.lightContainer = lightContainer;
 	clScene.sphereContainer = sphereContainer;
 	clScene.boxContainer = boxContainer;
+	clScene.bvhNodeContainer = bvhNodeContainer;
+	clScene.bvhPrimitiveContainer = bvhPrimitiveContainer;
+	clScene.lightNodeContainer = lightNodeContainer;
+	clScene.lightCullEpsilon = data->lightCullEpsilon;
+
+	// a kernel that counts rays points this at its own counters
+	clScene.rayCounters = NULL;
+
+	return clScene;
+}
+
+
+// angle between each successive ray cast (per pixel, anti-aliasing uses a fraction of this)
+float primaryStepSize(const Scene* scene, unsigned int width)
+{
+	return 1.0f / (0.5f * width / tan(PIOVER180 * 0.5f * scene->cameraFieldOfView));
+}
+
+
+// view ray through sub-location (fragmentx, fragmenty) of the image
+Ray primaryRay(const Scene* scene, float dirStepSize, float fragmentx, float fragmenty)
+{
+	// direction of default forward facing ray
+	Vector dir = { fragmentx * dirStepSize, (fragmenty * dirStepSize), 1.0f };
+
+	// rotated direction of ray
+	Vector rotatedDir = {
+		dir.x * cos(scene->cameraRotation) - dir.z * sin(scene->cameraRotation),
+		dir.y,
+		dir.x * sin(scene->cameraRotation) + dir.z * cos(scene->cameraRotation) };
+
+	// view ray starting from camera position and heading in rotated (normalised) direction
+	Ray viewRay = { scene->cameraPosition, normalize(rotatedDir) };
+
+	return viewRay;
+}
+
+
+// exposed 8 bit per channel colour of a pixel
+unsigned int packColour(Colour output, float exposure)
+{
+	return ((unsigned char)(255 * (min(1.0f - exp(output.z * exposure), 1.0f))) << 16) +
+		((unsigned char)(255 * (min(1.0f - exp(output.y * exposure), 1.0f))) << 8) +
+		((unsigned char)(255 * (min(1.0f - exp(output.x * exposure), 1.0f))) << 0);
+}
+
+
+__kernel void render(struct kernelPass data, __global struct Material* materialContainer, __global struct Light* lightContainer, __global struct Sphere* sphereContainer, __global struct Box* boxContainer, __global struct BVHNode* bvhNodeContainer, __global unsigned int* bvhPrimitiveContainer, __global struct LightNode* lightNodeContainer, __global unsigned int* out, __global unsigned int* rayCounters, __global unsigned int* heatMap)
+{
+	// the work-group's counts are added up here before going to rayCounters (see RayCounters.cl)
+	__local unsigned int groupCounts[2 * NUM_RAY_COUNTERS];
+
+	// get the i (x) and j (y) pixel coordinates from the global ID (the tile's position comes in as the global work offset)
+	unsigned int i = get_global_id(0);
+	unsigned int j = get_global_id(1);
+
+	Scene clScene = makeScene(&data, materialContainer, lightContainer, sphereContainer, boxContainer, bvhNodeContainer, bvhPrimitiveContainer, lightNodeContainer);
+
+	// this work-item's ray and test counts
+	RayCounters rayCounts;
+	resetRayCounters(&rayCounts);
+	clScene.rayCounters = &rayCounts;
+
+	//set aaLevel and testMode 
+	unsigned int aaLevel = PASS_AA_LEVEL(data);
+	int testMode = data.testMode;
 
-	unsigned int blockSize = data.i;
 	unsigned int width = data.totWidth;
 	unsigned int height = data.totHeight;
-	unsigned int curBlock = data.curBlock;
-	unsigned int numBW = data.numBW;
-	unsigned int numBH = data.numBH;
 
 
 	// angle between each successive ray cast (per pixel, anti-aliasing uses a fraction of this)
-	float dirStepSize = 1.0f / (0.5f * width / tan(PIOVER180 * 0.5f * clScene.cameraFieldOfView));
+	float dirStepSize = primaryStepSize(&clScene, width);
 
 
 	// count of samples rendered
 	unsigned int samplesRendered = 0;
 
+	// occluders remembered across this pixel's samples
+	ShadowCache shadowCache;
+	resetShadowCache(&shadowCache);
+
 
 
 
 	// loop through all the pixels
-	int x = i - (width / 2) + ((curBlock % numBW) * blockSize);
-	int y = j - (height / 2) + ((curBlock / numBH) * blockSize);
+	int x = i - (width / 2);
+	int y = j - (height / 2);
 
 
 	Colour output = { 0.0f, 0.0f, 0.0f };
@@ -283,20 +359,10 @@ __kernel void render(struct kernelPass data, __global struct Material* materialC
 	{
 		for (float fragmenty = (float)y; fragmenty < y + 1.0f; fragmenty += sampleStep)
 		{
-			// direction of default forward facing ray
-			Vector dir = { fragmentx * dirStepSize, (fragmenty * dirStepSize), 1.0f };
-
-			// rotated direction of ray
-			Vector rotatedDir = {
-				dir.x * cos(clScene.cameraRotation) - dir.z * sin(clScene.cameraRotation),
-				dir.y,
-				dir.x * sin(clScene.cameraRotation) + dir.z * cos(clScene.cameraRotation) };
-
-			// view ray starting from camera position and heading in rotated (normalised) direction
-			Ray viewRay = { clScene.cameraPosition, normalize(rotatedDir) };
+			Ray viewRay = primaryRay(&clScene, dirStepSize, fragmentx, fragmenty);
 
 			// follow ray and add proportional of the result to the final pixel colour
-			output += sampleRatio * traceRay(&clScene, viewRay);
+			output += sampleRatio * traceRay(&clScene, viewRay, &shadowCache);
 
 			// count this sample
 			samplesRendered++;
@@ -307,9 +373,7 @@ __kernel void render(struct kernelPass data, __global struct Material* materialC
 	{
 
 		// set the out to be either white or black depending on if there is an intersect
-		unsigned int returnColour = ((unsigned char)(255 * (min(1.0f - exp(output.z * clScene.exposure), 1.0f))) << 16) +
-			((unsigned char)(255 * (min(1.0f - exp(output.y * clScene.exposure), 1.0f))) << 8) +
-			((unsigned char)(255 * (min(1.0f - exp(output.x * clScene.exposure), 1.0f))) << 0);
+		unsigned int returnColour = packColour(output, clScene.exposure);
 
 		// store colour (calculated from x,y coordinates) in image buffer 
 		out[((y + (height / 2)) * (width)+(x + (width / 2)))] = returnColour;
@@ -323,6 +387,19 @@ __kernel void render(struct kernelPass data, __global struct Material* materialC
 		//*out++ = output.convertToPixel(clScene->exposure);
 	}
 
+	// add this work-item's counts to the frame's
+	COUNT_RAYS(&rayCounts, COUNT_PRIMARY_RAYS, samplesRendered);
+	reduceRayCounters(&rayCounts, groupCounts, rayCounters);
+
+#ifdef HEATMAP
+	// and keep them as the pixel's work for the heat map (built with RAY_COUNTERS too): its tests, then its rays
+	unsigned int pixel = j * width + i;
+	heatMap[2 * pixel] = countedTests(&rayCounts);
+	heatMap[2 * pixel + 1] = countedRays(&rayCounts);
+#endif
 
 }
 
+
+// the same render split into a wavefront of kernels
+#include "Stage5/Wavefront.cl"
@@ -0,0 +1,116 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "RenderContext.h"
+
+// get the platform and device, create the context and queue, build the program and create the kernel
+bool createRenderContext(RenderContext* rc, const char* programFilename, const char* buildOptions, const char* programCacheDir, bool profiling)
+{
+	cl_int err;
+
+	// get the platform
+	err = clGetPlatformIDs(1, &rc->platform, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError calling clGetPlatformIDs. Error code: %d\n", err);
+		return false;
+	}
+
+	// get the device
+	err = clGetDeviceIDs(rc->platform, CL_DEVICE_TYPE_GPU, 1, &rc->device, NULL);
+	if (err == CL_DEVICE_NOT_FOUND)
+	{
+		// no GPU, fall back to whatever the platform has (eg. a CPU runtime such as PoCL)
+		err = clGetDeviceIDs(rc->platform, CL_DEVICE_TYPE_ALL, 1, &rc->device, NULL);
+	}
+	if (err != CL_SUCCESS)
+	{
+		printf("Couldn't find any devices\n");
+		return false;
+	}
+
+	if (clGetDeviceInfo(rc->device, CL_DEVICE_NAME, sizeof(rc->deviceName), rc->deviceName, NULL) != CL_SUCCESS)
+	{
+		strcpy(rc->deviceName, "unknown");
+	}
+
+	// create cl context
+	rc->context = clCreateContext(NULL, 1, &rc->device, NULL, NULL, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("Couldn't create a context\n");
+		return false;
+	}
+
+	// create the command queues
+	rc->profiling = profiling;
+	cl_command_queue_properties properties = profiling ? CL_QUEUE_PROFILING_ENABLE : 0;
+	rc->queue = clCreateCommandQueue(rc->context, rc->device, properties, &err);
+	if (err == CL_SUCCESS) rc->transferQueue = clCreateCommandQueue(rc->context, rc->device, properties, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("Couldn't create the command queue\n");
+		return false;
+	}
+
+	// load the main cl file and build it (or reuse a cached binary of it) and check for any errors
+	rc->program = clLoadProgramCached(rc->context, rc->device, programFilename, buildOptions, programCacheDir, &err);
+	if (rc->program == NULL)
+	{
+		printf("Couldn't load/create the program\n");
+		return false;
+	}
+	if (err != CL_SUCCESS)
+	{
+		char* program_log;
+		size_t log_size;
+
+		clGetProgramBuildInfo(rc->program, rc->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+		program_log = (char*)malloc(log_size + 1);
+		program_log[log_size] = '\0';
+		clGetProgramBuildInfo(rc->program, rc->device, CL_PROGRAM_BUILD_LOG, log_size + 1, program_log, NULL);
+		printf("%s\n", program_log);
+		free(program_log);
+		return false;
+	}
+
+	// create the kernel and run the "render" function
+	rc->kernel = clCreateKernel(rc->program, "render", &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("Couldn't create the kernel\n");
+		return false;
+	}
+
+	return true;
+}
+
+
+// time a finished command took on the device, from its event (0 if the queues aren't profiling)
+double eventMilliseconds(const RenderContext* rc, cl_event event)
+{
+	cl_ulong start, end;
+	if (!rc->profiling ||
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+		clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS)
+	{
+		return 0.0;
+	}
+
+	return (end - start) / 1000000.0;
+}
+
+
+// release everything created by createRenderContext
+void releaseRenderContext(RenderContext* rc)
+{
+	clReleaseKernel(rc->kernel);
+	clReleaseProgram(rc->program);
+	clReleaseCommandQueue(rc->transferQueue);
+	clReleaseCommandQueue(rc->queue);
+	clReleaseContext(rc->context);
+}
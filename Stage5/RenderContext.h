@@ -0,0 +1,39 @@
+#ifndef __RENDER_CONTEXT_H
+#define __RENDER_CONTEXT_H
+
+#include "LoadCL.h"
+
+// all of the OpenCL state needed to render, created once per process and reused for every tile and every run
+typedef struct RenderContext
+{
+	cl_platform_id platform;				// OpenCL platform
+	cl_device_id device;					// device the kernel runs on
+	char deviceName[128];					// name the device reports
+	cl_context context;						// context owning every buffer
+	cl_command_queue queue;					// queue kernels are enqueued on
+	cl_command_queue transferQueue;			// second in-order queue for reads, so they overlap with later kernels
+	cl_program program;						// built Render.cl program
+	cl_kernel kernel;						// "render" kernel
+	bool profiling;							// whether the queues time their commands (see eventMilliseconds)
+} RenderContext;
+
+// device time spent on a frame's commands, in milliseconds (only measured when the queues are profiling)
+typedef struct DeviceTimes
+{
+	double kernelMs;						// running kernels
+	double readbackMs;						// reading the image back
+} DeviceTimes;
+
+// get the platform and device, create the context and queue, build the program with buildOptions (may be NULL) and create the kernel
+// the program binary is cached in programCacheDir (NULL to always compile from source), one binary per set of build options
+// profiling creates the queues with CL_QUEUE_PROFILING_ENABLE, so the device time of each command can be read from its event
+// prints the reason and returns false if any step fails
+bool createRenderContext(RenderContext* rc, const char* programFilename, const char* buildOptions, const char* programCacheDir, bool profiling);
+
+// time a finished command took on the device, from its event (0 if the queues aren't profiling)
+double eventMilliseconds(const RenderContext* rc, cl_event event);
+
+// release everything created by createRenderContext
+void releaseRenderContext(RenderContext* rc);
+
+#endif // __RENDER_CONTEXT_H
@@ -1,5 +1,6 @@
 
 #include "Stage5/SceneObjects.cl"
+#include "Stage5/RayCounters.cl"
 
 
 typedef struct Scene
@@ -23,5 +24,34 @@ typedef struct Scene
 	__global Light* lightContainer;
 	__global Sphere* sphereContainer;
 	__global Box* boxContainer;
+
+	// bounding volume hierarchy over the spheres and boxes
+	__global BVHNode* bvhNodeContainer;
+	__global unsigned int* bvhPrimitiveContainer;
+
+	// tree of bounding boxes over the lights
+	__global LightNode* lightNodeContainer;
+
+	// most that all the lights applyLighting() skips at one intersection may add up to in a colour channel
+	float lightCullEpsilon;
+
+	// the work-item's ray and test counts (only counted into with -DRAY_COUNTERS, see RayCounters.cl)
+	RayCounters* rayCounters;
 } Scene;
 
+
+// the program can be built for one scene with its counts and material types as constants (SCENE_SPECIALISED and the values
+// set with -D build options by the host), so loops over objects a scene doesn't have and unused textures compile away
+// SCENE_MATERIAL_TYPES has bit n set if any material is of type n
+#ifdef SCENE_SPECIALISED
+#define SCENE_SPHERES(scene) SCENE_NUM_SPHERES
+#define SCENE_BOXES(scene) SCENE_NUM_BOXES
+#define SCENE_LIGHTS(scene) SCENE_NUM_LIGHTS
+#define SCENE_HAS_MATERIAL(type) ((SCENE_MATERIAL_TYPES >> (type)) & 1)
+#else
+#define SCENE_SPHERES(scene) ((scene)->numSpheres)
+#define SCENE_BOXES(scene) ((scene)->numBoxes)
+#define SCENE_LIGHTS(scene) ((scene)->numLights)
+#define SCENE_HAS_MATERIAL(type) 1
+#endif
+
@@ -0,0 +1,83 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include "SceneBuffers.h"
+
+// create a read only buffer holding a copy of a scene container
+// buffers are never created with size zero (scenes without spheres or boxes still get a one element buffer)
+static cl_mem createContainerBuffer(const RenderContext* rc, size_t elementSize, unsigned int count, void* data, const char* name)
+{
+	cl_int err;
+	cl_mem buffer;
+
+	if (count > 0)
+	{
+		buffer = clCreateBuffer(rc->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, elementSize * count, data, &err);
+	}
+	else
+	{
+		buffer = clCreateBuffer(rc->context, CL_MEM_READ_ONLY, elementSize, NULL, &err);
+	}
+
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError creating the %s buffer. Error code: %d\n", name, err);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+
+// create the device buffers, copy the scene containers, BVH and light tree into them and bind them to the render kernel (arguments 1 to 7)
+bool uploadScene(const RenderContext* rc, const Scene* scene, SceneBuffers* buffers)
+{
+	buffers->materialBuffer = createContainerBuffer(rc, sizeof(Material), scene->numMaterials, scene->materialContainer, "material");
+	buffers->lightBuffer = createContainerBuffer(rc, sizeof(Light), scene->numLights, scene->lightContainer, "light");
+	buffers->sphereBuffer = createContainerBuffer(rc, sizeof(Sphere), scene->numSpheres, scene->sphereContainer, "sphere");
+	buffers->boxBuffer = createContainerBuffer(rc, sizeof(Box), scene->numBoxes, scene->boxContainer, "box");
+	buffers->bvhNodeBuffer = createContainerBuffer(rc, sizeof(BVHNode), scene->numBvhNodes, scene->bvhNodeContainer, "BVH node");
+	buffers->bvhPrimitiveBuffer = createContainerBuffer(rc, sizeof(unsigned int), scene->numSpheres + scene->numBoxes, scene->bvhPrimitiveContainer, "BVH primitive");
+	buffers->lightNodeBuffer = createContainerBuffer(rc, sizeof(LightNode), scene->numLightNodes, scene->lightNodeContainer, "light node");
+
+	if (!buffers->materialBuffer || !buffers->lightBuffer || !buffers->sphereBuffer || !buffers->boxBuffer || !buffers->bvhNodeBuffer || !buffers->bvhPrimitiveBuffer || !buffers->lightNodeBuffer)
+	{
+		return false;
+	}
+
+	// kernel arguments stay set between enqueues, so the scene only needs binding once
+	return bindSceneBuffers(rc->kernel, buffers);
+}
+
+
+// set a kernel's arguments 1 to 7 to the scene buffers
+bool bindSceneBuffers(cl_kernel kernel, const SceneBuffers* buffers)
+{
+	cl_mem args[] = { buffers->materialBuffer, buffers->lightBuffer, buffers->sphereBuffer, buffers->boxBuffer, buffers->bvhNodeBuffer, buffers->bvhPrimitiveBuffer, buffers->lightNodeBuffer };
+	for (cl_uint i = 0; i < 7; ++i)
+	{
+		cl_int err = clSetKernelArg(kernel, i + 1, sizeof(cl_mem), &args[i]);
+		if (err != CL_SUCCESS)
+		{
+			printf("\nError calling clSetKernelArg%d. Error code: %d\n", i + 2, err);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+// release the device buffers
+void releaseSceneBuffers(SceneBuffers* buffers)
+{
+	clReleaseMemObject(buffers->materialBuffer);
+	clReleaseMemObject(buffers->lightBuffer);
+	clReleaseMemObject(buffers->sphereBuffer);
+	clReleaseMemObject(buffers->boxBuffer);
+	clReleaseMemObject(buffers->bvhNodeBuffer);
+	clReleaseMemObject(buffers->bvhPrimitiveBuffer);
+	clReleaseMemObject(buffers->lightNodeBuffer);
+}
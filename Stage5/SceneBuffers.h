@@ -0,0 +1,28 @@
+#ifndef __SCENE_BUFFERS_H
+#define __SCENE_BUFFERS_H
+
+#include "Scene.h"
+#include "RenderContext.h"
+
+// device copies of the scene containers, uploaded once and kept resident for every tile and run
+typedef struct SceneBuffers
+{
+	cl_mem materialBuffer;
+	cl_mem lightBuffer;
+	cl_mem sphereBuffer;
+	cl_mem boxBuffer;
+	cl_mem bvhNodeBuffer;
+	cl_mem bvhPrimitiveBuffer;
+	cl_mem lightNodeBuffer;
+} SceneBuffers;
+
+// create the device buffers, copy the scene containers, BVH and light tree into them and bind them to the render kernel (arguments 1 to 7)
+bool uploadScene(const RenderContext* rc, const Scene* scene, SceneBuffers* buffers);
+
+// set a kernel's arguments 1 to 7 to the scene buffers (every kernel in Render.cl takes the scene the same way)
+bool bindSceneBuffers(cl_kernel kernel, const SceneBuffers* buffers);
+
+// release the device buffers
+void releaseSceneBuffers(SceneBuffers* buffers);
+
+#endif // __SCENE_BUFFERS_H
@@ -45,4 +45,25 @@ typedef struct Box
 {
 	__declspec(align(16)) Point p1, p2;				// two points to define opposite corners of the box
 	unsigned int materialId;	// material id
-} Box;
\ No newline at end of file
+} Box;
+
+// node of the bounding volume hierarchy over the spheres and boxes
+// the tree is flattened into an array, the two children of an inner node are stored next to each other
+typedef struct BVHNode
+{
+	float boundsMin[3];			// corners of the box around everything below this node
+	unsigned int first;			// inner node: index of the first child, leaf: index of its first entry in the primitive list
+	float boundsMax[3];
+	unsigned int count;			// number of primitives in a leaf, 0 for an inner node
+} BVHNode;
+
+// node of the tree of bounding boxes over the lights, flattened the same way as the BVH
+// every node covers a run of consecutive lights, a leaf's lights are lightContainer[first] to lightContainer[first + count - 1]
+typedef struct LightNode
+{
+	float boundsMin[3];			// corners of the box around the positions of the lights below this node
+	unsigned int first;			// inner node: index of the first child, leaf: index of its first light
+	float boundsMax[3];
+	unsigned int count;			// number of lights in a leaf, 0 for an inner node
+	float intensity;			// sum of the brightest channel of each light below this node
+} LightNode;
\ No newline at end of file
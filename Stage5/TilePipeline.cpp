@@ -0,0 +1,136 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "TilePipeline.h"
+
+// work out the tiling of a width x height frame, rendering the tiles of part
+// the last row and column of tiles are cut short if the image isn't a multiple of blockSize, and every tile to fit the part
+void createTilePipeline(TilePipeline* pipeline, int width, int height, unsigned int blockSize, unsigned int tilesInFlight, const FramePart* part)
+{
+	pipeline->width = width;
+	pipeline->height = height;
+	pipeline->blockSize = blockSize;
+	pipeline->numBlocksWide = (width + blockSize - 1) / blockSize;
+	pipeline->numBlocksHigh = (height + blockSize - 1) / blockSize;
+	pipeline->tilesInFlight = std::max(tilesInFlight, 1u);
+	pipeline->part = *part;
+
+	// only the tiles with pixels in the part
+	pipeline->blocks = new unsigned int[pipeline->numBlocksWide * pipeline->numBlocksHigh];
+	pipeline->totalBlocks = 0;
+	for (int block = part->firstTile; block <= part->lastTile; ++block)
+	{
+		int x0, y0, x1, y1;
+		if (framePartTile(part, block, &x0, &y0, &x1, &y1)) pipeline->blocks[pipeline->totalBlocks++] = block;
+	}
+
+	pipeline->kernelEvents = new cl_event[pipeline->tilesInFlight];
+	pipeline->readEvents = new cl_event[pipeline->tilesInFlight];
+}
+
+
+// top left corner and size of tile j (the part of it that is rendered)
+static void getTile(const TilePipeline* pipeline, unsigned int j, size_t* tileX, size_t* tileY, size_t* jobSizeX, size_t* jobSizeY)
+{
+	int x0, y0, x1, y1;
+	framePartTile(&pipeline->part, pipeline->blocks[j], &x0, &y0, &x1, &y1);
+	*tileX = x0;
+	*tileY = y0;
+	*jobSizeX = x1 - x0;
+	*jobSizeY = y1 - y0;
+}
+
+
+// render every tile of a frame into clBufferOut and read each one back into its place in frame
+bool renderTiles(TilePipeline* pipeline, const RenderContext* rc, cl_mem clBufferOut, const FrameView* frame, BmpStream* stream)
+{
+	cl_int err;
+	const unsigned int depth = pipeline->tilesInFlight;
+	const size_t rowPitch = pipeline->width * sizeof(unsigned int);
+	const size_t frameRowPitch = frame->stride * sizeof(unsigned int);
+
+	pipeline->times.kernelMs = pipeline->times.readbackMs = 0.0;
+
+	// each pass enqueues tile j, then retires the oldest tile once depth tiles are queued,
+	// which frees its event slot for tile j + 1
+	for (unsigned int j = 0; j < pipeline->totalBlocks + depth - 1; ++j)
+	{
+		if (j < pipeline->totalBlocks)
+		{
+			const unsigned int slot = j % depth;
+			size_t tileX, tileY, jobSizeX, jobSizeY;
+			getTile(pipeline, j, &tileX, &tileY, &jobSizeX, &jobSizeY);
+
+			// the work offset places the tile in the image, so the kernel's global id is its pixel position
+			size_t workOffset[] = { tileX, tileY };
+			size_t workSize[] = { jobSizeX, jobSizeY };
+
+			err = clEnqueueNDRangeKernel(rc->queue, rc->kernel, 2, workOffset, workSize, NULL, 0, NULL, &pipeline->kernelEvents[slot]);
+			if (err != CL_SUCCESS)
+			{
+				printf("Couldn't enqueue the kernel execution command\n");
+				return false;
+			}
+
+			// read just this tile's rectangle back into its view of the frame once its kernel is done
+			FrameView tile = subFrameView(frame, (int)tileX - pipeline->part.imageX0, (int)tileY - pipeline->part.imageY0, (int)jobSizeX, (int)jobSizeY);
+			size_t origin[] = { tileX * sizeof(unsigned int), tileY, 0 };
+			size_t tileOrigin[] = { 0, 0, 0 };
+			size_t region[] = { jobSizeX * sizeof(unsigned int), jobSizeY, 1 };
+			err = clEnqueueReadBufferRect(rc->transferQueue, clBufferOut, CL_FALSE, origin, tileOrigin, region, rowPitch, 0, frameRowPitch, 0, tile.pixels,
+				1, &pipeline->kernelEvents[slot], &pipeline->readEvents[slot]);
+			if (err != CL_SUCCESS)
+			{
+				printf("Couldn't enqueue the read buffer command\n");
+				return false;
+			}
+
+			// make sure the device starts on it straight away rather than when we next block
+			clFlush(rc->queue);
+			clFlush(rc->transferQueue);
+		}
+
+		if (j + 1 < depth) continue;
+
+		// retire the oldest tile still in flight
+		const unsigned int done = j + 1 - depth;
+		if (done >= pipeline->totalBlocks) continue;
+
+		const unsigned int slot = done % depth;
+		err = clWaitForEvents(1, &pipeline->readEvents[slot]);
+		if (err == CL_SUCCESS)
+		{
+			pipeline->times.kernelMs += eventMilliseconds(rc, pipeline->kernelEvents[slot]);
+			pipeline->times.readbackMs += eventMilliseconds(rc, pipeline->readEvents[slot]);
+		}
+		clReleaseEvent(pipeline->kernelEvents[slot]);
+		clReleaseEvent(pipeline->readEvents[slot]);
+		if (err != CL_SUCCESS)
+		{
+			printf("Error waiting for tile %u. Error code: %d\n", done, err);
+			return false;
+		}
+
+		// tiles retire in order, so the last tile of a row of tiles completes that band of image rows
+		if (stream != NULL && pipeline->blocks[done] % pipeline->numBlocksWide == pipeline->numBlocksWide - 1)
+		{
+			size_t tileX, tileY, jobSizeX, jobSizeY;
+			getTile(pipeline, done, &tileX, &tileY, &jobSizeX, &jobSizeY);
+			write_bmp_rows(stream, frame->pixels, (int)tileY, (int)jobSizeY, frame->stride);
+		}
+	}
+
+	return true;
+}
+
+
+void releaseTilePipeline(TilePipeline* pipeline)
+{
+	delete[] pipeline->blocks;
+	delete[] pipeline->kernelEvents;
+	delete[] pipeline->readEvents;
+}
@@ -0,0 +1,39 @@
+#ifndef __TILE_PIPELINE_H
+#define __TILE_PIPELINE_H
+
+#include "RenderContext.h"
+#include "ImageIO.h"
+#include "FrameBuffer.h"
+#include "FramePart.h"
+
+// splits the frame (or the part of it being rendered) into blockSize x blockSize tiles and keeps up to tilesInFlight of them queued on the device,
+// kernels go on the render queue and each tile's readback goes on the transfer queue, waiting on that tile's kernel event
+typedef struct TilePipeline
+{
+	int width, height;						// size of the whole image
+	unsigned int blockSize;					// width and height of a (full) tile
+	unsigned int numBlocksWide;				// tiles across
+	unsigned int numBlocksHigh;				// tiles down
+	unsigned int totalBlocks;				// tiles rendered (every tile of the frame unless only part of it is rendered)
+	FramePart part;							// part of the frame rendered, its tiles are clipped to it
+	unsigned int* blocks;					// frame tile number of each tile rendered, in scanline order
+	unsigned int tilesInFlight;				// tiles enqueued but not yet retired
+
+	cl_event* kernelEvents;					// ring of tilesInFlight kernel events
+	cl_event* readEvents;					// ring of tilesInFlight readback events
+
+	DeviceTimes times;						// device time of the last frame's kernels and readbacks (if the queues are profiling)
+} TilePipeline;
+
+// work out the tiling of a width x height frame, rendering the tiles of part (cut into blockSize tiles like the frame)
+void createTilePipeline(TilePipeline* pipeline, int width, int height, unsigned int blockSize, unsigned int tilesInFlight, const FramePart* part);
+
+// render every tile of a frame into clBufferOut and read each one back into its place in frame (rows may be padded)
+// frame holds the part's image, so its first pixel is (imageX0, imageY0) of the frame
+// if stream is not NULL (whole frames only), each band of rows is written to it as soon as its last tile has been read back,
+// so the file is written while the device is still rendering later tiles
+bool renderTiles(TilePipeline* pipeline, const RenderContext* rc, cl_mem clBufferOut, const FrameView* frame, BmpStream* stream);
+
+void releaseTilePipeline(TilePipeline* pipeline);
+
+#endif // __TILE_PIPELINE_H
@@ -2,6 +2,7 @@
 
 // simple timer
 // system/OS/core specific functions required for timing
+// Windows and Mac/Linux use a monotonic clock with (at least) microsecond resolution
 // to use this file you _MUST_ define either TARGET_PPU, TARGET_SPU, or TARGET_WINDOWS
 
 #ifndef __TIMER_H
@@ -15,7 +16,7 @@
 	#define NOMINMAX			// undefine stupid windows macros that break STL
 	#include <windows.h>
 #elif defined(TARGET_MACLINUX)
-	#include <sys/time.h>
+	#include <time.h>
 #else
 	#error Must define one of TARGET_PPU, TARGET_SPU, TARGET_WINDOWS, or TARGET_MACLINUX
 #endif
@@ -29,9 +30,10 @@ class Timer
 		static const unsigned int startTicks = 0xFFFFFFFF;
 		unsigned int finishTicks, usedTicks;
 	#elif defined(TARGET_WINDOWS)
-		unsigned int startTicks, finishTicks, usedTicks;
+		LARGE_INTEGER startTicks, finishTicks;
+		unsigned long long usedTicks;
 	#elif defined(TARGET_MACLINUX)
-		struct timeval startTicks, finishTicks;
+		struct timespec startTicks, finishTicks;
 		unsigned long long usedTicks;
 	#endif
 
@@ -50,9 +52,9 @@ public:
 		#elif defined(TARGET_SPU)
 			spu_write_decrementer(startTicks);
 		#elif defined(TARGET_WINDOWS)
-			startTicks = GetTickCount();
+			QueryPerformanceCounter(&startTicks);
 		#elif defined(TARGET_MACLINUX)
-			gettimeofday(&startTicks, 0);
+			clock_gettime(CLOCK_MONOTONIC, &startTicks);
 		#endif
 	}
 
@@ -66,11 +68,11 @@ public:
 			finishTicks = spu_read_decrementer();
 			usedTicks = startTicks - finishTicks;
 		#elif defined(TARGET_WINDOWS)
-			finishTicks = GetTickCount();						
-			usedTicks = finishTicks - startTicks;
+			QueryPerformanceCounter(&finishTicks);
+			usedTicks = finishTicks.QuadPart - startTicks.QuadPart;
 		#elif defined(TARGET_MACLINUX)
-			gettimeofday(&finishTicks, 0);
-			usedTicks = (((unsigned long long) finishTicks.tv_sec) * 1000000 + ((unsigned long long) finishTicks.tv_usec)) - (((unsigned long long) startTicks.tv_sec) * 1000000 + ((unsigned long long) startTicks.tv_usec));
+			clock_gettime(CLOCK_MONOTONIC, &finishTicks);
+			usedTicks = (((unsigned long long) finishTicks.tv_sec) * 1000000000 + ((unsigned long long) finishTicks.tv_nsec)) - (((unsigned long long) startTicks.tv_sec) * 1000000000 + ((unsigned long long) startTicks.tv_nsec));
 		#endif
 	}
 
@@ -80,19 +82,33 @@ public:
 		return (unsigned long long) usedTicks;
 	}
 
-	// get time in milliseconds
-	inline unsigned int getMilliseconds()
+	// get time in nanoseconds
+	inline unsigned long long getNanoseconds()
 	{
 		#if defined(TARGET_PPU)
-			return (usedTicks * 1000) / 79800000;
+			return (usedTicks * 1000) / 79800 * 1000;
 		#elif defined(TARGET_SPU)
-			return usedTicks / 80000;
+			return (unsigned long long) usedTicks * 25 / 2;
 		#elif defined(TARGET_WINDOWS)
-			return usedTicks;
+			LARGE_INTEGER frequency;
+			QueryPerformanceFrequency(&frequency);
+			return (usedTicks / frequency.QuadPart) * 1000000000 + (usedTicks % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
 		#elif defined(TARGET_MACLINUX)
-			return usedTicks / 1000;
+			return usedTicks;
 		#endif
 	}
+
+	// get time in milliseconds
+	inline unsigned int getMilliseconds()
+	{
+		return (unsigned int)(getNanoseconds() / 1000000);
+	}
+
+	// get time in (fractional) milliseconds
+	inline double getMillisecondsExact()
+	{
+		return getNanoseconds() / 1000000.0;
+	}
 };
 
 #endif //__TIMER_H
@@ -0,0 +1,363 @@
+// wavefront version of the render kernel
+// instead of one work-item following a pixel's rays all the way, each kernel does one step for every live path:
+//   generatePaths  - a work-item per pixel writes its primary rays and queues them
+//   intersectPaths - a work-item per queued path finds the closest object
+//   shadePaths     - works out the lighting at the hit, writes a shadow ray for each light, and the reflected / refracted ray
+//   shadowTest     - a work-item per queued shadow ray
+//   compactPaths   - adds up the unshadowed lights and queues the paths that carry on for the next bounce
+//   accumulatePixels - adds up each pixel's samples and writes it to the output
+// so work-items that stop at a diffuse surface don't sit idle while their neighbours bounce around inside glass
+// every path and shadow ray is worked out and added up in the same order as traceRay, so the image is the same as render's
+// the kernels that count rays (all but shadePaths and accumulatePixels) take the frame's ray counters as their last argument (see RayCounters.cl)
+
+
+// path state flags
+#define PATH_LIT 1			// lighting at this bounce's hit is added to the path's colour
+#define PATH_BOUNCE 2		// the path carries on with a reflected or refracted ray
+#define PATH_REFRACT 4		// the ray it carries on with is refracted rather than reflected
+
+// counters shared by the kernels
+#define COUNTER_QUEUED 0	// paths added to the queue being filled
+#define COUNTER_SHADOW 1	// shadow rays added to the shadow queue
+
+// a sample being followed through the scene
+typedef struct WavefrontPath
+{
+	Ray ray;								// ray to follow next
+	Colour colour;							// colour gathered so far
+	float coef;								// amount of ray left to transmit
+	float refractiveIndex;					// current refractive index
+	float lightCoef;						// amount of this bounce's lighting that reaches the camera
+	unsigned int numShadowRays;				// shadow rays written for this bounce's hit
+	int state;								// PATH_ flags
+} WavefrontPath;
+
+// shadow ray from a hit to one light, with the light's contribution should nothing block it
+typedef struct WavefrontShadowRay
+{
+	Ray ray;								// from the hit towards the light
+	Colour diffuse;							// diffuse lighting (diffuse and specular already added together if budgeted)
+	Colour specular;						// specular lighting
+	float lightDist;						// distance to the light
+	unsigned int light;						// light index
+	unsigned int pixel;						// pixel of the batch (its occluders are shared by its samples)
+	int budgeted;							// contribution worked out up front for the error budget
+	int occluded;							// set by shadowTest
+} WavefrontShadowRay;
+
+
+// write the primary rays of pixel (i, firstRow + j) to its slots and queue them
+// the sub-locations are stepped through in the same order as render, the pixel's sample count goes to pixelSamples
+__kernel void generatePaths(struct kernelPass data, __global struct Material* materialContainer, __global struct Light* lightContainer, __global struct Sphere* sphereContainer, __global struct Box* boxContainer, __global struct BVHNode* bvhNodeContainer, __global unsigned int* bvhPrimitiveContainer, __global struct LightNode* lightNodeContainer,
+	__global WavefrontPath* paths, __global unsigned int* queue, __global unsigned int* counters, __global unsigned int* pixelSamples, __global unsigned int* occluders, unsigned int firstRow, unsigned int slotsPerPixel, __global unsigned int* rayCounters)
+{
+	__local unsigned int groupCounts[2 * NUM_RAY_COUNTERS];
+
+	unsigned int i = get_global_id(0);
+	unsigned int j = firstRow + get_global_id(1);
+	unsigned int pixel = get_global_id(1) * data.totWidth + i;
+
+	Scene clScene = makeScene(&data, materialContainer, lightContainer, sphereContainer, boxContainer, bvhNodeContainer, bvhPrimitiveContainer, lightNodeContainer);
+	float dirStepSize = primaryStepSize(&clScene, data.totWidth);
+
+	int x = i - (data.totWidth / 2);
+	int y = j - (data.totHeight / 2);
+	float sampleStep = 1.0f / PASS_AA_LEVEL(data);
+
+	Colour black = { 0.0f, 0.0f, 0.0f };
+	unsigned int samples = 0;
+	for (float fragmentx = (float)x; fragmentx < x + 1.0f; fragmentx += sampleStep)
+	{
+		for (float fragmenty = (float)y; fragmenty < y + 1.0f; fragmenty += sampleStep)
+		{
+			unsigned int slot = pixel * slotsPerPixel + samples++;
+
+			paths[slot].ray = primaryRay(&clScene, dirStepSize, fragmentx, fragmenty);
+			paths[slot].colour = black;
+			paths[slot].coef = 1.0f;
+			paths[slot].refractiveIndex = DEFAULT_REFRACTIVE_INDEX;
+
+			queue[atomic_inc(&counters[COUNTER_QUEUED])] = slot;
+		}
+	}
+	pixelSamples[pixel] = samples;
+
+	RayCounters rayCounts;
+	resetRayCounters(&rayCounts);
+	COUNT_RAYS(&rayCounts, COUNT_PRIMARY_RAYS, samples);
+	reduceRayCounters(&rayCounts, groupCounts, rayCounters);
+
+	// nothing has blocked this pixel's lights yet
+	for (unsigned int k = 0; k < SHADOW_CACHE_SIZE; ++k)
+	{
+		occluders[pixel * SHADOW_CACHE_SIZE + k] = NO_OCCLUDER;
+	}
+}
+
+
+// find the closest object hit by each queued path (key NO_OCCLUDER for a miss)
+__kernel void intersectPaths(struct kernelPass data, __global struct Material* materialContainer, __global struct Light* lightContainer, __global struct Sphere* sphereContainer, __global struct Box* boxContainer, __global struct BVHNode* bvhNodeContainer, __global unsigned int* bvhPrimitiveContainer, __global struct LightNode* lightNodeContainer,
+	__global WavefrontPath* paths, __global unsigned int* queue, __global float* hitDistances, __global unsigned int* hitKeys, __global unsigned int* rayCounters)
+{
+	__local unsigned int groupCounts[2 * NUM_RAY_COUNTERS];
+
+	unsigned int entry = get_global_id(0);
+
+	Scene clScene = makeScene(&data, materialContainer, lightContainer, sphereContainer, boxContainer, bvhNodeContainer, bvhPrimitiveContainer, lightNodeContainer);
+	RayCounters rayCounts;
+	resetRayCounters(&rayCounts);
+	clScene.rayCounters = &rayCounts;
+
+	Ray viewRay = paths[queue[entry]].ray;
+	float t;
+	unsigned int closest;
+	if (!closestObject(&clScene, &viewRay, &t, &closest)) closest = NO_OCCLUDER;
+
+	hitDistances[entry] = t;
+	hitKeys[entry] = closest;
+
+	reduceRayCounters(&rayCounts, groupCounts, rayCounters);
+}
+
+
+// shade queue entry firstEntry + gid: misses read from the environment map, hits write a shadow ray for every light
+// applyLighting would test (to block gid * numLights onwards, in the same order) and work out the next ray
+__kernel void shadePaths(struct kernelPass data, __global struct Material* materialContainer, __global struct Light* lightContainer, __global struct Sphere* sphereContainer, __global struct Box* boxContainer, __global struct BVHNode* bvhNodeContainer, __global unsigned int* bvhPrimitiveContainer, __global struct LightNode* lightNodeContainer,
+	__global WavefrontPath* paths, __global unsigned int* queue, __global float* hitDistances, __global unsigned int* hitKeys, __global WavefrontShadowRay* shadowRays, __global unsigned int* shadowQueue, __global unsigned int* counters, unsigned int firstEntry, unsigned int slotsPerPixel)
+{
+	unsigned int entry = firstEntry + get_global_id(0);
+	unsigned int slot = queue[entry];
+	__global WavefrontPath* path = &paths[slot];
+
+	Scene clScene = makeScene(&data, materialContainer, lightContainer, sphereContainer, boxContainer, bvhNodeContainer, bvhPrimitiveContainer, lightNodeContainer);
+
+	// exit the loop if no intersection found (and read from the environment map)
+	if (hitKeys[entry] == NO_OCCLUDER)
+	{
+		if (path->coef > 0.0f) path->colour += path->coef * clScene.materialContainer[clScene.skyboxMaterialId].diffuse;
+		path->state = 0;
+		return;
+	}
+
+	Ray viewRay = path->ray;
+	Intersection intersect;
+	setIntersection(&clScene, &viewRay, hitKeys[entry], hitDistances[entry], &intersect);
+
+	// calculate response to collision: ie. get normal at point of collision and material of object
+	calculateIntersectionResponse(&clScene, &viewRay, &intersect);
+
+	int state = 0;
+	if (!intersect.insideObject)
+	{
+		state = PATH_LIT;
+		path->lightCoef = path->coef;
+
+		// walk the light tree as applyLighting does, writing a shadow ray instead of casting it
+		__global WavefrontShadowRay* block = &shadowRays[get_global_id(0) * SCENE_LIGHTS(&clScene)];
+		unsigned int numShadowRays = 0;
+
+		Ray lightRay = { intersect.pos };
+		float budget = clScene.lightCullEpsilon;
+
+		unsigned int stack[LIGHT_TREE_STACK_SIZE];
+		int stackSize = 0;
+		if (SCENE_LIGHTS(&clScene) > 0) stack[stackSize++] = 0;
+
+		while (stackSize > 0)
+		{
+			__global const LightNode* node = &clScene.lightNodeContainer[stack[--stackSize]];
+
+			if (isLightNodeBehind(node, &intersect)) continue;
+			if (budget > 0.0f)
+			{
+				float bound = lightNodeBound(node, &viewRay, &intersect);
+				if (bound <= budget)
+				{
+					budget -= bound;
+					continue;
+				}
+			}
+
+			if (node->count == 0)
+			{
+				stack[stackSize++] = node->first + 1;
+				stack[stackSize++] = node->first;
+				continue;
+			}
+
+			for (unsigned int j = node->first; j < node->first + node->count; ++j)
+			{
+				__global const Light* currentLight = &clScene.lightContainer[j];
+
+				lightRay.dir = currentLight->pos - intersect.pos;
+				float angleBetweenLightAndNormal = dot(lightRay.dir, intersect.normal);
+				if (angleBetweenLightAndNormal <= 0.0f)
+				{
+					continue;
+				}
+
+				float lightDist = sqrt(dot(lightRay.dir, lightRay.dir));
+				float invLightDist = 1.0f / lightDist;
+				float lightProjection = invLightDist * angleBetweenLightAndNormal;
+				lightRay.dir = lightRay.dir * invLightDist;
+
+				__global WavefrontShadowRay* shadowRay = &block[numShadowRays++];
+				shadowRay->budgeted = budget > 0.0f;
+				if (shadowRay->budgeted)
+				{
+					Colour contribution = applyDiffuse(&lightRay, currentLight, &intersect) + applySpecular(&lightRay, currentLight, lightProjection, &viewRay, &intersect);
+
+					float largest = maxChannel(contribution);
+					if (largest <= budget)
+					{
+						budget -= largest;
+						numShadowRays--;
+						continue;
+					}
+
+					shadowRay->diffuse = contribution;
+				}
+				else
+				{
+					shadowRay->diffuse = applyDiffuse(&lightRay, currentLight, &intersect);
+					shadowRay->specular = applySpecular(&lightRay, currentLight, lightProjection, &viewRay, &intersect);
+				}
+
+				shadowRay->ray = lightRay;
+				shadowRay->lightDist = lightDist;
+				shadowRay->light = j;
+				shadowRay->pixel = slot / slotsPerPixel;
+				shadowRay->occluded = 0;
+
+				shadowQueue[atomic_inc(&counters[COUNTER_SHADOW])] = get_global_id(0) * SCENE_LIGHTS(&clScene) + numShadowRays - 1;
+			}
+		}
+
+		path->numShadowRays = numShadowRays;
+	}
+
+	// if object has reflection or refraction component, adjust the view ray and coefficent of calculation and carry on
+	float currentRefractiveIndex = path->refractiveIndex;
+	if (intersect.material->reflection)
+	{
+		path->ray = calculateReflection(&viewRay, &intersect);
+		path->coef *= intersect.material->reflection;
+		state |= PATH_BOUNCE;
+	}
+	else if (intersect.material->refraction)
+	{
+		path->ray = calculateRefraction(&viewRay, &intersect, &currentRefractiveIndex);
+		path->refractiveIndex = currentRefractiveIndex;
+		path->coef *= intersect.material->refraction;
+		state |= PATH_BOUNCE | PATH_REFRACT;
+	}
+
+	path->state = state;
+}
+
+
+// test each queued shadow ray, starting with whatever last blocked that light for the same pixel
+// samples of a pixel may share an occluder slot at the same time, but a stale or torn slot only costs an extra test
+__kernel void shadowTest(struct kernelPass data, __global struct Material* materialContainer, __global struct Light* lightContainer, __global struct Sphere* sphereContainer, __global struct Box* boxContainer, __global struct BVHNode* bvhNodeContainer, __global unsigned int* bvhPrimitiveContainer, __global struct LightNode* lightNodeContainer,
+	__global WavefrontShadowRay* shadowRays, __global unsigned int* shadowQueue, __global unsigned int* occluders, __global unsigned int* rayCounters)
+{
+	__local unsigned int groupCounts[2 * NUM_RAY_COUNTERS];
+
+	__global WavefrontShadowRay* shadowRay = &shadowRays[shadowQueue[get_global_id(0)]];
+
+	Scene clScene = makeScene(&data, materialContainer, lightContainer, sphereContainer, boxContainer, bvhNodeContainer, bvhPrimitiveContainer, lightNodeContainer);
+	RayCounters rayCounts;
+	resetRayCounters(&rayCounts);
+	clScene.rayCounters = &rayCounts;
+
+	__global unsigned int* slot = &occluders[shadowRay->pixel * SHADOW_CACHE_SIZE + shadowRay->light % SHADOW_CACHE_SIZE];
+	unsigned int occluder = *slot, lastOccluder = occluder;
+
+	Ray lightRay = shadowRay->ray;
+	shadowRay->occluded = isInShadow(&clScene, &lightRay, shadowRay->lightDist, &occluder);
+	if (shadowRay->occluded) *slot = occluder;
+
+	COUNT_RAYS(&rayCounts, COUNT_SHADOW_RAYS, 1);
+	if (shadowRay->occluded && occluder == lastOccluder) COUNT_RAYS(&rayCounts, COUNT_SHADOW_CACHE_HITS, 1);
+	reduceRayCounters(&rayCounts, groupCounts, rayCounters);
+}
+
+
+// add queue entry firstEntry + gid's unshadowed lights to its colour, in light order, then queue it for the next bounce
+// paths still going after the last bounce (level MAX_RAYS_CAST - 1) read from the environment map instead
+// the paths that stop here are counted by the number of rays they took, the ones queued by the kind of ray they carry on with
+__kernel void compactPaths(struct kernelPass data, __global struct Material* materialContainer, __global struct Light* lightContainer, __global struct Sphere* sphereContainer, __global struct Box* boxContainer, __global struct BVHNode* bvhNodeContainer, __global unsigned int* bvhPrimitiveContainer, __global struct LightNode* lightNodeContainer,
+	__global WavefrontPath* paths, __global unsigned int* queue, __global WavefrontShadowRay* shadowRays, __global unsigned int* nextQueue, __global unsigned int* counters, unsigned int firstEntry, unsigned int level, __global unsigned int* rayCounters)
+{
+	__local unsigned int groupCounts[2 * NUM_RAY_COUNTERS];
+
+	unsigned int slot = queue[firstEntry + get_global_id(0)];
+	__global WavefrontPath* path = &paths[slot];
+
+	if (path->state & PATH_LIT)
+	{
+		__global WavefrontShadowRay* block = &shadowRays[get_global_id(0) * SCENE_LIGHTS(&data)];
+
+		Colour output = { 0.0f, 0.0f, 0.0f };
+		for (unsigned int k = 0; k < path->numShadowRays; ++k)
+		{
+			if (block[k].occluded) continue;
+
+			if (block[k].budgeted)
+			{
+				output += block[k].diffuse;
+			}
+			else
+			{
+				output += block[k].diffuse;
+				output += block[k].specular;
+			}
+		}
+
+		path->colour += path->lightCoef * output;
+	}
+
+	RayCounters rayCounts;
+	resetRayCounters(&rayCounts);
+
+	// (every work-item carries on to the end, as adding up the counts has barriers)
+	if (!(path->state & PATH_BOUNCE))
+	{
+		COUNT_RAYS(&rayCounts, COUNT_DEPTH + level, 1);
+	}
+	else if (level < MAX_RAYS_CAST - 1)
+	{
+		nextQueue[atomic_inc(&counters[COUNTER_QUEUED])] = slot;
+		COUNT_RAYS(&rayCounts, (path->state & PATH_REFRACT) ? COUNT_REFRACTION_RAYS : COUNT_REFLECTION_RAYS, 1);
+	}
+	else
+	{
+		if (path->coef > 0.0f) path->colour += path->coef * materialContainer[data.skyboxMaterialId].diffuse;
+		COUNT_RAYS(&rayCounts, COUNT_DEPTH + level, 1);
+	}
+
+	reduceRayCounters(&rayCounts, groupCounts, rayCounters);
+}
+
+
+// add up pixel (i, firstRow + j)'s samples in the order they were generated and store it in the image buffer
+__kernel void accumulatePixels(struct kernelPass data, __global struct Material* materialContainer, __global struct Light* lightContainer, __global struct Sphere* sphereContainer, __global struct Box* boxContainer, __global struct BVHNode* bvhNodeContainer, __global unsigned int* bvhPrimitiveContainer, __global struct LightNode* lightNodeContainer,
+	__global WavefrontPath* paths, __global unsigned int* pixelSamples, __global unsigned int* out, unsigned int firstRow, unsigned int slotsPerPixel)
+{
+	unsigned int i = get_global_id(0);
+	unsigned int j = firstRow + get_global_id(1);
+	unsigned int pixel = get_global_id(1) * data.totWidth + i;
+
+	float sampleRatio = 1.0f / (PASS_AA_LEVEL(data) * PASS_AA_LEVEL(data));
+
+	Colour output = { 0.0f, 0.0f, 0.0f };
+	for (unsigned int s = 0; s < pixelSamples[pixel]; ++s)
+	{
+		output += sampleRatio * paths[pixel * slotsPerPixel + s].colour;
+	}
+
+	if (!data.testMode)
+	{
+		out[j * data.totWidth + i] = packColour(output, data.exposure);
+	}
+}
@@ -0,0 +1,282 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <algorithm>
+#include "Wavefront.h"
+#include "Constants.h"
+
+// kernel function names, indexed by WavefrontPipeline::Kernel
+static const char* kernelNames[WavefrontPipeline::NUM_KERNELS] = { "generatePaths", "intersectPaths", "shadePaths", "shadowTest", "compactPaths", "accumulatePixels" };
+
+// counters in counterBuffer (COUNTER_ in Wavefront.cl)
+#define COUNTER_QUEUED 0
+#define COUNTER_SHADOW 1
+
+
+// create a device only buffer
+static cl_mem createDeviceBuffer(const RenderContext* rc, size_t size, const char* name)
+{
+	cl_int err;
+	cl_mem buffer = clCreateBuffer(rc->context, CL_MEM_READ_WRITE, size, NULL, &err);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError creating the %s buffer. Error code: %d\n", name, err);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+
+// set kernel arguments from first onwards to the given buffers
+static bool setBufferArgs(cl_kernel kernel, cl_uint first, const cl_mem* buffers, cl_uint count)
+{
+	for (cl_uint i = 0; i < count; ++i)
+	{
+		cl_int err = clSetKernelArg(kernel, first + i, sizeof(cl_mem), &buffers[i]);
+		if (err != CL_SUCCESS)
+		{
+			printf("\nError calling clSetKernelArg%d. Error code: %d\n", first + i + 1, err);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+// set an unsigned int kernel argument
+static bool setUintArg(cl_kernel kernel, cl_uint index, cl_uint value)
+{
+	cl_int err = clSetKernelArg(kernel, index, sizeof(value), &value);
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError calling clSetKernelArg%d. Error code: %d\n", index + 1, err);
+		return false;
+	}
+
+	return true;
+}
+
+
+// create the kernels, bind the scene to them and create the device buffers for a width x height frame
+bool createWavefrontPipeline(WavefrontPipeline* pipeline, const RenderContext* rc, const SceneBuffers* sceneBuffers, int width, int height, unsigned int aaLevel, unsigned int numLights, cl_mem rayCounterBuffer)
+{
+	cl_int err;
+
+	pipeline->width = width;
+	pipeline->height = height;
+	pipeline->slotsPerPixel = (aaLevel + 1) * (aaLevel + 1);
+	pipeline->rowsPerBatch = std::min(std::max(WAVEFRONT_PATHS / (width * pipeline->slotsPerPixel), 1u), (unsigned int)height);
+	pipeline->pathsPerShade = std::max(WAVEFRONT_SHADOW_RAYS / std::max(numLights, 1u), 1u);
+
+	for (int k = 0; k < WavefrontPipeline::NUM_KERNELS; ++k)
+	{
+		pipeline->kernels[k] = clCreateKernel(rc->program, kernelNames[k], &err);
+		if (err != CL_SUCCESS)
+		{
+			printf("Couldn't create the %s kernel\n", kernelNames[k]);
+			return false;
+		}
+
+		if (!bindSceneBuffers(pipeline->kernels[k], sceneBuffers)) return false;
+	}
+
+	const size_t batchPixels = (size_t)width * pipeline->rowsPerBatch;
+	const size_t batchPaths = batchPixels * pipeline->slotsPerPixel;
+	const size_t shadowRays = (size_t)pipeline->pathsPerShade * std::max(numLights, 1u);
+
+	pipeline->pathBuffer = createDeviceBuffer(rc, sizeof(WavefrontPath) * batchPaths, "path");
+	pipeline->queueBuffers[0] = createDeviceBuffer(rc, sizeof(cl_uint) * batchPaths, "path queue");
+	pipeline->queueBuffers[1] = createDeviceBuffer(rc, sizeof(cl_uint) * batchPaths, "path queue");
+	pipeline->hitDistanceBuffer = createDeviceBuffer(rc, sizeof(cl_float) * batchPaths, "hit distance");
+	pipeline->hitKeyBuffer = createDeviceBuffer(rc, sizeof(cl_uint) * batchPaths, "hit key");
+	pipeline->shadowRayBuffer = createDeviceBuffer(rc, sizeof(WavefrontShadowRay) * shadowRays, "shadow ray");
+	pipeline->shadowQueueBuffer = createDeviceBuffer(rc, sizeof(cl_uint) * shadowRays, "shadow queue");
+	pipeline->counterBuffer = createDeviceBuffer(rc, sizeof(cl_uint) * 2, "counter");
+	pipeline->pixelSampleBuffer = createDeviceBuffer(rc, sizeof(cl_uint) * batchPixels, "pixel sample");
+	pipeline->occluderBuffer = createDeviceBuffer(rc, sizeof(cl_uint) * batchPixels * WAVEFRONT_OCCLUDER_SLOTS, "occluder");
+
+	if (!pipeline->pathBuffer || !pipeline->queueBuffers[0] || !pipeline->queueBuffers[1] || !pipeline->hitDistanceBuffer || !pipeline->hitKeyBuffer ||
+		!pipeline->shadowRayBuffer || !pipeline->shadowQueueBuffer || !pipeline->counterBuffer || !pipeline->pixelSampleBuffer || !pipeline->occluderBuffer)
+	{
+		return false;
+	}
+
+	// the arguments that stay the same for every launch (the queues swap each bounce and are set as they are used)
+	cl_mem generateArgs[] = { pipeline->pathBuffer, pipeline->queueBuffers[0], pipeline->counterBuffer, pipeline->pixelSampleBuffer, pipeline->occluderBuffer };
+	cl_mem intersectArgs[] = { pipeline->pathBuffer };
+	cl_mem intersectHitArgs[] = { pipeline->hitDistanceBuffer, pipeline->hitKeyBuffer };
+	cl_mem shadeArgs[] = { pipeline->hitDistanceBuffer, pipeline->hitKeyBuffer, pipeline->shadowRayBuffer, pipeline->shadowQueueBuffer, pipeline->counterBuffer };
+	cl_mem shadowArgs[] = { pipeline->shadowRayBuffer, pipeline->shadowQueueBuffer, pipeline->occluderBuffer };
+	cl_mem compactArgs[] = { pipeline->shadowRayBuffer };
+	cl_mem accumulateArgs[] = { pipeline->pathBuffer, pipeline->pixelSampleBuffer };
+
+	return setBufferArgs(pipeline->kernels[WavefrontPipeline::GENERATE], 8, generateArgs, 5) && setUintArg(pipeline->kernels[WavefrontPipeline::GENERATE], 14, pipeline->slotsPerPixel) && setBufferArgs(pipeline->kernels[WavefrontPipeline::GENERATE], 15, &rayCounterBuffer, 1) &&
+		setBufferArgs(pipeline->kernels[WavefrontPipeline::INTERSECT], 8, intersectArgs, 1) && setBufferArgs(pipeline->kernels[WavefrontPipeline::INTERSECT], 10, intersectHitArgs, 2) && setBufferArgs(pipeline->kernels[WavefrontPipeline::INTERSECT], 12, &rayCounterBuffer, 1) &&
+		setBufferArgs(pipeline->kernels[WavefrontPipeline::SHADE], 8, &pipeline->pathBuffer, 1) && setBufferArgs(pipeline->kernels[WavefrontPipeline::SHADE], 10, shadeArgs, 5) && setUintArg(pipeline->kernels[WavefrontPipeline::SHADE], 16, pipeline->slotsPerPixel) &&
+		setBufferArgs(pipeline->kernels[WavefrontPipeline::SHADOW], 8, shadowArgs, 3) && setBufferArgs(pipeline->kernels[WavefrontPipeline::SHADOW], 11, &rayCounterBuffer, 1) &&
+		setBufferArgs(pipeline->kernels[WavefrontPipeline::COMPACT], 8, &pipeline->pathBuffer, 1) && setBufferArgs(pipeline->kernels[WavefrontPipeline::COMPACT], 10, compactArgs, 1) && setBufferArgs(pipeline->kernels[WavefrontPipeline::COMPACT], 12, &pipeline->counterBuffer, 1) && setBufferArgs(pipeline->kernels[WavefrontPipeline::COMPACT], 15, &rayCounterBuffer, 1) &&
+		setBufferArgs(pipeline->kernels[WavefrontPipeline::ACCUMULATE], 8, accumulateArgs, 2) && setUintArg(pipeline->kernels[WavefrontPipeline::ACCUMULATE], 12, pipeline->slotsPerPixel);
+}
+
+
+// enqueue a kernel over a 1 or 2 dimensional range
+// while profiling its event is kept until the end of the batch (see addBatchTimes)
+static bool enqueueKernel(const RenderContext* rc, WavefrontPipeline* pipeline, WavefrontPipeline::Kernel k, cl_uint dims, size_t sizeX, size_t sizeY)
+{
+	size_t workSize[] = { sizeX, sizeY };
+	cl_event event;
+	cl_int err = clEnqueueNDRangeKernel(rc->queue, pipeline->kernels[k], dims, NULL, workSize, NULL, 0, NULL, rc->profiling ? &event : NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("Couldn't enqueue the %s kernel. Error code: %d\n", kernelNames[k], err);
+		return false;
+	}
+
+	if (rc->profiling) pipeline->kernelEvents.push_back(event);
+	return true;
+}
+
+
+// add up the device time of the batch's kernels (all finished once its rows have been read back) and release their events
+static void addBatchTimes(const RenderContext* rc, WavefrontPipeline* pipeline)
+{
+	for (cl_event event : pipeline->kernelEvents)
+	{
+		pipeline->times.kernelMs += eventMilliseconds(rc, event);
+		clReleaseEvent(event);
+	}
+	pipeline->kernelEvents.clear();
+}
+
+
+// read one of the counters once the kernels before it have finished, optionally zeroing it for the next kernel to count with
+static bool takeCounter(const RenderContext* rc, const WavefrontPipeline* pipeline, unsigned int counter, cl_uint* value, bool reset)
+{
+	cl_int err = clEnqueueReadBuffer(rc->queue, pipeline->counterBuffer, CL_TRUE, sizeof(cl_uint) * counter, sizeof(cl_uint), value, 0, NULL, NULL);
+	if (err == CL_SUCCESS && reset)
+	{
+		const cl_uint zero = 0;
+		err = clEnqueueWriteBuffer(rc->queue, pipeline->counterBuffer, CL_TRUE, sizeof(cl_uint) * counter, sizeof(cl_uint), &zero, 0, NULL, NULL);
+	}
+	if (err != CL_SUCCESS)
+	{
+		printf("\nError reading the wavefront counters. Error code: %d\n", err);
+		return false;
+	}
+
+	return true;
+}
+
+
+// render a frame into clBufferOut and read each batch of rows back into its place in frame
+bool renderWavefront(WavefrontPipeline* pipeline, const RenderContext* rc, cl_mem clBufferOut, const FrameView* frame, BmpStream* stream)
+{
+	cl_int err;
+	cl_kernel* kernels = pipeline->kernels;
+
+	if (!setBufferArgs(kernels[WavefrontPipeline::ACCUMULATE], 10, &clBufferOut, 1)) return false;
+
+	pipeline->times.kernelMs = pipeline->times.readbackMs = 0.0;
+
+	for (unsigned int firstRow = 0; firstRow < (unsigned int)pipeline->height; firstRow += pipeline->rowsPerBatch)
+	{
+		const unsigned int rows = std::min(pipeline->rowsPerBatch, pipeline->height - firstRow);
+
+		// primary rays of every sample of the batch go into the first queue
+		const cl_uint zeros[2] = { 0, 0 };
+		err = clEnqueueWriteBuffer(rc->queue, pipeline->counterBuffer, CL_TRUE, 0, sizeof(zeros), zeros, 0, NULL, NULL);
+		if (err != CL_SUCCESS)
+		{
+			printf("\nError resetting the wavefront counters. Error code: %d\n", err);
+			return false;
+		}
+
+		if (!setUintArg(kernels[WavefrontPipeline::GENERATE], 13, firstRow) || !enqueueKernel(rc, pipeline, WavefrontPipeline::GENERATE, 2, pipeline->width, rows)) return false;
+
+		cl_uint live;
+		if (!takeCounter(rc, pipeline, COUNTER_QUEUED, &live, true)) return false;
+
+		// a bounce at a time: intersect every live path, then shade, test shadows and compact in groups that fit the shadow ray buffer
+		unsigned int current = 0;
+		for (int level = 0; level < MAX_RAYS_CAST && live > 0; ++level)
+		{
+			cl_mem queue = pipeline->queueBuffers[current], nextQueue = pipeline->queueBuffers[1 - current];
+
+			if (!setBufferArgs(kernels[WavefrontPipeline::INTERSECT], 9, &queue, 1) || !enqueueKernel(rc, pipeline, WavefrontPipeline::INTERSECT, 1, live, 1)) return false;
+
+			if (!setBufferArgs(kernels[WavefrontPipeline::SHADE], 9, &queue, 1) ||
+				!setBufferArgs(kernels[WavefrontPipeline::COMPACT], 9, &queue, 1) || !setBufferArgs(kernels[WavefrontPipeline::COMPACT], 11, &nextQueue, 1) ||
+				!setUintArg(kernels[WavefrontPipeline::COMPACT], 14, level))
+			{
+				return false;
+			}
+
+			for (cl_uint first = 0; first < live; first += pipeline->pathsPerShade)
+			{
+				const cl_uint count = std::min(live - first, pipeline->pathsPerShade);
+
+				if (!setUintArg(kernels[WavefrontPipeline::SHADE], 15, first) || !enqueueKernel(rc, pipeline, WavefrontPipeline::SHADE, 1, count, 1)) return false;
+
+				cl_uint shadowRays;
+				if (!takeCounter(rc, pipeline, COUNTER_SHADOW, &shadowRays, true)) return false;
+				if (shadowRays > 0 && !enqueueKernel(rc, pipeline, WavefrontPipeline::SHADOW, 1, shadowRays, 1)) return false;
+
+				if (!setUintArg(kernels[WavefrontPipeline::COMPACT], 13, first) || !enqueueKernel(rc, pipeline, WavefrontPipeline::COMPACT, 1, count, 1)) return false;
+			}
+
+			if (!takeCounter(rc, pipeline, COUNTER_QUEUED, &live, true)) return false;
+			current = 1 - current;
+		}
+
+		if (!setUintArg(kernels[WavefrontPipeline::ACCUMULATE], 11, firstRow) || !enqueueKernel(rc, pipeline, WavefrontPipeline::ACCUMULATE, 2, pipeline->width, rows)) return false;
+
+		// read the batch's rows back into its view of the frame (the frame's rows may be padded, the device's aren't)
+		FrameView batch = subFrameView(frame, 0, (int)firstRow, pipeline->width, (int)rows);
+		const size_t rowSize = pipeline->width * sizeof(unsigned int);
+		size_t origin[] = { 0, firstRow, 0 };
+		size_t batchOrigin[] = { 0, 0, 0 };
+		size_t region[] = { rowSize, rows, 1 };
+		cl_event readEvent;
+		err = clEnqueueReadBufferRect(rc->queue, clBufferOut, CL_TRUE, origin, batchOrigin, region, rowSize, 0, batch.stride * sizeof(unsigned int), 0, batch.pixels,
+			0, NULL, rc->profiling ? &readEvent : NULL);
+		if (err != CL_SUCCESS)
+		{
+			printf("Couldn't read back rows %u to %u. Error code: %d\n", firstRow, firstRow + rows, err);
+			return false;
+		}
+
+		if (rc->profiling)
+		{
+			pipeline->times.readbackMs += eventMilliseconds(rc, readEvent);
+			clReleaseEvent(readEvent);
+			addBatchTimes(rc, pipeline);
+		}
+
+		if (stream != NULL)
+		{
+			write_bmp_rows(stream, frame->pixels, (int)firstRow, (int)rows, frame->stride);
+		}
+	}
+
+	return true;
+}
+
+
+void releaseWavefrontPipeline(WavefrontPipeline* pipeline)
+{
+	cl_mem buffers[] = { pipeline->pathBuffer, pipeline->queueBuffers[0], pipeline->queueBuffers[1], pipeline->hitDistanceBuffer, pipeline->hitKeyBuffer,
+		pipeline->shadowRayBuffer, pipeline->shadowQueueBuffer, pipeline->counterBuffer, pipeline->pixelSampleBuffer, pipeline->occluderBuffer };
+	for (cl_mem buffer : buffers)
+	{
+		clReleaseMemObject(buffer);
+	}
+
+	for (int k = 0; k < WavefrontPipeline::NUM_KERNELS; ++k)
+	{
+		clReleaseKernel(pipeline->kernels[k]);
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef __WAVEFRONT_H
+#define __WAVEFRONT_H
+
+#include "RenderContext.h"
+#include "SceneBuffers.h"
+#include "ImageIO.h"
+#include "FrameBuffer.h"
+#include <vector>
+
+// path slots a batch of rows may use (a batch is always at least one row)
+#define WAVEFRONT_PATHS (1 << 18)
+
+// shadow rays one shadePaths launch may write (always at least one hit's worth, a shadow ray per light)
+#define WAVEFRONT_SHADOW_RAYS (1 << 18)
+
+// occluders remembered per pixel (SHADOW_CACHE_SIZE from Constants.cl)
+#define WAVEFRONT_OCCLUDER_SLOTS 16
+
+// host copies of the structs in Wavefront.cl, only used to size the device buffers
+typedef struct WavefrontPath
+{
+	__declspec(align(16)) cl_float3 start;
+	cl_float3 dir;
+	cl_float3 colour;
+	cl_float coef;
+	cl_float refractiveIndex;
+	cl_float lightCoef;
+	cl_uint numShadowRays;
+	cl_int state;
+} WavefrontPath;
+
+typedef struct WavefrontShadowRay
+{
+	__declspec(align(16)) cl_float3 start;
+	cl_float3 dir;
+	cl_float3 diffuse;
+	cl_float3 specular;
+	cl_float lightDist;
+	cl_uint light;
+	cl_uint pixel;
+	cl_int budgeted;
+	cl_int occluded;
+} WavefrontShadowRay;
+
+// renders the frame a batch of rows at a time with the kernels in Wavefront.cl instead of the render kernel,
+// the batch's paths, queues and shadow rays stay on the device between kernels and only queue lengths are read back
+typedef struct WavefrontPipeline
+{
+	// the kernels, in the order they run
+	enum Kernel { GENERATE, INTERSECT, SHADE, SHADOW, COMPACT, ACCUMULATE, NUM_KERNELS };
+
+	int width, height;						// size of the whole image
+	unsigned int slotsPerPixel;				// path slots per pixel, (aaLevel + 1)^2 covers every sub-location render's loops can step to
+	unsigned int rowsPerBatch;				// rows rendered at once
+	unsigned int pathsPerShade;				// queue entries shaded per shadePaths launch (each has room for a shadow ray per light)
+
+	cl_kernel kernels[NUM_KERNELS];
+
+	cl_mem pathBuffer;						// every sample of the batch, slotsPerPixel per pixel
+	cl_mem queueBuffers[2];					// paths to trace at this bounce and at the next
+	cl_mem hitDistanceBuffer;				// distance to the closest hit of each queue entry
+	cl_mem hitKeyBuffer;					// object key of the closest hit of each queue entry (NO_OCCLUDER for a miss)
+	cl_mem shadowRayBuffer;					// shadow rays of the queue entries being shaded, numLights per entry
+	cl_mem shadowQueueBuffer;				// shadow rays to test
+	cl_mem counterBuffer;					// queue lengths
+	cl_mem pixelSampleBuffer;				// number of samples of each pixel of the batch
+	cl_mem occluderBuffer;					// last occluder of each pixel's lights
+
+	DeviceTimes times;						// device time of the last frame's kernels and readbacks (if the queues are profiling)
+	std::vector<cl_event> kernelEvents;		// events of the current batch's kernels, only kept while profiling
+} WavefrontPipeline;
+
+// create the kernels, bind the scene to them and create the device buffers for a width x height frame
+// the kernels add their ray counts to rayCounterBuffer when the program is built with -DRAY_COUNTERS (see RayCounters.cl)
+// prints the reason and returns false if any step fails
+bool createWavefrontPipeline(WavefrontPipeline* pipeline, const RenderContext* rc, const SceneBuffers* sceneBuffers, int width, int height, unsigned int aaLevel, unsigned int numLights, cl_mem rayCounterBuffer);
+
+// render a frame into clBufferOut and read each batch of rows back into its place in frame (rows may be padded)
+// if stream is not NULL, each batch is written to it once read back
+// the kernelPass argument (0) of every kernel must already be set
+bool renderWavefront(WavefrontPipeline* pipeline, const RenderContext* rc, cl_mem clBufferOut, const FrameView* frame, BmpStream* stream);
+
+void releaseWavefrontPipeline(WavefrontPipeline* pipeline);
+
+#endif // __WAVEFRONT_H